@@ -0,0 +1,205 @@
+#include "EntityBVH.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <stack>
+
+//-----------------------------------------------------------------------------
+// Instance transforms
+//-----------------------------------------------------------------------------
+void EntityBVH::updateInstance(Instance& instance, FVec3 position, Basis basis){
+	/*
+	Sets the transform of an instance and refreshes everything derived from
+	it. The basis doesn't need to be orthonormal, but it can't be degenerate.
+	*/
+
+	instance.position = position;
+	instance.basis = basis;
+
+	// Rows of the inverse of the matrix whose columns are the basis vectors
+	FVec3 row_0 = basis.v1.cross(basis.v2);
+	FVec3 row_1 = basis.v2.cross(basis.v0);
+	FVec3 row_2 = basis.v0.cross(basis.v1);
+	float determinant = basis.v0.dot(row_0);
+	assert(abs(determinant) > ARBITRARY_EPSILON);
+
+	float inverse_determinant = 1.0f / determinant;
+	instance.inverse_basis = {
+		row_0 * inverse_determinant,
+		row_1 * inverse_determinant,
+		row_2 * inverse_determinant,
+	};
+
+	instance.world_bounds = transformedBounds(
+		instance.mesh_tree->tree_bounds, position, basis);
+}
+
+FCuboid EntityBVH::transformedBounds(const FCuboid& bounds, FVec3 position, Basis basis){
+	/*
+	World-space AABB of a transformed mesh-space AABB. Transforms the center
+	and projects the half extents onto each world axis.
+	*/
+
+	FVec3 half_extent = bounds.extent * 0.5f;
+	FVec3 center = bounds.origin + half_extent;
+	FVec3 world_center =
+		basis.v0 * center.x +
+		basis.v1 * center.y +
+		basis.v2 * center.z +
+		position;
+
+	FVec3 world_half_extent;
+	for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+		world_half_extent[axis] =
+			abs(basis.v0[axis]) * half_extent.x +
+			abs(basis.v1[axis]) * half_extent.y +
+			abs(basis.v2[axis]) * half_extent.z;
+	}
+
+	return {world_center - world_half_extent, world_half_extent * 2.0f};
+}
+
+FCuboid EntityBVH::mergedBounds(const FCuboid& a, const FCuboid& b){
+	FVec3 min_corner;
+	FVec3 max_corner;
+	for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+		min_corner[axis] = min(a.origin[axis], b.origin[axis]);
+		max_corner[axis] = max(
+			a.origin[axis] + a.extent[axis],
+			b.origin[axis] + b.extent[axis]);
+	}
+	return {min_corner, max_corner - min_corner};
+}
+
+Ray EntityBVH::toInstanceSpace(const Instance& instance, Ray ray){
+	/*
+	The direction is NOT normalized afterwards. That keeps values of t
+	identical between world and mesh space, so hits can be compared directly.
+	*/
+
+	const Basis& inverse = instance.inverse_basis;
+	FVec3 offset = ray.origin - instance.position;
+	Ray local_ray = {
+		{inverse.v0.dot(offset), inverse.v1.dot(offset), inverse.v2.dot(offset)},
+		{inverse.v0.dot(ray.dir), inverse.v1.dot(ray.dir), inverse.v2.dot(ray.dir)},
+	};
+	return local_ray;
+}
+
+FVec3 EntityBVH::normalToWorldSpace(const Instance& instance, FVec3 normal){
+	/*
+	Normals transform by the inverse transpose.
+	*/
+
+	const Basis& inverse = instance.inverse_basis;
+	FVec3 world_normal =
+		inverse.v0 * normal.x +
+		inverse.v1 * normal.y +
+		inverse.v2 * normal.z;
+	return world_normal.normal();
+}
+
+//-----------------------------------------------------------------------------
+// Tree construction
+//-----------------------------------------------------------------------------
+void EntityBVH::buildTree(TreeData& tree){
+	/*
+	Median split along the longest axis of the instance centers, one instance
+	per leaf. Instance transforms need to be up to date before this is called.
+	*/
+
+	struct BuildTask{
+		NodeIndex node_index;
+		Int32 first;
+		Int32 count;
+	};
+
+	tree.nodes.clear();
+	Int32 num_instances = (Int32) tree.instances.size();
+	if(num_instances == 0){
+		return;
+	}
+
+	std::vector<FVec3> centers(num_instances);
+	for(Int32 i = 0; i < num_instances; ++i){
+		const FCuboid& bounds = tree.instances[i].world_bounds;
+		centers[i] = bounds.origin + bounds.extent * 0.5f;
+	}
+
+	std::vector<Int32> order(num_instances);
+	std::iota(order.begin(), order.end(), 0);
+
+	tree.nodes.reserve(2 * num_instances - 1);
+	tree.nodes.push_back(Node{});
+
+	std::stack<BuildTask> tasks;
+	tasks.push({0, 0, num_instances});
+	while(!tasks.empty()){
+		BuildTask task = tasks.top();
+		tasks.pop();
+
+		if(task.count == 1){
+			Int32 instance_index = order[task.first];
+			Node& leaf = tree.nodes[task.node_index];
+			leaf.bounds = tree.instances[instance_index].world_bounds;
+			leaf.instance_index = instance_index;
+			continue;
+		}
+
+		// Find the axis with the largest spread of centers
+		FVec3 min_center = centers[order[task.first]];
+		FVec3 max_center = min_center;
+		for(Int32 i = task.first; i < task.first + task.count; ++i){
+			for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+				min_center[axis] = min(min_center[axis], centers[order[i]][axis]);
+				max_center[axis] = max(max_center[axis], centers[order[i]][axis]);
+			}
+		}
+		FVec3 spread = max_center - min_center;
+		int split_axis = AXIS_X;
+		for(int axis = 1; axis < NUM_3D_AXES; ++axis){
+			if(spread[axis] > spread[split_axis]){
+				split_axis = axis;
+			}
+		}
+
+		// Ties are broken by index so rebuilds are deterministic
+		Int32 mid = task.first + task.count / 2;
+		std::nth_element(
+			order.begin() + task.first,
+			order.begin() + mid,
+			order.begin() + task.first + task.count,
+			[&centers, split_axis](Int32 a, Int32 b){
+				float a_val = centers[a][split_axis];
+				float b_val = centers[b][split_axis];
+				return a_val < b_val || (a_val == b_val && a < b);
+			});
+
+		NodeIndex left_child_index = (NodeIndex) tree.nodes.size();
+		tree.nodes[task.node_index].left_child_index = left_child_index;
+		tree.nodes.push_back(Node{});
+		tree.nodes.push_back(Node{});
+		tasks.push({left_child_index, task.first, mid - task.first});
+		tasks.push({left_child_index + 1, mid, task.first + task.count - mid});
+	}
+
+	refitTree(tree);
+}
+
+void EntityBVH::refitTree(TreeData& tree){
+	/*
+	Recalculates every node's bounds from the current instance bounds
+	without changing the topology.
+	*/
+
+	for(Int64 i = (Int64) tree.nodes.size() - 1; i >= 0; --i){
+		Node& node = tree.nodes[i];
+		if(node.left_child_index == INVALID_NODE_INDEX){
+			node.bounds = tree.instances[node.instance_index].world_bounds;
+		}else{
+			node.bounds = mergedBounds(
+				tree.nodes[node.left_child_index].bounds,
+				tree.nodes[node.left_child_index + 1].bounds);
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Primitives.hpp"
+#include "Geometry.hpp"
+#include "Types.hpp"
+#include "Constants.hpp"
+#include "KDTree.hpp"
+
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// EntityBVH
+//-----------------------------------------------------------------------------
+namespace EntityBVH{
+	/*
+	Top level of a two-level acceleration structure for moving entities. Each
+	instance pairs an entity transform with a bottom-level MeshKDTree that
+	lives in mesh space and never changes. Only this tree is touched when
+	entities move.
+
+	The topology is built once for a given set of instances. After that,
+	refitTree() recalculates the node bounds bottom-up in O(instances), which
+	is cheap enough to run every frame. Tree quality degrades if entities
+	drift far from where they were when the tree was built, so callers can
+	rebuild whenever they like.
+
+	NOTE: Nodes are stored so that children always come after their parent.
+		Iterating backwards is a valid bottom-up traversal. Like the
+		VoxelKDTree, the right child is at left_child_index + 1.
+	*/
+
+	typedef Int32 NodeIndex;
+	static constexpr NodeIndex INVALID_NODE_INDEX = -1;
+
+	struct Instance{
+		EntityHandle entity;
+		ResourceHandle mesh_handle;
+		const MeshKDTree::TreeData* mesh_tree;
+
+		// Mesh to world transform. Same convention as makeModelMatrix.
+		FVec3 position;
+		Basis basis;
+
+		// Derived from the values above by updateInstance()
+		Basis inverse_basis;  // Rows of the inverse, for world to mesh space
+		FCuboid world_bounds;
+	};
+
+	struct Node{
+		FCuboid bounds;
+		NodeIndex left_child_index{INVALID_NODE_INDEX};  // Invalid for leaves
+		Int32 instance_index{-1};  // Only defined for leaves
+	};
+
+	struct TreeData{
+		std::vector<Node> nodes;
+		std::vector<Instance> instances;
+	};
+
+	// Deepest possible tree for a reasonable number of instances. Used to
+	// size fixed traversal stacks.
+	static constexpr Int32 MAX_TREE_DEPTH = 64;
+
+	void updateInstance(Instance& instance, FVec3 position, Basis basis);
+	void buildTree(TreeData& tree);
+	void refitTree(TreeData& tree);
+
+	FCuboid transformedBounds(const FCuboid& bounds, FVec3 position, Basis basis);
+	FCuboid mergedBounds(const FCuboid& a, const FCuboid& b);
+	Ray toInstanceSpace(const Instance& instance, Ray ray);
+	FVec3 normalToWorldSpace(const Instance& instance, FVec3 normal);
+};
@@ -1,5 +1,13 @@
 #include "KDTree.hpp"
 
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 //-----------------------------------------------------------------------------
 // VoxelKDTree
 //-----------------------------------------------------------------------------
@@ -89,12 +97,6 @@ void VoxelKDTree::debuggingPrintPackedData(VoxelKDTree::PackedData data){
 	printf("<Pack %s'>", &as_text[0]);
 }
 
-Int64 VoxelKDTree::writeToBuffer(const TreeData* tree){
-	/*
-	
-	*/
-}
-
 //-----------------------------------------------------------------------------
 // Tree Builder Namespace
 //-----------------------------------------------------------------------------
@@ -118,8 +120,11 @@ bool isInBounds(IVec3 vec){
 Voxel VoxelKDTree::TreeBuilder::VoxelLookup::voxelAtCoord(
 	IVec3 global_voxel_coord){
 	/*
-	Returns the voxel at the given global coordinate
-	THREADING: Unsafe reference to the chunk table
+	Returns the voxel at the given global coordinate. Unloaded chunks are
+	air.
+
+	THREADING: Chunks are copied into the cache under a ReadGuard, so the
+		table can change underneath without invalidating them.
 	*/
 
 	// Update cached chunk if we didn't have it yet.
@@ -164,7 +169,15 @@ Voxel VoxelKDTree::TreeBuilder::VoxelLookup::voxelAtCoord(
 		// Write the new chunk.
 		m_cached_chunk_coords[0] = chunk_coord;
 		m_num_misses_since_last_refresh[0] = 0;
-		m_cached_chunks[0] = *m_table_ptr->getChunkPtr(chunk_coord);
+		ChunkTable::ReadGuard read_guard(*m_table_ptr);
+		const RawVoxelChunk* chunk_ptr = m_table_ptr->getChunkPtr(chunk_coord);
+		if(chunk_ptr != NULL){
+			m_cached_chunks[0] = *chunk_ptr;
+		}else{
+			for(Int32 i = 0; i < CHUNK_VOLUME; ++i){
+				m_cached_chunks[0].data[i].type = VoxelType::Air;
+			}
+		}
 		read_index = 0;
 	}
 	
@@ -267,6 +280,215 @@ VoxelKDTree::TreeBuilder::generateSummary(const ChunkTable* table,
 	return output_summary;
 }
 
+VoxelKDTree::TreeBuilder::SummedVolumeTable::BoxSums 
+VoxelKDTree::TreeBuilder::SummedVolumeTable::boxSums(const ICuboid& box) const{
+	/*
+	Sums over a box in tree space by inclusion-exclusion of the 8 corners.
+	*/
+
+	Int32 x0 = box.origin.x;
+	Int32 y0 = box.origin.y;
+	Int32 z0 = box.origin.z;
+	Int32 x1 = x0 + box.extent.x;
+	Int32 y1 = y0 + box.extent.y;
+	Int32 z1 = z0 + box.extent.z;
+	assert(x0 >= 0 && y0 >= 0 && z0 >= 0);
+	assert(x1 < dims.x && y1 < dims.y && z1 < dims.z);
+
+	Uint64 corners[8] = {
+		linearIndex(x1, y1, z1), linearIndex(x0, y1, z1), 
+		linearIndex(x1, y0, z1), linearIndex(x1, y1, z0),
+		linearIndex(x0, y0, z1), linearIndex(x0, y1, z0), 
+		linearIndex(x1, y0, z0), linearIndex(x0, y0, z0),
+	};
+	auto box_sum = [&corners](const std::vector<Uint32>& prefix_sums){
+		// Wraps around modulo 2^32, which is fine. See the struct comment.
+		return prefix_sums[corners[0]] 
+			- prefix_sums[corners[1]] - prefix_sums[corners[2]] - prefix_sums[corners[3]] 
+			+ prefix_sums[corners[4]] + prefix_sums[corners[5]] + prefix_sums[corners[6]]
+			- prefix_sums[corners[7]];
+	};
+
+	return {
+		.num_solid=box_sum(solid_counts),
+		.type_index_sum=box_sum(type_index_sums),
+		.type_index_square_sum=box_sum(type_index_square_sums)
+	};
+}
+
+bool 
+VoxelKDTree::TreeBuilder::buildSummedVolumeTable(const ChunkTable& table, 
+	ICuboid bounds, SummedVolumeTable& output){
+	/*
+	Given tree bounds in world space, compute the prefix sums for every
+	voxel inside them. Unloaded chunks count as air.
+
+	Returns false if the sums over a single plane of the tree could exceed
+	32 bits, in which case the table can't be used.
+	*/
+
+	constexpr Int32 NUM_POSSIBLE_TYPES = 256;
+	constexpr Uint64 MAX_EXACT_SUM = MAX_UINT32_VALUE;
+
+	IVec3 extent = bounds.extent;
+	output.dims = {extent.x + 1, extent.y + 1, extent.z + 1};
+	Uint64 num_entries = 
+		(Uint64) output.dims.x * output.dims.y * output.dims.z;
+	output.solid_counts.assign(num_entries, 0);
+	output.type_index_sums.assign(num_entries, 0);
+	output.type_index_square_sums.assign(num_entries, 0);
+	output.types_by_index.clear();
+
+	ChunkTable::ReadGuard read_guard(table);
+
+	// Dense type indices, in order of first appearance
+	Int32 index_by_type[NUM_POSSIBLE_TYPES];
+	for(Int32 i = 0; i < NUM_POSSIBLE_TYPES; ++i){
+		index_by_type[i] = -1;
+	}
+
+	// STEP 1: Raw values, offset by one in every dimension so that the
+	// zero planes of the table stay zero.
+	IVec3 bounds_end = bounds.origin + bounds.extent;
+	IVec3 chunk_min = chunkCoordFromVoxelCoord(bounds.origin);
+	IVec3 chunk_max = chunkCoordFromVoxelCoord(bounds_end - IVec3{1, 1, 1});
+	for(Int32 cz = chunk_min.z; cz <= chunk_max.z; ++cz)
+	for(Int32 cy = chunk_min.y; cy <= chunk_max.y; ++cy)
+	for(Int32 cx = chunk_min.x; cx <= chunk_max.x; ++cx){
+		IVec3 chunk_coord = {cx, cy, cz};
+		IVec3 chunk_origin = chunk_coord * CHUNK_LEN;
+		const RawVoxelChunk* chunk_ptr = table.getChunkPtr(chunk_coord);
+
+		// Part of the chunk inside the bounds, in local coordinates
+		IVec3 local_min, local_max;
+		for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+			local_min[axis] = std::max(bounds.origin[axis] - chunk_origin[axis], 0);
+			local_max[axis] = std::min(bounds_end[axis] - chunk_origin[axis], CHUNK_LEN);
+		}
+
+		for(Int32 z = local_min.z; z < local_max.z; ++z)
+		for(Int32 y = local_min.y; y < local_max.y; ++y)
+		for(Int32 x = local_min.x; x < local_max.x; ++x){
+			VoxelType type = VoxelType::Air;
+			if(chunk_ptr != NULL){
+				type = chunk_ptr->data[linearChunkIndex(x, y, z)].type;
+			}
+			if(index_by_type[type] == -1){
+				index_by_type[type] = output.types_by_index.size();
+				output.types_by_index.push_back(type);
+			}
+
+			Uint32 type_index = index_by_type[type];
+			IVec3 tree_coord = chunk_origin + IVec3{x, y, z} - bounds.origin;
+			Uint64 i = output.linearIndex(
+				tree_coord.x + 1, tree_coord.y + 1, tree_coord.z + 1);
+			output.solid_counts[i] = !isAir(type);
+			output.type_index_sums[i] = type_index;
+			output.type_index_square_sums[i] = type_index * type_index;
+		}
+	}
+
+	// Summaries only ever ask about single planes, so only those sums need
+	// to fit. The moment test also squares the index sum, which has to fit
+	// in 64 bits.
+	Uint64 max_index = std::max((Uint64) output.types_by_index.size() - 1, (Uint64) 1);
+	Uint64 max_plane_area = std::max({
+		(Uint64) extent.x * extent.y, 
+		(Uint64) extent.x * extent.z, 
+		(Uint64) extent.y * extent.z
+	});
+	if(max_plane_area * max_index * max_index > MAX_EXACT_SUM){
+		printf("WARNING: Tree bounds are too large for a summed volume table\n");
+		return false;
+	}
+
+	// STEP 2: Prefix sums along each axis in turn
+	const IVec3& dims = output.dims;
+	Uint64 strides[NUM_3D_AXES] = {
+		1, 
+		(Uint64) dims.x, 
+		(Uint64) dims.x * dims.y
+	};
+	std::vector<Uint32>* all_tables[] = {
+		&output.solid_counts, 
+		&output.type_index_sums, 
+		&output.type_index_square_sums
+	};
+	for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+		Uint64 stride = strides[axis];
+		for(Int32 z = 0; z < dims.z; ++z)
+		for(Int32 y = 0; y < dims.y; ++y)
+		for(Int32 x = 0; x < dims.x; ++x){
+			IVec3 coord = {x, y, z};
+			if(coord[axis] == 0){
+				continue;
+			}
+
+			Uint64 i = output.linearIndex(x, y, z);
+			for(std::vector<Uint32>* table_ptr : all_tables){
+				(*table_ptr)[i] += (*table_ptr)[i - stride];
+			}
+		}
+	}
+
+	return true;
+}
+
+VoxelKDTree::TreeBuilder::AxisSummary 
+VoxelKDTree::TreeBuilder::generateSummary(const SummedVolumeTable& volume_table, 
+	ICuboid volume, Axis axis){
+	/*
+	Same output as the version that scans the chunk table, but each plane
+	is a single box query. The volume is in tree space.
+	*/
+
+	constexpr IVec2 ITERATION_PLANES[] = {
+		{AXIS_Y, AXIS_Z},
+		{AXIS_X, AXIS_Z},
+		{AXIS_X, AXIS_Y},
+	};
+	const IVec2 offsets = ITERATION_PLANES[axis];
+
+	int axis_extent = volume.extent[axis];
+	Int64 total_solids = 0;
+	Int64 plane_area = volume.extent[offsets[0]] * volume.extent[offsets[1]];
+	Int64 plane_perimeter = 
+		2 * (volume.extent[offsets[0]]) + 2 * (volume.extent[offsets[1]]);
+	std::vector<Int64> num_solid_in_plane;
+	std::vector<VoxelType> type_if_homogenous;
+	num_solid_in_plane.reserve(axis_extent);
+	type_if_homogenous.reserve(axis_extent);
+
+	ICuboid plane = volume;
+	plane.extent[axis] = 1;
+	for(int a = 0; a < axis_extent; ++a){
+		plane.origin[axis] = volume.origin[axis] + a;
+		SummedVolumeTable::BoxSums sums = volume_table.boxSums(plane);
+		total_solids += sums.num_solid;
+		num_solid_in_plane.push_back(sums.num_solid);
+
+		// All indices are equal exactly when sum^2 == count * sum_of_squares
+		VoxelType plane_type = VoxelType::EMPTY;
+		Uint64 index_sum = sums.type_index_sum;
+		if(index_sum * index_sum == plane_area * (Uint64) sums.type_index_square_sum){
+			plane_type = volume_table.types_by_index[index_sum / plane_area];
+		}
+		type_if_homogenous.push_back(plane_type);
+	}
+
+	Int16 offset_from_orign = volume.origin[axis];
+	AxisSummary output_summary = {
+		.axis=axis,
+		.offset_from_origin=offset_from_orign, 
+		.plane_perimeter=plane_perimeter,
+		.plane_area=plane_area,
+		.total_solids=total_solids, 
+		.num_solid_in_plane=num_solid_in_plane, 
+		.type_if_homogenous=type_if_homogenous
+	};
+	return output_summary;
+}
+
 void 
 VoxelKDTree::TreeBuilder::debuggingPrintAxisSummary(
 	const AxisSummary& summary){
@@ -349,20 +571,33 @@ VoxelKDTree::TreeBuilder::generateSplit(const SplitReferenceData& ref){
 	SplitRecommendation all_recs[3] = {};
 
 	// STEP 1: Survey the axis and decide where to split
+	auto summarize = [&ref, tree_ptr](Axis summary_axis){
+		if(ref.volume_table != NULL){
+			return generateSummary(*ref.volume_table, ref.node_cuboid, summary_axis);
+		}
+		return generateSummary(ref.chunk_table, tree_ptr->bounds.origin, 
+			ref.node_cuboid, summary_axis);
+	};
+
+	// Scores are only comparable between axes for the same offset picker
+	auto pick_offset = [&ref](const AxisSummary& summary){
+		if(ref.settings->optimization_level == OPTIMIZE_EXHAUSTIVE){
+			return offsetPickerBinnedSAH(ref, summary);
+		}
+		return offsetPickerLongestRunBias(ref, summary);
+	};
+
 	Axis axis = axisPickerLongest(ref);
-	all_summaries[axis] = generateSummary(
-		ref.chunk_table, tree_ptr->bounds.origin, ref.node_cuboid, axis);
+	all_summaries[axis] = summarize(axis);
 	//all_recs[axis] = offsetPickerStupid(ref, all_summaries[axis]);
-	all_recs[axis] = offsetPickerLongestRunBias(ref, all_summaries[axis]);
+	all_recs[axis] = pick_offset(all_summaries[axis]);
 	Axis best_axis = axis;
-	if(ref.settings->optimization_level == OPTIMIZE_EXHAUSTIVE){
+	if(ref.settings->optimization_level >= OPTIMIZE_HIGH){
 		float best_split_score = all_recs[axis].split_score;
 		for(int i = 0; i < NUM_3D_AXES; ++i){
 			if(i != axis){
-				all_summaries[i] = generateSummary(ref.chunk_table, 
-					tree_ptr->bounds.origin, ref.node_cuboid, (Axis) i);
-				all_recs[i] = offsetPickerLongestRunBias(ref, 
-					all_summaries[i]);
+				all_summaries[i] = summarize((Axis) i);
+				all_recs[i] = pick_offset(all_summaries[i]);
 			}
 
 			if(all_recs[i].split_score > best_split_score){
@@ -373,6 +608,33 @@ VoxelKDTree::TreeBuilder::generateSplit(const SplitReferenceData& ref){
 	}
 	AxisSummary& summary = all_summaries[best_axis];
 	SplitRecommendation rec = all_recs[best_axis];
+
+	// The SAH score is the negated cost of splitting, where a mixed child 
+	// costs one per solid voxel. A mixed leaf is also traced by walking its
+	// voxels, which costs a step per voxel along each axis, so it costs 
+	// whichever is more. A split that doesn't beat that only adds nodes. 
+	// The root is always split. Off unless should_terminate_by_sah is set.
+	// NOTE: Lower step costs make fewer nodes but longer walks. At 0.25 
+	//	terrain trees had about 20% fewer nodes and traced about 5% slower.
+	constexpr float ARBITRARY_VOXEL_STEP_COST = 0.25;
+
+	SplitResult result = {};
+	bool is_leaf_cost_checked = ref.settings->optimization_level == OPTIMIZE_EXHAUSTIVE 
+		&& ref.settings->should_terminate_by_sah && ref.node_depth > 0;
+	if(is_leaf_cost_checked){
+		Uint64 solid_count = 0;
+		for(Int64 num_solid : summary.num_solid_in_plane){
+			solid_count += num_solid;
+		}
+		IVec3 extent = ref.node_cuboid.extent;
+		float walk_cost = ARBITRARY_VOXEL_STEP_COST * (extent.x + extent.y + extent.z);
+		float leaf_cost = std::max((float) solid_count, walk_cost);
+		if(-rec.split_score >= leaf_cost){
+			result.is_leaf_cheaper = true;
+			result.leaf.pack = mixedLeafState(solid_count, volume(ref.node_cuboid));
+			return result;
+		}
+	}
 	CuboidSplit split_cuboids = splitCuboid(ref.node_cuboid, rec.plane);
 
 	// STEP 2: Get information about the two children.
@@ -405,7 +667,6 @@ VoxelKDTree::TreeBuilder::generateSplit(const SplitReferenceData& ref){
 
 	// STEP 3: Perform all the nasty bit packing and formatting
 	// before returning the result.
-	SplitResult result;
 	result.split = rec.plane;
 	for(int i = 0; i < NUM_CHILDREN_PER_SPLIT; ++i){
 		result.cuboids[i] = split_cuboids.results[i];
@@ -413,12 +674,10 @@ VoxelKDTree::TreeBuilder::generateSplit(const SplitReferenceData& ref){
 		result.children[i] = child_nodes[i];	
 	}
 
-	if(ref.settings->should_calculate_non_leaf_properties){
-		assert(false);  // TODO: Implement
-	}else{
-		result.is_properties_defined[0] = false;
-		result.is_properties_defined[1] = false;
-	}
+	// NOTE: Properties are filled in by calculateProperties() once the
+	// whole tree exists.
+	result.is_properties_defined[0] = false;
+	result.is_properties_defined[1] = false;
 
 	return result;
 }
@@ -545,6 +804,128 @@ VoxelKDTree::TreeBuilder::offsetPickerLongestRunBias(
 	};
 }
 
+VoxelKDTree::TreeBuilder::SplitRecommendation 
+VoxelKDTree::TreeBuilder::offsetPickerBinnedSAH(
+	const SplitReferenceData& ref, const AxisSummary& summary){
+	/*
+	Offset picker that estimates the cost of tracing through the node 
+	with the surface area heuristic. Evaluates a fixed number of evenly 
+	spaced candidate planes (bins), plus the planes that cut empty or
+	completely solid space off either end of the node.
+
+	Solid voxels are the primitives, except that a child which is 
+	completely solid or completely empty costs nothing, since it becomes a
+	single leaf that's resolved the moment a ray enters it.
+
+	The score is the negated cost, so scores from different axes of the
+	same node can be compared directly.
+
+	ATTRIBUTION: Empty space bonus from Vlastimil Havran's thesis,
+		"Heuristic Ray Shooting Algorithms" (2000). Binning from Ingo Wald,
+		"On fast Construction of SAH-based Bounding Volume Hierarchies" (2007).
+	*/
+
+	constexpr float ARBITRARY_TRAVERSAL_COST = 1.0;
+	constexpr float ARBITRARY_EMPTY_SPACE_BONUS = 0.2;
+
+	const auto& solids_vec = summary.num_solid_in_plane;
+	int num_planes = solids_vec.size();
+	if(num_planes < 2){
+		return {
+			.plane={summary.axis, 0},
+			.split_score=-LARGE_FLOAT
+		};
+	}
+
+	// Number of solids before each plane, so every candidate is O(1)
+	std::vector<Int64> solids_before(num_planes + 1, 0);
+	for(int i = 0; i < num_planes; ++i){
+		solids_before[i + 1] = solids_before[i] + solids_vec[i];
+	}
+	Int64 total_solids = solids_before[num_planes];
+
+	// A box that's n planes long has surface area 2*area + n*perimeter
+	float plane_area = summary.plane_area;
+	float plane_perimeter = summary.plane_perimeter;
+	float parent_surface_area = 2 * plane_area + num_planes * plane_perimeter;
+
+	auto child_cost = [&summary](Int64 num_solid, Int64 num_child_planes){
+		Int64 child_volume = summary.plane_area * num_child_planes;
+		bool is_uniform = (num_solid == 0 || num_solid == child_volume);
+		return is_uniform ? 0.0f : (float) num_solid;
+	};
+
+	int best_offset = -1;
+	float best_cost = LARGE_FLOAT;
+	auto evaluate = [&](int local_offset){
+		if(local_offset < 1 || local_offset >= num_planes){
+			return;
+		}
+
+		Int64 near_solids = solids_before[local_offset];
+		Int64 far_solids = total_solids - near_solids;
+		int near_planes = local_offset;
+		int far_planes = num_planes - local_offset;
+		float near_surface_area = 2 * plane_area + near_planes * plane_perimeter;
+		float far_surface_area = 2 * plane_area + far_planes * plane_perimeter;
+
+		float cost = ARBITRARY_TRAVERSAL_COST + (
+			near_surface_area * child_cost(near_solids, near_planes) + 
+			far_surface_area * child_cost(far_solids, far_planes)
+		) / parent_surface_area;
+		if(near_solids == 0 || far_solids == 0){
+			cost *= (1 - ARBITRARY_EMPTY_SPACE_BONUS);
+		}
+
+		// Strictly less, so ties go to the first candidate
+		if(cost < best_cost){
+			best_cost = cost;
+			best_offset = local_offset;
+		}
+	};
+
+	// Evenly spaced bins. If there are fewer planes than bins, this
+	// evaluates every plane.
+	int num_bins = std::max(ref.settings->num_sah_bins, 2);
+	for(int bin = 1; bin < num_bins; ++bin){
+		evaluate((Int64) bin * num_planes / num_bins);
+	}
+
+	// Cut empty space and completely solid space off the ends explicitly
+	auto is_empty = [&solids_vec](int i){return solids_vec[i] == 0;};
+	auto is_full = [&solids_vec, &summary](int i){
+		return solids_vec[i] == summary.plane_area;
+	};
+	int first_non_empty = 0;
+	while(first_non_empty < num_planes && is_empty(first_non_empty)){
+		++first_non_empty;
+	}
+	int last_non_empty = num_planes - 1;
+	while(last_non_empty >= 0 && is_empty(last_non_empty)){
+		--last_non_empty;
+	}
+	int first_non_full = 0;
+	while(first_non_full < num_planes && is_full(first_non_full)){
+		++first_non_full;
+	}
+	int last_non_full = num_planes - 1;
+	while(last_non_full >= 0 && is_full(last_non_full)){
+		--last_non_full;
+	}
+	evaluate(first_non_empty);
+	evaluate(last_non_empty + 1);
+	evaluate(first_non_full);
+	evaluate(last_non_full + 1);
+
+	assert(best_offset != -1);
+	Int16 tree_space_offset = summary.offset_from_origin + best_offset;
+	assert(tree_space_offset != INVALID_PLANE_OFFSET);
+	return {
+		.plane={summary.axis, tree_space_offset},
+		.split_score=-best_cost
+	};
+}
+
 VoxelKDTree::TreeBuilder::CuboidSplit 
 VoxelKDTree::TreeBuilder::splitCuboid(ICuboid cuboid, SplitPlane split){
 	/*
@@ -628,7 +1009,9 @@ VoxelKDTree::TreeBuilder::leafStates(const AxisSummary& summary,
 			state = VALUE_EMPTY_LEAF;
 		}else if(solid_count == child_volume){  // Status: Completely solid	
 			state &= ~FLAG_LEAF_IS_EMPTY;
-			if(is_homogenous[i]){
+			// Slices that each mix types report EMPTY, which would otherwise
+			// "match" each other and produce a leaf of type EMPTY.
+			if(is_homogenous[i] && types[i] != VoxelType::EMPTY){
 				// WARNING: Assumes palette id is the type's numeric value!
 				Bytes2 palette_id_bits = 
 					(types[i] << SHIFT_LEAF_PALETTE_INDEX);
@@ -639,13 +1022,7 @@ VoxelKDTree::TreeBuilder::leafStates(const AxisSummary& summary,
 				state = VALUE_SOLID_MIXED_LEAF;  // 100% solid, mixed type.
 			}
 		}else{  // Status: Mixed solid/empty.
-			state &= ~FLAG_LEAF_IS_EMPTY;
-			state |= FLAG_LEAF_IS_MIXED_TYPE;
-			
-			float fill_percent = ((float) solid_count / child_volume) * 100;
-			Bytes2 percent_full = std::max(1.0f, fill_percent);
-			assert(percent_full > 0 && percent_full <= 100);
-			state |= percent_full << SHIFT_LEAF_PERCENT_FULL;
+			state = mixedLeafState(solid_count, child_volume);
 		}
 
 		partition_results[i] = state;
@@ -654,128 +1031,134 @@ VoxelKDTree::TreeBuilder::leafStates(const AxisSummary& summary,
 	return partition_results;
 }
 
-VoxelKDTree::TreeData* 
-VoxelKDTree::TreeBuilder::buildTree(const ChunkTable& table, 
-	VoxelKDTree::BuildSettings settings){
+VoxelKDTree::PackedData 
+VoxelKDTree::TreeBuilder::mixedLeafState(Uint64 solid_count, Uint64 volume){
 	/*
-	Given access to a chunk table and a settings object, build a 
-	tree with the given configuration.
+	Packed leaf for a volume that's part solid and part empty. Only the
+	fill percentage is stored, so tracing it needs the chunk table.
 	*/
 
-	struct ConstructionBlock{
-		int node_depth;
-		NodeIndex unfinished_node;
-		NodeIndex parent_index;
-		ICuboid bounds;
-	};
+	assert(solid_count > 0 && solid_count < volume);
 
-	constexpr Int32 ARBITRARY_INITIAL_NODE_CAPACITY = 20;
-	constexpr Int32 ARBITRARY_MAX_TREE_DEPTH = 100;
-	constexpr Int32 MAX_POSSIBLE_PREALLOCATION_DEPTH = 30;
+	PackedData state = VALUE_UNSET_NODE | VALUE_LEAF_NODE;
+	state &= ~FLAG_LEAF_IS_EMPTY;
+	state |= FLAG_LEAF_IS_MIXED_TYPE;
+
+	float fill_percent = ((float) solid_count / volume) * 100;
+	Bytes2 percent_full = std::max(1.0f, fill_percent);
+	assert(percent_full > 0 && percent_full <= 100);
+	state |= percent_full << SHIFT_LEAF_PERCENT_FULL;
+	return state;
+}
 
-	// How much to multiply the capacity by when reallocating
-	constexpr float ARBITRARY_CAPACITY_MULTIPLIER = 2.0;
+void 
+VoxelKDTree::TreeBuilder::reportProgress(BuildProgress& progress, 
+	Int64 finished_volume){
+	/*
+	Adds volume that was turned into leaves. Every call owns a unique
+	interval of the total, so each 10% step gets printed exactly once no
+	matter how many threads are reporting.
+	*/
 
-	TreeData tree;
-	tree.bounds = settings.bounds;  // World space. Nodes are in "tree space"
-	tree.node_capacity = 0;
-	tree.node_count = 1;  // Account for the root node.
-	tree.curr_max_depth = 0;
-	tree.is_packed_tree = settings.should_pack_nodes;
-	tree.has_property_nodes = settings.should_calculate_non_leaf_properties;
-	tree.geometry_nodes_ptr   = NULL;
-	tree.property_nodes_ptr   = NULL;
-	tree.descendant_nodes_ptr = NULL;
-	//assert(!tree.is_packed_tree); // TODO: Remove once unpacked version is done
+	constexpr Int64 NUM_PROGRESS_STEPS = 10;
 
-	assert(settings.max_depth <= ARBITRARY_MAX_TREE_DEPTH);
-	if(settings.should_preallocate_max_node_space){
-		assert(settings.max_depth <= MAX_POSSIBLE_PREALLOCATION_DEPTH);
+	Int64 previous = progress.processed_volume.fetch_add(finished_volume);
+	Int64 current = previous + finished_volume;
+	Int64 previous_step = previous * NUM_PROGRESS_STEPS / progress.total_volume;
+	Int64 current_step = current * NUM_PROGRESS_STEPS / progress.total_volume;
+	if(current_step > previous_step){
+		printf("BuildTree: %li%% Processed\n", 
+			current_step * 100 / NUM_PROGRESS_STEPS);
 	}
+}
 
-	// Node indices are 32bit values. No matter the depth, we can't get
-	// more than the max Int32 value.
-	Int64 max_possible_nodes = MAX_INT32_VALUE;
-	if(settings.max_depth < MAX_POSSIBLE_PREALLOCATION_DEPTH){
-		max_possible_nodes = (1 << (settings.max_depth + 1)) - 1;
-	}
+void 
+VoxelKDTree::TreeBuilder::buildSubtree(const ChunkTable& table, 
+	BuildSettings& settings, const TreeData* tree, 
+	const SummedVolumeTable* volume_table, ConstructionBlock root, 
+	int frontier_depth, SubtreeBuffer& output, BuildProgress& progress){
+	/*
+	Splits the root block until everything below it is a leaf. Nodes are 
+	written to the output buffer with the root at index 0. 
 
-	if(settings.should_preallocate_max_node_space){
-		assert(settings.max_depth > 0);
-		assert(settings.max_depth <= MAX_POSSIBLE_PREALLOCATION_DEPTH);
-		resizeToCapacity(tree, max_possible_nodes);
-	}else{
-		resizeToCapacity(tree, ARBITRARY_INITIAL_NODE_CAPACITY);
-	}
-	tree.geometry_nodes_ptr[0] = {VALUE_UNSET_NODE};  // Placeholder root
+	If frontier_depth is not negative, nodes reached at that depth are left
+	unsplit and recorded in output.frontier_nodes instead.
+
+	NOTE: The tree is only used for its bounds, so any number of threads 
+		can build subtrees of the same tree at once.
+	THREADING: Safe as long as nothing writes to the chunk table.
+	*/
 
-	Int64 total_volume = volume(tree.bounds);
-	Int64 processed_volume = 0;
-	Int32 num_iterations = 0;
+	auto& geometry_nodes = output.geometry_nodes;
+	auto& left_child_indices = output.left_child_indices;
+	geometry_nodes.push_back({VALUE_UNSET_NODE});  // Placeholder root
+	left_child_indices.push_back(INVALID_NODE_INDEX);
 
 	std::stack<ConstructionBlock> stack;
-	ICuboid tree_space_bounds = {{0, 0, 0}, {tree.bounds.extent}};
-	stack.push({0, 0, INVALID_NODE_INDEX, tree_space_bounds});
+	root.unfinished_node = 0;
+	stack.push(root);
 	while(stack.size() > 0){
 		auto [curr_depth, curr_index, parent_index, curr_bounds] = stack.top();
 		stack.pop();
 
-		float ratio = (float) processed_volume / (float) total_volume;
-		printf("BuildTree: %f%% Processed|Iteration %i|Depth:%i"
-			"|CurrIndex:%i|ParentIndex:%i\n",
-			ratio * 100, ++num_iterations, curr_depth, 
-			curr_index, parent_index);
+		if(curr_depth == frontier_depth){
+			output.frontier_nodes.push_back({
+				.block={curr_depth, curr_index, parent_index, curr_bounds},
+				.node_count_when_reached=(NodeIndex) geometry_nodes.size()
+			});
+			continue;
+		}
 
 		// STEP 1: Perform split and init current node.
 		SplitReferenceData split_reference = {
 			.settings=&settings,
 			.chunk_table=&table,
-			.tree_data=&tree,
+			.volume_table=volume_table,
+			.tree_data=tree,
 			.node_to_split=curr_index,
 			.node_cuboid=curr_bounds,
 			.node_depth=curr_depth
 		};
 		SplitResult split_result = generateSplit(split_reference);
+		if(split_result.is_leaf_cheaper){
+			geometry_nodes[curr_index] = split_result.leaf;
+			if(settings.should_report_progress){
+				reportProgress(progress, volume(curr_bounds));
+			}
+			continue;
+		}
 		PackedData curr_data = VALUE_UNSET_NODE;
 		curr_data |= NODE_TYPES_ARR[split_result.split.axis];
 		curr_data |= (split_result.split.offset << SHIFT_PLANE_OFFSET);
-		tree.geometry_nodes_ptr[curr_index] = {.pack=curr_data};
-		tree.curr_max_depth = max(tree.curr_max_depth, curr_depth);
+		geometry_nodes[curr_index] = {.pack=curr_data};
+		output.max_depth = max(output.max_depth, curr_depth);
 
-		// Update descendants array if this is a packed tree
-		Int32 child_base_index;
+		// Packed children go at the end of the buffer. Unpacked ones follow 
+		// the 2n+1 rule, which only holds if this subtree is the whole tree.
+		NodeIndex child_base_index;
 		if(settings.should_pack_nodes){
-			child_base_index = tree.node_count;
-			tree.descendant_nodes_ptr[curr_index].left_child_index 
-				= child_base_index;
+			child_base_index = geometry_nodes.size();
+			left_child_indices[curr_index] = child_base_index;
 		}else{
 			child_base_index = 2 * curr_index + 1;
 		}
-
-		// See if we need to resize
-		if(tree.node_count + 2 > tree.node_capacity){
-			Int32 new_size = min(
-				(Int32) (tree.node_capacity * ARBITRARY_CAPACITY_MULTIPLIER),
-				(Int32) max_possible_nodes);
-			bool is_successful = resizeToCapacity(tree, new_size);
-			if(!is_successful){
-				printf("ERROR: Attempt to resize to capacity %i failed!\n",
-					new_size);
-				return NULL;
-			}
+		Uint64 required_size = child_base_index + NUM_CHILDREN_PER_SPLIT;
+		if(geometry_nodes.size() < required_size){
+			geometry_nodes.resize(required_size, {VALUE_UNSET_NODE});
+			left_child_indices.resize(required_size, INVALID_NODE_INDEX);
 		}
 
 		// STEP 2: Deal with the children
-		for(int i = 0; i < 2; ++i){
+		Int64 finished_volume = 0;
+		for(int i = 0; i < NUM_CHILDREN_PER_SPLIT; ++i){
 			ICuboid node_bounds = split_result.cuboids[i];
 			GeometryNode node = split_result.children[i];
 			bool is_leaf_node = split_result.is_leaf_node[i];
-			processed_volume += (volume(node_bounds) * is_leaf_node);
+			finished_volume += (volume(node_bounds) * is_leaf_node);
 
-			Int32 child_index = child_base_index + i;
+			NodeIndex child_index = child_base_index + i;
 			if(is_leaf_node){
-				//node_counts[INDEX_LEAF_AIR_COUNT]
-				tree.geometry_nodes_ptr[child_index] = node;
+				geometry_nodes[child_index] = node;
 			}else{
 				// This node will need to be split. 
 				// Pack a ConstructionBlock and stick it on the stack.
@@ -787,60 +1170,522 @@ VoxelKDTree::TreeBuilder::buildTree(const ChunkTable& table,
 				};
 				stack.push(new_block);
 			}
-
-			if(split_result.is_properties_defined[i]){
-				// TODO: Implement
-				assert(false);
-			}
 		}
-		tree.node_count += 2;
-	}
-	debuggingPrintTreeStats(&tree);
-	
-	// Return a pointer to the struct instead of the struct itself.
-	TreeData* tree_data_ptr = (TreeData*) malloc(sizeof(TreeData));
-	if(tree_data_ptr != NULL){
-		*tree_data_ptr = tree;
+		if(finished_volume > 0 && settings.should_report_progress){
+			reportProgress(progress, finished_volume);
+		}
 	}
-	printf("\a\n");
-	return tree_data_ptr;
 }
 
-//-----------------------------------------------------------------------------
-// VoxelKDTree
-//-----------------------------------------------------------------------------
-bool VoxelKDTree::resizeToCapacity(VoxelKDTree::TreeData& tree, 
-	Int32 capacity){
+VoxelKDTree::TreeData* 
+VoxelKDTree::TreeBuilder::buildTree(const ChunkTable& table, 
+	VoxelKDTree::BuildSettings settings){
 	/*
-	Resize the internal array to have at least the given capacity
-	Returns False if something went wrong, and True otherwise.
+	Given access to a chunk table and a settings object, build a 
+	tree with the given configuration.
+
+	The top few levels are split serially until there are a few subtrees
+	per thread. The subtrees are then built in parallel into their own
+	buffers and stitched together in the order a serial depth-first build
+	would have produced. Since a depth-first build places every subtree in
+	one contiguous run of nodes, each buffer only needs a constant offset.
+	The result is identical regardless of thread count.
 	*/
 
-	struct PointerProperties{
-		void** ptr;
-		int element_size;
-		bool should_reallocate;
-	};
+	constexpr Int32 ARBITRARY_MAX_TREE_DEPTH = 100;
+	constexpr Int32 MAX_POSSIBLE_PREALLOCATION_DEPTH = 30;
 
-	PointerProperties tree_pointer_properties[] = {
-		{(void**)&tree.geometry_nodes_ptr,   sizeof(GeometryNode),
-			true},
-		{(void**)&tree.property_nodes_ptr,   sizeof(PropertyNode),
-			tree.has_property_nodes},
-		{(void**)&tree.descendant_nodes_ptr, sizeof(DescendantNode),
-			tree.is_packed_tree},
-	};
+	// More subtrees than threads, since their sizes vary wildly
+	constexpr Int32 ARBITRARY_SUBTREES_PER_THREAD = 4;
 
-	if(tree.node_capacity < capacity){
-		for(PointerProperties& prop : tree_pointer_properties){
-			auto [ptr, element_size, should_reallocate] = prop;
+	TreeData tree;
+	tree.bounds = settings.bounds;  // World space. Nodes are in "tree space"
+	tree.node_capacity = 0;
+	tree.node_count = 0;
+	tree.curr_max_depth = 0;
+	tree.is_packed_tree = settings.should_pack_nodes;
+	tree.has_property_nodes = settings.should_calculate_non_leaf_properties;
+	tree.geometry_nodes_ptr   = NULL;
+	tree.property_nodes_ptr   = NULL;
+	tree.descendant_nodes_ptr = NULL;
+	tree.rope_nodes_ptr       = NULL;
+	tree.compact_nodes_ptr    = NULL;
+	//assert(!tree.is_packed_tree); // TODO: Remove once unpacked version is done
 
-			if(should_reallocate){
-				void* result = realloc(*ptr, element_size * capacity);
-				if(result == NULL){
-					printf("Reallocation Failed!\n");
-					return false;
-				}else{
+	assert(settings.max_depth <= ARBITRARY_MAX_TREE_DEPTH);
+	if(settings.should_preallocate_max_node_space){
+		assert(settings.max_depth > 0);
+		assert(settings.max_depth <= MAX_POSSIBLE_PREALLOCATION_DEPTH);
+	}
+
+	// Node indices are 32bit values. No matter the depth, we can't get
+	// more than the max Int32 value.
+	Int64 max_possible_nodes = MAX_INT32_VALUE;
+	if(settings.max_depth < MAX_POSSIBLE_PREALLOCATION_DEPTH){
+		max_possible_nodes = (1 << (settings.max_depth + 1)) - 1;
+	}
+
+	Int32 num_threads = settings.num_build_threads;
+	if(num_threads <= 0){
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// Deep enough for a few subtrees per thread, assuming a balanced top.
+	// Unpacked trees index children by position, so they're built whole.
+	int frontier_depth = 0;
+	while((1 << frontier_depth) < num_threads * ARBITRARY_SUBTREES_PER_THREAD){
+		++frontier_depth;
+	}
+	frontier_depth = std::min(frontier_depth, settings.max_depth - 1);
+	if(!settings.should_pack_nodes){
+		frontier_depth = -1;
+	}
+
+	BuildProgress progress;
+	progress.total_volume = volume(tree.bounds);
+
+	// Summaries come from prefix sums if possible, and voxel scans otherwise
+	SummedVolumeTable volume_table;
+	SummedVolumeTable* volume_table_ptr = NULL;
+	if(settings.should_use_summed_volume_tables && 
+		buildSummedVolumeTable(table, tree.bounds, volume_table)){
+		
+		volume_table_ptr = &volume_table;
+	}
+
+	// STEP 1: Split the top of the tree serially
+	ICuboid tree_space_bounds = {{0, 0, 0}, {tree.bounds.extent}};
+	ConstructionBlock root_block = {0, 0, INVALID_NODE_INDEX, tree_space_bounds};
+	SubtreeBuffer top;
+	buildSubtree(table, settings, &tree, volume_table_ptr, root_block, 
+		frontier_depth, top, progress);
+
+	// STEP 2: Build the subtrees below the frontier in parallel, biggest 
+	// first so a large subtree doesn't start last.
+	Int32 num_subtrees = top.frontier_nodes.size();
+	std::vector<SubtreeBuffer> subtrees(num_subtrees);
+	std::vector<Int32> build_order(num_subtrees);
+	for(Int32 i = 0; i < num_subtrees; ++i){
+		build_order[i] = i;
+	}
+	std::stable_sort(build_order.begin(), build_order.end(), 
+		[&top](Int32 a, Int32 b){
+			return volume(top.frontier_nodes[a].block.bounds) > 
+				volume(top.frontier_nodes[b].block.bounds);
+		});
+
+	std::atomic<Int32> next_subtree{0};
+	auto build_subtrees = [&](){
+		while(true){
+			Int32 order_index = next_subtree.fetch_add(1);
+			if(order_index >= num_subtrees){
+				break;
+			}
+			Int32 subtree_index = build_order[order_index];
+			buildSubtree(table, settings, &tree, volume_table_ptr,
+				top.frontier_nodes[subtree_index].block, -1, 
+				subtrees[subtree_index], progress);
+		}
+	};
+
+	num_threads = std::min(num_threads, std::max(num_subtrees, 1));
+	std::vector<std::thread> threads;
+	for(Int32 i = 1; i < num_threads; ++i){
+		threads.push_back(std::thread(build_subtrees));
+	}
+	build_subtrees();
+	for(std::thread& thread : threads){
+		thread.join();
+	}
+
+	// STEP 3: Stitch. A serial build would have inserted each subtree's 
+	// nodes (other than its root, which already has a slot) right where 
+	// the top's node count stood when its frontier node was reached.
+	Int64 total_nodes = top.geometry_nodes.size();
+	std::vector<NodeIndex> subtree_offsets(num_subtrees);
+	for(Int32 i = 0; i < num_subtrees; ++i){
+		subtree_offsets[i] = top.frontier_nodes[i].node_count_when_reached +
+			(total_nodes - top.geometry_nodes.size()) - 1;
+		total_nodes += subtrees[i].geometry_nodes.size() - 1;
+	}
+	if(total_nodes > max_possible_nodes){
+		printf("ERROR: Tree needs %li nodes, but only %li are possible!\n",
+			total_nodes, max_possible_nodes);
+		return NULL;
+	}
+
+	Int64 capacity = total_nodes;
+	if(settings.should_preallocate_max_node_space){
+		capacity = max_possible_nodes;
+	}
+	if(!resizeToCapacity(tree, capacity)){
+		printf("ERROR: Attempt to resize to capacity %li failed!\n", capacity);
+		return NULL;
+	}
+	tree.node_count = total_nodes;
+
+	// Maps an index in the top buffer to the final index
+	std::vector<NodeIndex> top_index_map(top.geometry_nodes.size());
+	Int32 num_inserted = 0;
+	NodeIndex shift = 0;
+	for(Uint64 i = 0; i < top.geometry_nodes.size(); ++i){
+		while(num_inserted < num_subtrees && 
+			top.frontier_nodes[num_inserted].node_count_when_reached <= (NodeIndex) i){
+			
+			shift += subtrees[num_inserted].geometry_nodes.size() - 1;
+			++num_inserted;
+		}
+		top_index_map[i] = (i == 0) ? 0 : i + shift;
+	}
+
+	auto write_node = [&tree](NodeIndex index, GeometryNode node, 
+		NodeIndex left_child_index){
+		tree.geometry_nodes_ptr[index] = node;
+		if(tree.is_packed_tree){
+			tree.descendant_nodes_ptr[index].left_child_index = left_child_index;
+		}
+	};
+	for(Uint64 i = 0; i < top.geometry_nodes.size(); ++i){
+		NodeIndex left_child_index = top.left_child_indices[i];
+		if(left_child_index != INVALID_NODE_INDEX){
+			left_child_index = top_index_map[left_child_index];
+		}
+		write_node(top_index_map[i], top.geometry_nodes[i], left_child_index);
+	}
+	tree.curr_max_depth = top.max_depth;
+	for(Int32 i = 0; i < num_subtrees; ++i){
+		const SubtreeBuffer& subtree = subtrees[i];
+		NodeIndex offset = subtree_offsets[i];
+		NodeIndex root_index = 
+			top_index_map[top.frontier_nodes[i].block.unfinished_node];
+		for(Uint64 j = 0; j < subtree.geometry_nodes.size(); ++j){
+			NodeIndex left_child_index = subtree.left_child_indices[j];
+			if(left_child_index != INVALID_NODE_INDEX){
+				left_child_index += offset;
+			}
+			NodeIndex final_index = (j == 0) ? root_index : j + offset;
+			write_node(final_index, subtree.geometry_nodes[j], left_child_index);
+		}
+		tree.curr_max_depth = max(tree.curr_max_depth, subtree.max_depth);
+	}
+
+	if(tree.has_property_nodes && !calculateProperties(tree, &table)){
+		printf("ERROR: Failed to calculate node properties!\n");
+		tree.has_property_nodes = false;
+	}
+	if(settings.should_generate_ropes && !generateRopes(tree)){
+		printf("ERROR: Failed to generate ropes! Tree will use stack traversal.\n");
+	}
+	if(settings.should_cluster_treelets && !clusterTreelets(tree)){
+		printf("ERROR: Failed to cluster treelets! Tree keeps its build order.\n");
+	}
+	if(settings.should_report_progress){
+		debuggingPrintTreeStats(&tree);
+	}
+	
+	// Return a pointer to the struct instead of the struct itself.
+	TreeData* tree_data_ptr = (TreeData*) malloc(sizeof(TreeData));
+	if(tree_data_ptr != NULL){
+		*tree_data_ptr = tree;
+	}
+	if(settings.should_report_progress){
+		printf("\a\n");
+	}
+	return tree_data_ptr;
+}
+
+VoxelKDTree::TreeData* 
+VoxelKDTree::TreeBuilder::composeTree(const std::vector<const TreeData*>& subtrees, 
+	VoxelKDTree::BuildSettings settings){
+	/*
+	Joins independently built trees into a single tree over their combined
+	bounds. A small top tree of planes separates the subtrees from each
+	other, and each subtree's nodes are copied in below it with their 
+	plane offsets moved into the new tree space. Space that isn't covered
+	by any subtree becomes empty leaves.
+
+	Used to keep a tree per world region, so that an edit only requires
+	rebuilding one region before composing again. Composing is a copy, 
+	which is far cheaper than surveying the voxels again.
+
+	WARNING: The subtrees can't overlap, and there has to be a plane that
+		separates them at every level of the top tree. Subtrees that come
+		from different cells of a grid always satisfy this.
+	NOTE: Ropes and treelets are generated for the composed tree if the
+		settings ask for them. Any the subtrees have are ignored.
+	NOTE: Properties are only kept if every subtree has them, since mixed 
+		leaves can't be described again without the chunk table.
+	*/
+
+	struct CompositionBlock{
+		int node_depth;
+		NodeIndex node;
+		ICuboid bounds;  // Tree space
+		std::vector<Int32> members;  // Indices of the subtrees inside
+	};
+
+	if(subtrees.size() == 0){
+		return NULL;
+	}
+
+	// STEP 1: Combined bounds
+	IVec3 bounds_min = subtrees[0]->bounds.origin;
+	IVec3 bounds_max = subtrees[0]->bounds.origin + subtrees[0]->bounds.extent;
+	for(const TreeData* subtree : subtrees){
+		assert(subtree->is_packed_tree);
+		for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+			bounds_min[axis] = std::min(bounds_min[axis], subtree->bounds.origin[axis]);
+			bounds_max[axis] = std::max(bounds_max[axis], 
+				subtree->bounds.origin[axis] + subtree->bounds.extent[axis]);
+		}
+	}
+
+	TreeData tree;
+	tree.bounds = {bounds_min, bounds_max - bounds_min};
+	tree.is_packed_tree = true;
+	tree.has_property_nodes = settings.should_calculate_non_leaf_properties;
+	for(const TreeData* subtree : subtrees){
+		tree.has_property_nodes &= subtree->has_property_nodes;
+	}
+	for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+		if(tree.bounds.extent[axis] > MAX_VALID_PLANE_OFFSET){
+			printf("ERROR: Composed tree is too large for its plane offsets!\n");
+			return NULL;
+		}
+	}
+
+	// Subtree bounds relative to the new tree's origin
+	std::vector<ICuboid> member_bounds(subtrees.size());
+	for(Uint64 i = 0; i < subtrees.size(); ++i){
+		member_bounds[i] = {
+			subtrees[i]->bounds.origin - tree.bounds.origin, 
+			subtrees[i]->bounds.extent
+		};
+	}
+
+	// STEP 2: Split the top serially. Subtrees are spliced in as soon as a 
+	// block holds nothing but one subtree, so each one lands in a 
+	// contiguous run of nodes.
+	SubtreeBuffer output;
+	auto& geometry_nodes = output.geometry_nodes;
+	auto& left_child_indices = output.left_child_indices;
+	std::vector<PropertyNode> property_nodes;  // Only used for leaves
+	geometry_nodes.push_back({VALUE_UNSET_NODE});
+	left_child_indices.push_back(INVALID_NODE_INDEX);
+	property_nodes.push_back({});
+
+	auto splice = [&](NodeIndex slot, int depth, Int32 member){
+		const TreeData* subtree = subtrees[member];
+		IVec3 shift = member_bounds[member].origin;
+		NodeIndex offset = geometry_nodes.size() - 1;
+		for(Uint64 i = 0; i < subtree->node_count; ++i){
+			PackedData pack = subtree->geometry_nodes_ptr[i].pack;
+			NodeIndex left_child_index = INVALID_NODE_INDEX;
+			NodeType node_type = nodeType(pack);
+			if(node_type != NODE_LEAF){
+				Int32 offset_in_tree = planeOffset(pack) + shift[node_type];
+				pack = (pack & ~MASK_PLANE_OFFSET_BITS) | 
+					(offset_in_tree << SHIFT_PLANE_OFFSET);
+				left_child_index = 
+					subtree->descendant_nodes_ptr[i].left_child_index + offset;
+			}
+
+			PropertyNode properties = {};
+			if(tree.has_property_nodes){
+				properties = subtree->property_nodes_ptr[i];
+			}
+
+			if(i == 0){
+				geometry_nodes[slot] = {pack};
+				left_child_indices[slot] = left_child_index;
+				property_nodes[slot] = properties;
+			}else{
+				geometry_nodes.push_back({pack});
+				left_child_indices.push_back(left_child_index);
+				property_nodes.push_back(properties);
+			}
+		}
+		output.max_depth = std::max(output.max_depth, depth + subtree->curr_max_depth);
+	};
+
+	CompositionBlock root_block;
+	root_block.node_depth = 0;
+	root_block.node = 0;
+	root_block.bounds = {{0, 0, 0}, tree.bounds.extent};
+	for(Uint64 i = 0; i < subtrees.size(); ++i){
+		root_block.members.push_back(i);
+	}
+
+	std::stack<CompositionBlock> stack;
+	stack.push(root_block);
+	while(stack.size() > 0){
+		CompositionBlock block = stack.top();
+		stack.pop();
+
+		if(block.members.size() == 0){
+			geometry_nodes[block.node] = {VALUE_EMPTY_LEAF};
+			continue;
+		}
+		if(block.members.size() == 1 && 
+			member_bounds[block.members[0]] == block.bounds){
+			
+			splice(block.node, block.node_depth, block.members[0]);
+			continue;
+		}
+
+		// Candidate planes are the faces of the subtrees. Pick the one that 
+		// doesn't cut through a subtree and splits them most evenly.
+		Int32 num_members = block.members.size();
+		SplitPlane best_plane = {AXIS_INVALID, INVALID_PLANE_OFFSET};
+		Int32 best_imbalance = MAX_INT32_VALUE;
+		for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+			Int32 block_min = block.bounds.origin[axis];
+			Int32 block_max = block_min + block.bounds.extent[axis];
+			for(Int32 candidate : block.members)
+			for(int side = 0; side < 2; ++side){
+				const ICuboid& candidate_bounds = member_bounds[candidate];
+				Int32 plane = candidate_bounds.origin[axis] + 
+					side * candidate_bounds.extent[axis];
+				if(plane <= block_min || plane >= block_max){
+					continue;
+				}
+
+				bool is_separating = true;
+				Int32 num_near = 0;
+				for(Int32 member : block.members){
+					Int32 member_min = member_bounds[member].origin[axis];
+					Int32 member_max = member_min + member_bounds[member].extent[axis];
+					is_separating &= (member_max <= plane || member_min >= plane);
+					num_near += (member_max <= plane);
+				}
+
+				Int32 imbalance = std::abs(2 * num_near - num_members);
+				if(is_separating && imbalance < best_imbalance){
+					best_imbalance = imbalance;
+					best_plane = {(Axis) axis, (Int16) plane};
+				}
+			}
+		}
+		if(best_plane.axis == AXIS_INVALID){
+			printf("ERROR: Subtrees can't be separated by a plane!\n");
+			return NULL;
+		}
+
+		PackedData curr_data = VALUE_UNSET_NODE;
+		curr_data |= NODE_TYPES_ARR[best_plane.axis];
+		curr_data |= (best_plane.offset << SHIFT_PLANE_OFFSET);
+		geometry_nodes[block.node] = {curr_data};
+		output.max_depth = std::max(output.max_depth, block.node_depth);
+
+		NodeIndex child_base_index = geometry_nodes.size();
+		left_child_indices[block.node] = child_base_index;
+		geometry_nodes.resize(child_base_index + NUM_CHILDREN_PER_SPLIT, {VALUE_UNSET_NODE});
+		left_child_indices.resize(child_base_index + NUM_CHILDREN_PER_SPLIT, 
+			INVALID_NODE_INDEX);
+		property_nodes.resize(child_base_index + NUM_CHILDREN_PER_SPLIT, {});
+
+		CuboidSplit split_cuboids = splitCuboid(block.bounds, best_plane);
+		for(int i = 0; i < NUM_CHILDREN_PER_SPLIT; ++i){
+			CompositionBlock child_block;
+			child_block.node_depth = block.node_depth + 1;
+			child_block.node = child_base_index + i;
+			child_block.bounds = split_cuboids.results[i];
+			for(Int32 member : block.members){
+				bool is_near = member_bounds[member].origin[best_plane.axis] < 
+					best_plane.offset;
+				if(is_near == (i == 0)){
+					child_block.members.push_back(member);
+				}
+			}
+			stack.push(child_block);
+		}
+	}
+
+	// STEP 3: Copy into the final allocation
+	Int64 total_nodes = geometry_nodes.size();
+	if(total_nodes > (Int64) MAX_INT32_VALUE){
+		printf("ERROR: Composed tree needs %li nodes!\n", total_nodes);
+		return NULL;
+	}
+	if(!resizeToCapacity(tree, total_nodes)){
+		printf("ERROR: Attempt to resize to capacity %li failed!\n", total_nodes);
+		free(tree.geometry_nodes_ptr);
+		free(tree.property_nodes_ptr);
+		free(tree.descendant_nodes_ptr);
+		return NULL;
+	}
+	tree.node_count = total_nodes;
+	tree.curr_max_depth = output.max_depth;
+	for(Int64 i = 0; i < total_nodes; ++i){
+		tree.geometry_nodes_ptr[i] = geometry_nodes[i];
+		tree.descendant_nodes_ptr[i].left_child_index = left_child_indices[i];
+		if(tree.has_property_nodes){
+			tree.property_nodes_ptr[i] = property_nodes[i];
+		}
+	}
+
+	// Leaves came along with their subtrees. Only the nodes above them 
+	// need to be aggregated again.
+	if(tree.has_property_nodes && !calculateProperties(tree, NULL)){
+		printf("ERROR: Failed to calculate node properties!\n");
+		tree.has_property_nodes = false;
+	}
+	if(settings.should_generate_ropes && !generateRopes(tree)){
+		printf("ERROR: Failed to generate ropes! Tree will use stack traversal.\n");
+	}
+	if(settings.should_cluster_treelets && !clusterTreelets(tree)){
+		printf("ERROR: Failed to cluster treelets! Tree keeps its build order.\n");
+	}
+
+	TreeData* tree_data_ptr = (TreeData*) malloc(sizeof(TreeData));
+	if(tree_data_ptr != NULL){
+		*tree_data_ptr = tree;
+	}
+	return tree_data_ptr;
+}
+
+//-----------------------------------------------------------------------------
+// VoxelKDTree
+//-----------------------------------------------------------------------------
+bool VoxelKDTree::resizeToCapacity(VoxelKDTree::TreeData& tree, 
+	Int32 capacity){
+	/*
+	Resize the internal array to have at least the given capacity
+	Returns False if something went wrong, and True otherwise.
+	*/
+
+	if(tree.mapped_file_ptr != NULL){
+		printf("ERROR: Trees mapped from a file are read only!\n");
+		return false;
+	}
+
+	struct PointerProperties{
+		void** ptr;
+		int element_size;
+		bool should_reallocate;
+	};
+
+	PointerProperties tree_pointer_properties[] = {
+		{(void**)&tree.geometry_nodes_ptr,   sizeof(GeometryNode),
+			true},
+		{(void**)&tree.property_nodes_ptr,   sizeof(PropertyNode),
+			tree.has_property_nodes},
+		{(void**)&tree.descendant_nodes_ptr, sizeof(DescendantNode),
+			tree.is_packed_tree},
+		{(void**)&tree.rope_nodes_ptr,       sizeof(RopeNode),
+			tree.has_ropes},
+	};
+
+	if(tree.node_capacity < capacity){
+		for(PointerProperties& prop : tree_pointer_properties){
+			auto [ptr, element_size, should_reallocate] = prop;
+
+			if(should_reallocate){
+				void* result = realloc(*ptr, element_size * capacity);
+				if(result == NULL){
+					printf("Reallocation Failed!\n");
+					return false;
+				}else{
 					*ptr = result;
 				}
 			}
@@ -856,10 +1701,19 @@ void VoxelKDTree::freeTreeData(TreeData*& data){
 	if(data == NULL){
 		return;
 	}
+
+	if(data->mapped_file_ptr != NULL){
+		munmap(data->mapped_file_ptr, data->mapped_file_bytes);
+		free(data);
+		data = NULL;
+		return;
+	}
 	
 	free(data->geometry_nodes_ptr);
 	free(data->property_nodes_ptr);
 	free(data->descendant_nodes_ptr);
+	free(data->rope_nodes_ptr);
+	free(data->compact_nodes_ptr);
 	free(data);
 	data = NULL;
 }
@@ -869,6 +1723,475 @@ bool isLeaf(VoxelKDTree::PackedData data){
 		VoxelKDTree::VALUE_LEAF_NODE;
 }
 
+VoxelKDTree::NodeIndex VoxelKDTree::childBaseIndex(const TreeData* tree, 
+	NodeIndex node_index){
+	/*
+	Index of the near child of an internal node. The far child is right
+	after it.
+	*/
+
+	if(tree->is_packed_tree){
+		return tree->descendant_nodes_ptr[node_index].left_child_index;
+	}
+	return 2 * node_index + 1;
+}
+
+bool VoxelKDTree::generateRopes(TreeData& tree){
+	/*
+	Fills in a RopeNode for every node in an already built tree. 
+
+	The first pass walks down the tree handing each node its parent's ropes, 
+	except for the face on the split plane, which points at the sibling. 
+	That's valid, but a rope can end up pointing at a large subtree whose 
+	children would be a much closer match. The second pass tightens every 
+	leaf's ropes by descending into the neighbor as long as a single child 
+	still covers the entire face.
+
+	ATTRIBUTION: Ropes and the tightening step are from "Stackless KD-Tree 
+		Traversal for High Performance GPU Ray Tracing" by Popov et al.
+
+	Returns False if the rope memory couldn't be allocated.
+	*/
+
+	if(tree.mapped_file_ptr != NULL){
+		printf("ERROR: Trees mapped from a file are read only!\n");
+		return false;
+	}
+
+	struct RopeTask{
+		NodeIndex node_index;
+		RopeNode node;
+	};
+
+	RopeNode* rope_nodes_ptr = (RopeNode*) malloc(tree.node_capacity * sizeof(RopeNode));
+	if(rope_nodes_ptr == NULL){
+		return false;
+	}
+
+	RopeTask root_task;
+	root_task.node_index = 0;
+	for(int face = 0; face < DIR_INVALID; ++face){
+		root_task.node.ropes[face] = INVALID_NODE_INDEX;
+	}
+	for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+		root_task.node.min_corner[axis] = 0;
+		root_task.node.max_corner[axis] = tree.bounds.extent[axis];
+	}
+
+	// Pass 1: Bounds for every node, and ropes to the sibling or an ancestor's neighbor
+	std::vector<NodeIndex> leaf_indices;
+	std::stack<RopeTask> stack;
+	stack.push(root_task);
+	while(!stack.empty()){
+		RopeTask task = stack.top();
+		stack.pop();
+		rope_nodes_ptr[task.node_index] = task.node;
+
+		PackedData data = tree.geometry_nodes_ptr[task.node_index].pack;
+		if(isLeaf(data)){
+			leaf_indices.push_back(task.node_index);
+			continue;
+		}
+
+		Axis axis = (Axis) nodeType(data);
+		Int16 offset = planeOffset(data);
+		NodeIndex child_base_index = childBaseIndex(&tree, task.node_index);
+
+		RopeTask near_task = {child_base_index, task.node};
+		near_task.node.max_corner[axis] = offset;
+		near_task.node.ropes[axis * 2] = child_base_index + 1;
+
+		RopeTask far_task = {child_base_index + 1, task.node};
+		far_task.node.min_corner[axis] = offset;
+		far_task.node.ropes[axis * 2 + 1] = child_base_index;
+
+		stack.push(far_task);
+		stack.push(near_task);
+	}
+
+	// Pass 2: Tighten the leaf ropes
+	for(NodeIndex leaf_index : leaf_indices){
+		RopeNode& leaf = rope_nodes_ptr[leaf_index];
+		for(int face = 0; face < DIR_INVALID; ++face){
+			Axis face_axis = (Axis) (face / 2);
+			bool is_negative_face = face % 2;
+
+			NodeIndex rope = leaf.ropes[face];
+			while(rope != INVALID_NODE_INDEX){
+				PackedData data = tree.geometry_nodes_ptr[rope].pack;
+				if(isLeaf(data)){
+					break;
+				}
+
+				Axis axis = (Axis) nodeType(data);
+				Int16 offset = planeOffset(data);
+				NodeIndex child_base_index = childBaseIndex(&tree, rope);
+				if(axis == face_axis){
+					// Only the child on this side of the neighbor touches the face
+					rope = child_base_index + is_negative_face;
+				}else if(offset <= leaf.min_corner[axis]){
+					rope = child_base_index + 1;
+				}else if(offset >= leaf.max_corner[axis]){
+					rope = child_base_index;
+				}else{
+					break;  // The plane cuts through the face
+				}
+			}
+			leaf.ropes[face] = rope;
+		}
+	}
+
+	free(tree.rope_nodes_ptr);
+	tree.rope_nodes_ptr = rope_nodes_ptr;
+	tree.has_ropes = true;
+	return true;
+}
+
+bool VoxelKDTree::clusterTreelets(TreeData& tree){
+	/*
+	Reorders every node array so the tree is laid out as treelets: groups
+	of up to NODES_PER_TREELET nodes from the top of a subtree, filled in
+	breadth first. A ray that enters a treelet usually descends through 
+	all of its levels, so it only pays for one or two cache misses where
+	the build order (depth first) would cost one per level. Subtrees that 
+	don't fit become the roots of new treelets, which are placed depth 
+	first so neighboring subtrees also stay close.
+
+	Sibling pairs are never split up, so children are still found at 
+	left_child_index and left_child_index + 1. Unpacked trees come out 
+	packed. Ropes and properties are carried over, and a CompactNode 
+	array is filled in for traversal.
+
+	The CompactNode array is cache line aligned, and a treelet never 
+	straddles two lines. One that doesn't fit in what's left of the 
+	current line starts on the next, and the slots it skips become empty
+	leaves that nothing points at. They're counted in node_count.
+
+	NOTE: Meant to run once on a finished tree. Nothing keeps the compact
+		nodes in sync with later edits.
+
+	ATTRIBUTION: Treelet layouts for cache efficient trees are described in
+		"Cache-Oblivious Mesh Layouts" by Yoon et al., and the simpler
+		fixed-size clustering used here by Gil and Itai, "How to Pack Trees".
+
+	Returns False if memory couldn't be allocated, leaving the tree as-is.
+	*/
+
+	if(tree.mapped_file_ptr != NULL){
+		printf("ERROR: Trees mapped from a file are read only!\n");
+		return false;
+	}
+
+	Int64 num_tree_nodes = tree.node_count;
+	std::vector<NodeIndex> new_order;  // Old node indices in their new order
+	std::vector<NodeIndex> old_to_new(tree.node_capacity, INVALID_NODE_INDEX);
+	new_order.reserve(num_tree_nodes);
+
+	auto place = [&](NodeIndex old_index){
+		old_to_new[old_index] = (NodeIndex) new_order.size();
+		new_order.push_back(old_index);
+	};
+
+	// Treelets are identified by the old index of their first sibling pair
+	std::stack<NodeIndex> treelet_roots;
+	place(0);
+	PackedData root_data = tree.geometry_nodes_ptr[0].pack;
+	if(!isLeaf(root_data)){
+		treelet_roots.push(childBaseIndex(&tree, 0));
+	}
+
+	// The root shares its line with the first treelet
+	std::vector<NodeIndex> pair_queue;
+	std::vector<NodeIndex> treelet_nodes;
+	Int32 line_capacity = NODES_PER_TREELET - 1;
+	while(!treelet_roots.empty()){
+		NodeIndex first_pair = treelet_roots.top();
+		treelet_roots.pop();
+
+		pair_queue.clear();
+		pair_queue.push_back(first_pair);
+		treelet_nodes.clear();
+		Uint64 queue_front = 0;
+		while(queue_front < pair_queue.size() && 
+			treelet_nodes.size() + NUM_CHILDREN_PER_SPLIT <= (Uint64) line_capacity){
+			
+			NodeIndex pair_index = pair_queue[queue_front++];
+			for(int i = 0; i < NUM_CHILDREN_PER_SPLIT; ++i){
+				NodeIndex old_index = pair_index + i;
+				treelet_nodes.push_back(old_index);
+				if(!isLeaf(tree.geometry_nodes_ptr[old_index].pack)){
+					pair_queue.push_back(childBaseIndex(&tree, old_index));
+				}
+			}
+		}
+
+		// Start a new line if the treelet doesn't fit in this one
+		Int32 line_offset = new_order.size() % NODES_PER_TREELET;
+		if(line_offset + (Int32) treelet_nodes.size() > NODES_PER_TREELET){
+			new_order.resize(new_order.size() + NODES_PER_TREELET - line_offset, 
+				INVALID_NODE_INDEX);
+		}
+		for(NodeIndex old_index : treelet_nodes){
+			place(old_index);
+		}
+		line_capacity = NODES_PER_TREELET;
+
+		// Whatever didn't fit starts its own treelet. Pushed in reverse so 
+		// the leftmost is placed next.
+		for(Uint64 i = pair_queue.size(); i > queue_front; --i){
+			treelet_roots.push(pair_queue[i - 1]);
+		}
+	}
+	Int64 node_count = new_order.size();
+
+	GeometryNode* geometry_nodes_ptr = (GeometryNode*) malloc(
+		node_count * sizeof(GeometryNode));
+	DescendantNode* descendant_nodes_ptr = (DescendantNode*) malloc(
+		node_count * sizeof(DescendantNode));
+	Uint64 compact_bytes = node_count * sizeof(CompactNode);
+	compact_bytes += CACHE_LINE_BYTES - (compact_bytes % CACHE_LINE_BYTES);
+	CompactNode* compact_nodes_ptr = (CompactNode*) aligned_alloc(
+		CACHE_LINE_BYTES, compact_bytes);
+	PropertyNode* property_nodes_ptr = NULL;
+	if(tree.has_property_nodes){
+		property_nodes_ptr = (PropertyNode*) malloc(node_count * sizeof(PropertyNode));
+	}
+	RopeNode* rope_nodes_ptr = NULL;
+	if(tree.has_ropes){
+		rope_nodes_ptr = (RopeNode*) malloc(node_count * sizeof(RopeNode));
+	}
+
+	bool is_allocation_failed = 
+		geometry_nodes_ptr == NULL || 
+		descendant_nodes_ptr == NULL ||
+		compact_nodes_ptr == NULL ||
+		(tree.has_property_nodes && property_nodes_ptr == NULL) ||
+		(tree.has_ropes && rope_nodes_ptr == NULL);
+	if(is_allocation_failed){
+		free(geometry_nodes_ptr);
+		free(descendant_nodes_ptr);
+		free(compact_nodes_ptr);
+		free(property_nodes_ptr);
+		free(rope_nodes_ptr);
+		return false;
+	}
+
+	for(NodeIndex new_index = 0; new_index < node_count; ++new_index){
+		NodeIndex old_index = new_order[new_index];
+		if(old_index == INVALID_NODE_INDEX){
+			geometry_nodes_ptr[new_index] = {VALUE_EMPTY_LEAF};
+			descendant_nodes_ptr[new_index] = {INVALID_NODE_INDEX};
+			compact_nodes_ptr[new_index] = {INVALID_NODE_INDEX, VALUE_EMPTY_LEAF, 0};
+			if(tree.has_property_nodes){
+				property_nodes_ptr[new_index] = {};
+			}
+			if(tree.has_ropes){
+				RopeNode rope_node = {};
+				for(int face = 0; face < DIR_INVALID; ++face){
+					rope_node.ropes[face] = INVALID_NODE_INDEX;
+				}
+				rope_nodes_ptr[new_index] = rope_node;
+			}
+			continue;
+		}
+
+		PackedData data = tree.geometry_nodes_ptr[old_index].pack;
+		NodeIndex left_child_index = INVALID_NODE_INDEX;
+		if(!isLeaf(data)){
+			left_child_index = old_to_new[childBaseIndex(&tree, old_index)];
+		}
+
+		geometry_nodes_ptr[new_index] = {data};
+		descendant_nodes_ptr[new_index] = {left_child_index};
+		compact_nodes_ptr[new_index] = {left_child_index, data, 0};
+		if(tree.has_property_nodes){
+			property_nodes_ptr[new_index] = tree.property_nodes_ptr[old_index];
+		}
+		if(tree.has_ropes){
+			RopeNode rope_node = tree.rope_nodes_ptr[old_index];
+			for(int face = 0; face < DIR_INVALID; ++face){
+				if(rope_node.ropes[face] != INVALID_NODE_INDEX){
+					rope_node.ropes[face] = old_to_new[rope_node.ropes[face]];
+				}
+			}
+			rope_nodes_ptr[new_index] = rope_node;
+		}
+	}
+
+	free(tree.geometry_nodes_ptr);
+	free(tree.descendant_nodes_ptr);
+	free(tree.compact_nodes_ptr);
+	free(tree.property_nodes_ptr);
+	free(tree.rope_nodes_ptr);
+	tree.geometry_nodes_ptr = geometry_nodes_ptr;
+	tree.descendant_nodes_ptr = descendant_nodes_ptr;
+	tree.compact_nodes_ptr = compact_nodes_ptr;
+	tree.property_nodes_ptr = property_nodes_ptr;
+	tree.rope_nodes_ptr = rope_nodes_ptr;
+	tree.node_count = node_count;
+	tree.node_capacity = node_count;
+	tree.is_packed_tree = true;
+	return true;
+}
+
+bool VoxelKDTree::calculateProperties(TreeData& tree, const ChunkTable* table_ptr){
+	/*
+	Fills in a PropertyNode for every node in an already built tree, so 
+	that traversal can stop at an internal node and still know roughly 
+	what's below it.
+
+	Leaves are described first. Empty and homogenous leaves follow from 
+	their geometry node alone. Mixed leaves are counted voxel by voxel from
+	the table, or kept as they are if table_ptr is NULL (composeTree() 
+	copies them over from the subtrees). Internal nodes then aggregate 
+	their children from the bottom up.
+
+	NOTE: An internal node's palette index is the dominant type of its 
+		child with more solid voxels. That isn't an exact majority over the 
+		whole subtree, but it's all a distant node needs.
+
+	Returns False if the property memory couldn't be allocated.
+	*/
+
+	constexpr Int32 NUM_POSSIBLE_TYPES = 256;
+
+	if(tree.mapped_file_ptr != NULL){
+		printf("ERROR: Trees mapped from a file are read only!\n");
+		return false;
+	}
+
+	struct PropertyTask{
+		NodeIndex node_index;
+		ICuboid bounds;  // Tree space
+	};
+
+	struct Aggregate{
+		Int64 num_solid;
+		VoxelType dominant_type;
+	};
+
+	if(tree.property_nodes_ptr == NULL){
+		assert(table_ptr != NULL);
+		tree.property_nodes_ptr = 
+			(PropertyNode*) malloc(tree.node_capacity * sizeof(PropertyNode));
+		if(tree.property_nodes_ptr == NULL){
+			return false;
+		}
+	}
+	tree.has_property_nodes = true;
+
+
+	// Pass 1: Bounds for every node. Parents come before their children.
+	std::vector<PropertyTask> tasks_in_order;
+	std::stack<PropertyTask> stack;
+	stack.push({0, {{0, 0, 0}, tree.bounds.extent}});
+	while(!stack.empty()){
+		PropertyTask task = stack.top();
+		stack.pop();
+		tasks_in_order.push_back(task);
+
+		PackedData data = tree.geometry_nodes_ptr[task.node_index].pack;
+		if(isLeaf(data)){
+			continue;
+		}
+
+		SplitPlane plane = {(Axis) nodeType(data), (Int16) planeOffset(data)};
+		NodeIndex child_base_index = childBaseIndex(&tree, task.node_index);
+		ICuboid child_bounds[NUM_CHILDREN_PER_SPLIT];
+		child_bounds[0] = task.bounds;
+		child_bounds[0].extent[plane.axis] = 
+			plane.offset - task.bounds.origin[plane.axis];
+		child_bounds[1] = task.bounds;
+		child_bounds[1].origin[plane.axis] = plane.offset;
+		child_bounds[1].extent[plane.axis] -= child_bounds[0].extent[plane.axis];
+		for(int i = 0; i < NUM_CHILDREN_PER_SPLIT; ++i){
+			stack.push({child_base_index + i, child_bounds[i]});
+		}
+	}
+
+	// Pass 2: Aggregate from the bottom up
+	std::vector<Aggregate> aggregates(tree.node_capacity);
+	for(auto it = tasks_in_order.rbegin(); it != tasks_in_order.rend(); ++it){
+		NodeIndex node_index = it->node_index;
+		const ICuboid& bounds = it->bounds;
+		Int64 node_volume = volume(bounds);
+		PackedData data = tree.geometry_nodes_ptr[node_index].pack;
+		PropertyNode& properties = tree.property_nodes_ptr[node_index];
+
+		Aggregate aggregate = {0, VoxelType::EMPTY};
+		if(!isLeaf(data)){
+			NodeIndex child_base_index = childBaseIndex(&tree, node_index);
+			const Aggregate& near = aggregates[child_base_index];
+			const Aggregate& far = aggregates[child_base_index + 1];
+			aggregate.num_solid = near.num_solid + far.num_solid;
+			aggregate.dominant_type = (near.num_solid >= far.num_solid) ? 
+				near.dominant_type : far.dominant_type;
+		}else if(data & FLAG_LEAF_IS_EMPTY){
+			// Nothing to count
+		}else if(isHomogenousLeaf(data)){
+			// WARNING: Assumes palette id is the type's numeric value!
+			aggregate.dominant_type = (VoxelType) paletteIndex(data);
+			aggregate.num_solid = node_volume;
+		}else if(table_ptr == NULL){
+			// Already described. Undo the rounding as well as possible.
+			aggregate.num_solid = std::llround(
+				node_volume * (properties.density_percentage / 100.0));
+			aggregate.dominant_type = (VoxelType) properties.palette_index;
+		}else{
+			ChunkTable::ReadGuard read_guard(*table_ptr);
+			Int64 type_counts[NUM_POSSIBLE_TYPES] = {};
+			IVec3 world_min = tree.bounds.origin + bounds.origin;
+			IVec3 world_end = world_min + bounds.extent;
+			IVec3 chunk_min = chunkCoordFromVoxelCoord(world_min);
+			IVec3 chunk_max = chunkCoordFromVoxelCoord(world_end - IVec3{1, 1, 1});
+			for(Int32 cz = chunk_min.z; cz <= chunk_max.z; ++cz)
+			for(Int32 cy = chunk_min.y; cy <= chunk_max.y; ++cy)
+			for(Int32 cx = chunk_min.x; cx <= chunk_max.x; ++cx){
+				IVec3 chunk_origin = IVec3{cx, cy, cz} * CHUNK_LEN;
+				const RawVoxelChunk* chunk_ptr = table_ptr->getChunkPtr({cx, cy, cz});
+				if(chunk_ptr == NULL){
+					continue;  // Unloaded chunks are air
+				}
+
+				IVec3 local_min, local_max;
+				for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+					local_min[axis] = std::max(world_min[axis] - chunk_origin[axis], 0);
+					local_max[axis] = std::min(world_end[axis] - chunk_origin[axis], CHUNK_LEN);
+				}
+				for(Int32 z = local_min.z; z < local_max.z; ++z)
+				for(Int32 y = local_min.y; y < local_max.y; ++y)
+				for(Int32 x = local_min.x; x < local_max.x; ++x){
+					++type_counts[chunk_ptr->data[linearChunkIndex(x, y, z)].type];
+				}
+			}
+
+			Int64 dominant_count = 0;
+			for(Int32 type = 0; type < NUM_POSSIBLE_TYPES; ++type){
+				if(type_counts[type] == 0 || isAir((VoxelType) type)){
+					continue;
+				}
+				aggregate.num_solid += type_counts[type];
+				if(type_counts[type] > dominant_count){
+					dominant_count = type_counts[type];
+					aggregate.dominant_type = (VoxelType) type;
+				}
+			}
+		}
+		aggregates[node_index] = aggregate;
+
+		properties = {};
+		if(aggregate.num_solid > 0){
+			double fraction = aggregate.num_solid / (double) node_volume;
+			properties.density_percentage = std::max(1.0, std::round(fraction * 100));
+			properties.palette_index = aggregate.dominant_type;
+		}
+		properties.max_extent = std::max({
+			bounds.extent.x, bounds.extent.y, bounds.extent.z});
+	}
+
+	return true;
+}
+
 VoxelKDTree::TreeData* VoxelKDTree::loadTreeFromFile(std::string filepath, 
 	bool is_packed){
 	/*
@@ -921,6 +2244,8 @@ VoxelKDTree::TreeData* VoxelKDTree::loadTreeFromFile(std::string filepath,
 		tree_ptr->geometry_nodes_ptr = g_nodes_ptr;
 		tree_ptr->descendant_nodes_ptr = d_nodes_ptr;
 		tree_ptr->property_nodes_ptr = NULL;
+		tree_ptr->rope_nodes_ptr = NULL;
+		tree_ptr->compact_nodes_ptr = NULL;
 
 		tree_ptr->bounds = header.bounds;
 		tree_ptr->node_capacity = node_capacity;
@@ -928,6 +2253,7 @@ VoxelKDTree::TreeData* VoxelKDTree::loadTreeFromFile(std::string filepath,
 		tree_ptr->curr_max_depth = 0;
 		tree_ptr->is_packed_tree = is_packed;
 		tree_ptr->has_property_nodes = false;
+		tree_ptr->has_ropes = false;
 	}
 
 	struct Node{
@@ -1050,6 +2376,232 @@ VoxelKDTree::TreeData* VoxelKDTree::loadTreeFromFile(std::string filepath,
 	return tree_ptr;
 }
 
+VoxelKDTree::TreeFileKey VoxelKDTree::treeFileKey(const BuildSettings& settings, 
+	Uint64 world_hash){
+	/*
+	Key for a tree built with the given settings over a world with the 
+	given contents.
+	*/
+
+	TreeFileKey key;
+	memset(&key, 0, sizeof(TreeFileKey));
+	key.bounds = settings.bounds;
+	key.world_hash = world_hash;
+	key.max_depth = settings.max_depth;
+	key.mandatory_leaf_volume = settings.mandatory_leaf_volume;
+	key.num_sah_bins = settings.num_sah_bins;
+	key.optimization_level = settings.optimization_level;
+	key.should_differentiate_types = settings.should_differentiate_types;
+	key.should_generate_ropes = settings.should_generate_ropes;
+	key.should_cluster_treelets = settings.should_cluster_treelets;
+	key.should_calculate_non_leaf_properties = 
+		settings.should_calculate_non_leaf_properties;
+	key.should_terminate_by_sah = settings.should_terminate_by_sah;
+	return key;
+}
+
+bool VoxelKDTree::writeTreeToFile(const TreeData* tree, const TreeFileKey& key, 
+	std::string filepath){
+	/*
+	Writes the tree in the layout mapTreeFromFile() expects. The header
+	comes first, then every node array the tree has in its own section.
+	Only the first node_count nodes are written, not the full capacity.
+
+	Returns False if the file couldn't be written.
+	*/
+
+	assert(tree->is_packed_tree);
+
+	auto align = [](Uint64 offset){
+		Uint64 remainder = offset % TREE_FILE_SECTION_ALIGNMENT;
+		return remainder == 0 ? offset : offset + TREE_FILE_SECTION_ALIGNMENT - remainder;
+	};
+
+	TreeFileHeader header;
+	memset(&header, 0, sizeof(TreeFileHeader));
+	memcpy(header.magic, TREE_FILE_MAGIC, sizeof(TREE_FILE_MAGIC));
+	header.version = TREE_FILE_VERSION;
+	header.endian_marker = TREE_FILE_ENDIAN_MARKER;
+	header.header_bytes = sizeof(TreeFileHeader);
+	header.key = key;
+	header.node_count = tree->node_count;
+	header.curr_max_depth = tree->curr_max_depth;
+	header.is_packed_tree = tree->is_packed_tree;
+	header.has_property_nodes = tree->has_property_nodes;
+	header.has_ropes = tree->has_ropes;
+
+	const void* section_data[NUM_TREE_FILE_SECTIONS] = {
+		tree->geometry_nodes_ptr,
+		tree->descendant_nodes_ptr,
+		tree->property_nodes_ptr,
+		tree->rope_nodes_ptr,
+		tree->compact_nodes_ptr,
+	};
+	Uint64 element_bytes[NUM_TREE_FILE_SECTIONS] = {
+		sizeof(GeometryNode),
+		sizeof(DescendantNode),
+		sizeof(PropertyNode),
+		sizeof(RopeNode),
+		sizeof(CompactNode),
+	};
+
+	Uint64 file_bytes = sizeof(TreeFileHeader);
+	for(Uint32 i = 0; i < NUM_TREE_FILE_SECTIONS; ++i){
+		if(section_data[i] == NULL){
+			continue;
+		}
+		header.sections[i].offset = align(file_bytes);
+		header.sections[i].num_bytes = element_bytes[i] * tree->node_count;
+		file_bytes = header.sections[i].offset + header.sections[i].num_bytes;
+	}
+
+	std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+	if(!file.good()){
+		printf("ERROR: Couldn't open '%s' for writing!\n", filepath.c_str());
+		return false;
+	}
+
+	file.write((const char*) &header, sizeof(TreeFileHeader));
+	const char padding[TREE_FILE_SECTION_ALIGNMENT] = {};
+	Uint64 num_written = sizeof(TreeFileHeader);
+	for(Uint32 i = 0; i < NUM_TREE_FILE_SECTIONS; ++i){
+		const TreeFileHeader::Section& section = header.sections[i];
+		if(section.num_bytes == 0){
+			continue;
+		}
+		file.write(padding, section.offset - num_written);
+		file.write((const char*) section_data[i], section.num_bytes);
+		num_written = section.offset + section.num_bytes;
+	}
+
+	if(!file.good()){
+		printf("ERROR: Failed while writing '%s'!\n", filepath.c_str());
+		return false;
+	}
+	return true;
+}
+
+VoxelKDTree::TreeData* VoxelKDTree::mapTreeFromFile(std::string filepath, 
+	const TreeFileKey& expected_key){
+	/*
+	Maps a file written by writeTreeToFile() into memory and points a tree
+	at it. Nothing is parsed or copied, and pages are only read from disk
+	once a traversal touches them. Free the tree with freeTreeData() as 
+	usual, which unmaps the file.
+
+	Returns NULL if the file is missing, from another version or byte 
+	order, doesn't match the expected key, or is truncated.
+	*/
+
+	int file_descriptor = open(filepath.c_str(), O_RDONLY);
+	if(file_descriptor < 0){
+		return NULL;
+	}
+
+	struct stat file_stats;
+	if(fstat(file_descriptor, &file_stats) != 0 || 
+		file_stats.st_size < (off_t) sizeof(TreeFileHeader)){
+		
+		close(file_descriptor);
+		return NULL;
+	}
+
+	Uint64 file_bytes = file_stats.st_size;
+	void* mapping = mmap(NULL, file_bytes, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+	close(file_descriptor);  // The mapping keeps its own reference
+	if(mapping == MAP_FAILED){
+		printf("ERROR: Couldn't map '%s'!\n", filepath.c_str());
+		return NULL;
+	}
+
+	// STEP 1: Validate
+	const TreeFileHeader* header = (const TreeFileHeader*) mapping;
+	const char* rejection = NULL;
+	if(memcmp(header->magic, TREE_FILE_MAGIC, sizeof(TREE_FILE_MAGIC)) != 0){
+		rejection = "not a tree file";
+	}else if(header->endian_marker != TREE_FILE_ENDIAN_MARKER){
+		rejection = "written with a different byte order";
+	}else if(header->version != TREE_FILE_VERSION || 
+		header->header_bytes != sizeof(TreeFileHeader)){
+		
+		rejection = "written by a different version";
+	}else if(memcmp(&header->key, &expected_key, sizeof(TreeFileKey)) != 0){
+		rejection = "stale. The world or build settings changed";
+	}else if(!header->is_packed_tree || header->node_count > MAX_INT32_VALUE){
+		rejection = "corrupt";
+	}
+
+	Uint64 element_bytes[NUM_TREE_FILE_SECTIONS] = {
+		sizeof(GeometryNode),
+		sizeof(DescendantNode),
+		sizeof(PropertyNode),
+		sizeof(RopeNode),
+		sizeof(CompactNode),
+	};
+	void* section_ptrs[NUM_TREE_FILE_SECTIONS] = {};
+	for(Uint32 i = 0; i < NUM_TREE_FILE_SECTIONS && rejection == NULL; ++i){
+		const TreeFileHeader::Section& section = header->sections[i];
+		if(section.num_bytes == 0){
+			continue;
+		}
+
+		bool is_valid = true;
+		is_valid &= (section.num_bytes == element_bytes[i] * header->node_count);
+		is_valid &= (section.offset % TREE_FILE_SECTION_ALIGNMENT == 0);
+		is_valid &= (section.offset <= file_bytes);
+		is_valid &= (section.num_bytes <= file_bytes - section.offset);
+		if(!is_valid){
+			rejection = "truncated or corrupt";
+			break;
+		}
+		section_ptrs[i] = (Bytes1*) mapping + section.offset;
+	}
+	if(rejection == NULL && (section_ptrs[SECTION_GEOMETRY_NODES] == NULL || 
+		section_ptrs[SECTION_DESCENDANT_NODES] == NULL)){
+		
+		rejection = "missing node arrays";
+	}
+	if(rejection == NULL && (header->has_property_nodes != 
+		(section_ptrs[SECTION_PROPERTY_NODES] != NULL) || header->has_ropes != 
+		(section_ptrs[SECTION_ROPE_NODES] != NULL))){
+		
+		rejection = "corrupt";
+	}
+
+	if(rejection != NULL){
+		printf("Tree file '%s' is %s. Ignoring it.\n", filepath.c_str(), rejection);
+		munmap(mapping, file_bytes);
+		return NULL;
+	}
+
+	// STEP 2: Point a tree at the sections
+	TreeData* tree_ptr = (TreeData*) malloc(sizeof(TreeData));
+	if(tree_ptr == NULL){
+		munmap(mapping, file_bytes);
+		return NULL;
+	}
+	*tree_ptr = TreeData();
+	tree_ptr->bounds = header->key.bounds;
+	tree_ptr->node_capacity = header->node_count;
+	tree_ptr->node_count = header->node_count;
+	tree_ptr->curr_max_depth = header->curr_max_depth;
+	tree_ptr->is_packed_tree = true;
+	tree_ptr->has_property_nodes = header->has_property_nodes;
+	tree_ptr->has_ropes = header->has_ropes;
+	tree_ptr->geometry_nodes_ptr = (GeometryNode*) section_ptrs[SECTION_GEOMETRY_NODES];
+	tree_ptr->descendant_nodes_ptr = (DescendantNode*) section_ptrs[SECTION_DESCENDANT_NODES];
+	tree_ptr->property_nodes_ptr = (PropertyNode*) section_ptrs[SECTION_PROPERTY_NODES];
+	tree_ptr->rope_nodes_ptr = (RopeNode*) section_ptrs[SECTION_ROPE_NODES];
+	tree_ptr->compact_nodes_ptr = (CompactNode*) section_ptrs[SECTION_COMPACT_NODES];
+	tree_ptr->mapped_file_ptr = mapping;
+	tree_ptr->mapped_file_bytes = file_bytes;
+
+	// Traversal jumps around the arrays, so readahead mostly loads pages 
+	// that never get used.
+	madvise(mapping, file_bytes, MADV_RANDOM);
+	return tree_ptr;
+}
+
 
 //-----------------------------------------------------------------------------
 // Mesh KDTree
@@ -1075,10 +2627,71 @@ MeshKDTree::TreeData MeshKDTree::buildTree(const TriangleMesh& mesh){
 		tree_data.intersect_data.push_back(tri_intersect);
 		tree_data.surface_data.push_back(tri_surface);
 	}
+	tree_data.num_triangles = tree_data.intersect_data.size();
+
+	// Until splitting exists the whole mesh is one leaf
+	Range32 all_triangles = {0, (Int32) tree_data.num_triangles};
+	LeafNode root_leaf;
+	root_leaf.triangle_range = all_triangles;
+	root_leaf.block_range = {(Int32) tree_data.triangle_blocks.size(), 0};
+	packTriangleBlocks(tree_data, all_triangles);
+	root_leaf.block_range.extent = 
+		(Int32) tree_data.triangle_blocks.size() - root_leaf.block_range.origin;
+	tree_data.leaf_nodes.push_back(root_leaf);
+	tree_data.node_count = 1;
+
+	if(tree_data.num_triangles > 0){
+		FVec3 min_corner = tree_data.intersect_data[0].vertices[0];
+		FVec3 max_corner = min_corner;
+		for(const Triangle& triangle : tree_data.intersect_data){
+			for(int i = 0; i < 3; ++i){
+				for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+					min_corner[axis] = min(min_corner[axis], triangle.vertices[i][axis]);
+					max_corner[axis] = max(max_corner[axis], triangle.vertices[i][axis]);
+				}
+			}
+		}
+		tree_data.tree_bounds = {min_corner, max_corner - min_corner};
+	}
 
 	return tree_data;
 }
 
+void MeshKDTree::packTriangleBlocks(TreeData& tree, Range32 triangle_range){
+	/*
+	Appends the triangles in the given range of intersect_data to the end
+	of triangle_blocks. The final block is padded with degenerate lanes.
+	*/
+
+	for(Int32 block_start = 0; block_start < triangle_range.extent; 
+		block_start += TRIANGLE_BLOCK_WIDTH){
+		
+		TriangleBlock block;
+		for(int lane = 0; lane < TRIANGLE_BLOCK_WIDTH; ++lane){
+			Int32 local_index = block_start + lane;
+			FVec3 v0 = {0, 0, 0};
+			FVec3 edge1 = {0, 0, 0};
+			FVec3 edge2 = {0, 0, 0};
+			block.triangle_index[lane] = INVALID_TRIANGLE_INDEX;
+			if(local_index < triangle_range.extent){
+				Int32 triangle_index = triangle_range.origin + local_index;
+				const Triangle& triangle = tree.intersect_data[triangle_index];
+				v0 = triangle.vertices[0];
+				edge1 = triangle.vertices[1] - triangle.vertices[0];
+				edge2 = triangle.vertices[2] - triangle.vertices[0];
+				block.triangle_index[lane] = triangle_index;
+			}
+
+			for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+				block.v0[axis][lane] = v0[axis];
+				block.edge1[axis][lane] = edge1[axis];
+				block.edge2[axis][lane] = edge2[axis];
+			}
+		}
+		tree.triangle_blocks.push_back(block);
+	}
+}
+
 MeshKDTree::MKDTree::MKDTree(){
 
 }
@@ -1090,3 +2703,7 @@ MeshKDTree::MKDTree::MKDTree(TreeData data){
 MeshKDTree::MKDTree::~MKDTree(){
 
 }
+
+const MeshKDTree::TreeData* MeshKDTree::MKDTree::data() const{
+	return &m_data;
+}
@@ -10,6 +10,8 @@
 
 #include <vector>
 #include <stack>
+#include <array>
+#include <atomic>
 
 //-----------------------------------------------------------------------------
 // VoxelKDTree
@@ -134,15 +136,54 @@ namespace VoxelKDTree{
 		Optional node type. Allows traversal to terminate at any point
 		in the tree, not just leaf nodes. Information about the subtree
 		can then be retrieved from these nodes for various purposes.
+
+		Filled in by calculateProperties(). Leaves describe their own 
+		voxels, and internal nodes aggregate everything below them.
 		*/
 
-		Uint8 density_percentage;
+		Uint8 density_percentage;  // Solid voxels, rounded. 0 only if empty
+		Uint8 palette_index;  // Most common solid type. EMPTY if empty
+		Uint16 max_extent;  // Longest side of the node, in voxels
 	};
+	static_assert(sizeof(PropertyNode) == 4, "PropertyNode must be 4 bytes");
 
 	struct DescendantNode{
 		NodeIndex left_child_index{INVALID_NODE_INDEX};
 	};
 
+	struct CompactNode{
+		/*
+		Optional interleaved copy of a node's geometry and descendant info,
+		so a traversal step only touches one array. A 64 byte cache line 
+		holds 8 of them. See clusterTreelets().
+		*/
+
+		NodeIndex left_child_index;
+		PackedData pack;
+		Uint16 padding;
+	};
+	static_assert(sizeof(CompactNode) == 8);
+	static constexpr int CACHE_LINE_BYTES = 64;
+	static constexpr int NODES_PER_TREELET = CACHE_LINE_BYTES / sizeof(CompactNode);
+
+	struct RopeNode{
+		/*
+		Optional node type for stackless traversal. Every node stores its 
+		tree space bounds, and leaves also store a rope out of each face.
+		A rope points at the smallest node that covers the whole face, so 
+		a ray leaving a leaf follows the rope for its exit face and descends 
+		from there to the next leaf. INVALID_NODE_INDEX means the face is 
+		on the tree boundary.
+
+		NOTE: Rope indices follow GridDirection. DIR_X_POS is the face on
+			the max X side of the node.
+		*/
+
+		NodeIndex ropes[DIR_INVALID];
+		Int16 min_corner[NUM_3D_AXES];
+		Int16 max_corner[NUM_3D_AXES];
+	};
+
 	struct SplitPlane{
 		Axis axis;
 		Int16 offset;  // From tree origin, NOT the node origin.
@@ -155,7 +196,21 @@ namespace VoxelKDTree{
 
 		// Higher numbers mean more optimized, but slower tree
 		// construction.
-		OptimizationLevel optimization_level{OPTIMIZE_EXHAUSTIVE};
+		//	NONE-MEDIUM: Longest axis, split at the edge of the longest run.
+		//	HIGH:        Same, but tries all three axes.
+		//	EXHAUSTIVE:  Binned surface area heuristic on all three axes.
+		OptimizationLevel optimization_level{OPTIMIZE_HIGH};
+
+		// Number of evenly spaced candidate planes per axis evaluated by
+		// the surface area heuristic. Planes that cut empty or completely
+		// solid space off the ends of a node are always evaluated too.
+		int num_sah_bins{32};
+
+		// If true, the surface area heuristic also decides when to stop. 
+		// Nodes that are cheaper to trace as a mixed leaf than split aren't
+		// split. Makes about a fifth fewer nodes, but traces a bit slower.
+		// Only used by OPTIMIZE_EXHAUSTIVE.
+		bool should_terminate_by_sah{false};
 
 		// Tree cannot be deeper than this. All contents at this
 		// level will be forced into a leaf node regardless of type.
@@ -178,6 +233,7 @@ namespace VoxelKDTree{
 
 		// Calculate property info for all nodes, not just leaves. This
 		// makes partial tree traversals possible at the cost of extra memory.
+		// See calculateProperties().
 		bool should_calculate_non_leaf_properties{false};
 
 		// If true, the tree builder tries to make splits that produce 
@@ -185,6 +241,34 @@ namespace VoxelKDTree{
 		// Doesn't guarantee that will happen (Hitting max depth/Min Volume)
 		bool should_differentiate_types{false};
 
+		// If true, leaves get links to their neighbors so rays can be 
+		// traced without a traversal stack. Costs a RopeNode per node.
+		// Cone traced rays can't stop early on a rope, so they ignore the
+		// ropes and use the stack.
+		bool should_generate_ropes{false};
+
+		// If true, the finished tree is reordered so that small subtrees
+		// (treelets) sit next to each other in memory, and a CompactNode
+		// array is added. Traversal then pulls a whole treelet into cache
+		// with a single miss instead of one miss per level. Treelets are
+		// padded to cache lines, which adds about a fifth more nodes.
+		bool should_cluster_treelets{false};
+
+		// If true, prefix sums of the world's contents are computed once
+		// up front so that surveying a node costs O(length) instead of 
+		// O(volume). Costs 12 bytes per voxel in the tree bounds for the
+		// duration of the build. Produces the same tree either way.
+		bool should_use_summed_volume_tables{true};
+
+		// Subtrees below the top few levels are built in parallel on this
+		// many threads. 0 uses every hardware thread. The finished tree is
+		// identical regardless of the thread count.
+		int num_build_threads{0};
+
+		// If false, the build doesn't print progress or stats. Meant for 
+		// small trees that get rebuilt often.
+		bool should_report_progress{true};
+
 		ICuboid bounds;
 	};
 
@@ -197,12 +281,113 @@ namespace VoxelKDTree{
 		
 		bool is_packed_tree{true};
 		bool has_property_nodes{false};
+		bool has_ropes{false};
 		GeometryNode*   geometry_nodes_ptr{NULL};
 		PropertyNode*   property_nodes_ptr{NULL};
 		DescendantNode* descendant_nodes_ptr{NULL};
+		RopeNode*       rope_nodes_ptr{NULL};
+		CompactNode*    compact_nodes_ptr{NULL};  // Only set by clusterTreelets()
+
+		// Only set by mapTreeFromFile(). The node arrays point into the 
+		// mapping and are read only.
+		void* mapped_file_ptr{NULL};
+		Uint64 mapped_file_bytes{0};
+	};
+
+	//---------------------------------------
+	// Tree files
+	//---------------------------------------
+	static constexpr char TREE_FILE_MAGIC[4] = {'V', 'K', 'D', 'M'};
+	static constexpr Uint32 TREE_FILE_VERSION = 5;
+	static constexpr Uint32 TREE_FILE_ENDIAN_MARKER = 0x01020304;
+
+	// Sections start on page boundaries so each can be paged in on its own
+	static constexpr Uint64 TREE_FILE_SECTION_ALIGNMENT = 4096;
+
+	enum TreeFileSection: Uint32{
+		SECTION_GEOMETRY_NODES = 0,
+		SECTION_DESCENDANT_NODES,
+		SECTION_PROPERTY_NODES,
+		SECTION_ROPE_NODES,
+		SECTION_COMPACT_NODES,
+		NUM_TREE_FILE_SECTIONS
+	};
+
+	struct TreeFileKey{
+		/*
+		Everything that decides what a built tree looks like. A file whose
+		key doesn't match the requested one is stale. 
+
+		NOTE: Keys are compared byte for byte, so always create them with 
+			treeFileKey() to keep the padding zeroed.
+		*/
+
+		ICuboid bounds;
+		Uint64 world_hash;  // See ChunkTable::contentHash()
+		Int32 max_depth;
+		Int32 mandatory_leaf_volume;
+		Int32 num_sah_bins;
+		Uint8 optimization_level;
+		Uint8 should_differentiate_types;
+		Uint8 should_generate_ropes;
+		Uint8 should_cluster_treelets;
+		Uint8 should_calculate_non_leaf_properties;
+		Uint8 should_terminate_by_sah;
+	};
+
+	struct TreeFileHeader{
+		/*
+		Start of a tree file. The node arrays follow as sections, stored 
+		exactly as they are in memory, so a mapped file can be traversed 
+		without parsing anything. Files are native endian. One written on 
+		a machine with a different byte order fails the endian check.
+		*/
+
+		struct Section{
+			Uint64 offset;  // From the start of the file
+			Uint64 num_bytes;  // 0 if the tree doesn't have the array
+		};
+
+		char magic[4];
+		Uint32 version;
+		Uint32 endian_marker;
+		Uint32 header_bytes;
+		TreeFileKey key;
+		Uint64 node_count;
+		Int32 curr_max_depth;
+		Uint8 is_packed_tree;
+		Uint8 has_property_nodes;
+		Uint8 has_ropes;
+		Uint8 padding[1];
+		Section sections[NUM_TREE_FILE_SECTIONS];
 	};
 
-	Int64 writeToBuffer(const TreeData* tree);
+	struct NodeView{
+		PackedData pack;
+		NodeIndex left_child_index;  // Only meaningful for internal nodes
+	};
+
+	inline NodeView nodeView(const TreeData* tree, NodeIndex node_index){
+		/*
+		Everything a traversal step needs from a node, from whichever 
+		layout the tree has.
+		*/
+
+		if(tree->compact_nodes_ptr != NULL){
+			const CompactNode& node = tree->compact_nodes_ptr[node_index];
+			return {node.pack, node.left_child_index};
+		}
+
+		NodeView view;
+		view.pack = tree->geometry_nodes_ptr[node_index].pack;
+		if(tree->is_packed_tree){
+			view.left_child_index = tree->descendant_nodes_ptr[node_index].left_child_index;
+		}else{
+			view.left_child_index = 2 * node_index + 1;
+		}
+		return view;
+	}
+
 	void debuggingPrintTreeContents(const TreeData* tree);
 	void debuggingPrintTreeStats(const TreeData* tree);
 	void debuggingPrintPackedData(VoxelKDTree::PackedData data);
@@ -211,6 +396,8 @@ namespace VoxelKDTree{
 		//---------------------------------------
 		// Structure Definitions
 		//---------------------------------------
+		struct SummedVolumeTable;
+
 		struct SplitReferenceData{
 			/*
 			Provided to node splitting function 
@@ -218,6 +405,7 @@ namespace VoxelKDTree{
 
 			BuildSettings* settings;
 			const ChunkTable* chunk_table;
+			const SummedVolumeTable* volume_table;  // NULL if unused
 
 			const TreeData* tree_data;
 			NodeIndex node_to_split;
@@ -242,17 +430,72 @@ namespace VoxelKDTree{
 			bool is_leaf_node[2];
 			GeometryNode children[2];
 
-			// NOTE: This is only filled if the build setting 
-			// "should_calculate_non_leaf_properties" is
-			// set to True. Otherwise this will be undefined.
+			// NOTE: Never filled during a split. A node's properties 
+			// depend on the whole subtree below it, so they're computed
+			// by calculateProperties() once the tree is finished.
 			bool is_properties_defined[2];
 			PropertyNode child_properties[2];
+
+			// Set if the node is cheaper to trace as a leaf than split. The 
+			// node becomes this leaf, and the fields above are meaningless.
+			bool is_leaf_cheaper;
+			GeometryNode leaf;
 		};
 
 		struct CuboidSplit{
 			ICuboid results[2];
 		};
 
+		struct ConstructionBlock{
+			/*
+			A node that still needs to be split
+			*/
+
+			int node_depth;
+			NodeIndex unfinished_node;
+			NodeIndex parent_index;
+			ICuboid bounds;
+		};
+
+		struct FrontierNode{
+			/*
+			A node at the frontier depth that was left unsplit while building
+			the top of the tree. Its subtree gets built separately.
+			*/
+
+			ConstructionBlock block;
+
+			// Node count of the top of the tree at the moment the node was
+			// reached. A serial build would start placing the subtree here.
+			NodeIndex node_count_when_reached;
+		};
+
+		struct SubtreeBuffer{
+			/*
+			Nodes of a subtree built independently of the rest of the tree.
+			Indices are local to the buffer, with the subtree root at 0. Nodes
+			are allocated in the same order a serial build would use, so 
+			stitching a buffer into the tree is a constant index offset.
+			*/
+
+			std::vector<GeometryNode> geometry_nodes;
+			std::vector<NodeIndex> left_child_indices;
+			Int32 max_depth{0};
+
+			// Only filled when building the top of the tree
+			std::vector<FrontierNode> frontier_nodes;
+		};
+
+		struct BuildProgress{
+			/*
+			Shared between build threads. Progress is printed each time the
+			processed volume crosses another 10%.
+			*/
+
+			std::atomic<Int64> processed_volume{0};
+			Int64 total_volume;
+		};
+
 		struct AxisSummary{
 			/*
 			NOTE: I'm planning on making it possible to have slices of fixed 
@@ -273,6 +516,41 @@ namespace VoxelKDTree{
 		};
 		void debuggingPrintAxisSummary(const AxisSummary& summary);
 
+		struct SummedVolumeTable{
+			/*
+			3D prefix sums over the tree volume, so the contents of any box
+			can be counted in O(1) instead of visiting every voxel. Entry 
+			(x, y, z) holds the sum over [0, x) x [0, y) x [0, z) in tree 
+			space, which is why each dimension is one larger than the extent.
+
+			Types are tracked through the first two moments of a dense index
+			per type. A box holds a single type exactly when 
+			sum^2 == count * sum_of_squares, and that type's index is then 
+			sum / count. This takes two tables no matter how many types the
+			world has.
+
+			NOTE: Sums are stored modulo 2^32. Box sums are still exact as 
+				long as the true value fits, which is checked on construction.
+			*/
+
+			struct BoxSums{
+				Uint32 num_solid;
+				Uint32 type_index_sum;
+				Uint32 type_index_square_sum;
+			};
+
+			IVec3 dims;
+			std::vector<Uint32> solid_counts;
+			std::vector<Uint32> type_index_sums;
+			std::vector<Uint32> type_index_square_sums;
+			std::vector<VoxelType> types_by_index;
+
+			inline Uint64 linearIndex(Int32 x, Int32 y, Int32 z) const{
+				return x + (Uint64) dims.x * (y + (Uint64) dims.y * z);
+			}
+			BoxSums boxSums(const ICuboid& box) const;
+		};
+
 		class VoxelLookup{
 			/*
 			Abstracts lookup operations to the table.
@@ -309,10 +587,15 @@ namespace VoxelKDTree{
 		// Private helper functions
 		AxisSummary generateSummary(const ChunkTable* table, 
 			IVec3 volume_origin_offset, ICuboid volume, Axis axis);
+		AxisSummary generateSummary(const SummedVolumeTable& volume_table, 
+			ICuboid volume, Axis axis);
+		bool buildSummedVolumeTable(const ChunkTable& table, ICuboid bounds, 
+			SummedVolumeTable& output);
 		SplitResult generateSplit(const SplitReferenceData& ref);
 		CuboidSplit splitCuboid(ICuboid cuboid, SplitPlane split);
 		std::array<PackedData, NUM_CHILDREN_PER_SPLIT> leafStates(
 			const AxisSummary& summary, SplitPlane split);
+		PackedData mixedLeafState(Uint64 solid_count, Uint64 volume);
 
 		// Axis pickers
 		Axis axisPickerStupid(const SplitReferenceData& ref);
@@ -323,16 +606,35 @@ namespace VoxelKDTree{
 			const SplitReferenceData& ref, const AxisSummary& summary);
 		SplitRecommendation offsetPickerLongestRunBias(
 			const SplitReferenceData& ref, const AxisSummary& summary);
+		SplitRecommendation offsetPickerBinnedSAH(
+			const SplitReferenceData& ref, const AxisSummary& summary);
+
+		// Construction
+		void buildSubtree(const ChunkTable& table, BuildSettings& settings, 
+			const TreeData* tree, const SummedVolumeTable* volume_table, 
+			ConstructionBlock root, int frontier_depth, SubtreeBuffer& output, 
+			BuildProgress& progress);
+		void reportProgress(BuildProgress& progress, Int64 finished_volume);
 
 		// Public interface. 
 		// TODO: Move to the VoxelKDTree namespace when done
 		TreeData* buildTree(const ChunkTable& table, BuildSettings settings);
+		TreeData* composeTree(const std::vector<const TreeData*>& subtrees, 
+			BuildSettings settings);
 	};
 
 	// Make Private
 	bool resizeToCapacity(TreeData& tree, Int32 capacity);
 	void freeTreeData(TreeData*& data);
 	TreeData* loadTreeFromFile(std::string filepath, bool is_packed=true);
+	TreeFileKey treeFileKey(const BuildSettings& settings, Uint64 world_hash);
+	bool writeTreeToFile(const TreeData* tree, const TreeFileKey& key, 
+		std::string filepath);
+	TreeData* mapTreeFromFile(std::string filepath, const TreeFileKey& expected_key);
+	NodeIndex childBaseIndex(const TreeData* tree, NodeIndex node_index);
+	bool generateRopes(TreeData& tree);
+	bool clusterTreelets(TreeData& tree);
+	bool calculateProperties(TreeData& tree, const ChunkTable* table_ptr);
 };
 
 namespace MeshKDTree{
@@ -370,10 +672,35 @@ namespace MeshKDTree{
 	struct LeafNode{
 		/*
 		All triangles are allocated in one big linear
-		vector. This indexes into that vector.
+		vector. This indexes into that vector. The same triangles are
+		also packed into a contiguous range of TriangleBlocks.
 		*/
 
 		Range32 triangle_range;
+		Range32 block_range;
+	};
+
+	// Number of triangles tested per SIMD pass. 8 fits a single AVX register
+	// and two SSE registers.
+	static constexpr int TRIANGLE_BLOCK_WIDTH = 8;
+	static constexpr Int32 INVALID_TRIANGLE_INDEX = -1;
+
+	struct alignas(32) TriangleBlock{
+		/*
+		Structure-of-arrays copy of up to TRIANGLE_BLOCK_WIDTH triangles. 
+		Stores everything Moller-Trumbore needs (v0 and the two edges from 
+		it) so that a whole block can be tested against a ray at once.
+
+		Unused lanes have zero-length edges, which the intersection test 
+		treats as parallel to every ray, so they can never produce a hit.
+		*/
+
+		float v0[NUM_3D_AXES][TRIANGLE_BLOCK_WIDTH];
+		float edge1[NUM_3D_AXES][TRIANGLE_BLOCK_WIDTH];
+		float edge2[NUM_3D_AXES][TRIANGLE_BLOCK_WIDTH];
+
+		// Index into TreeData::intersect_data, or INVALID_TRIANGLE_INDEX
+		Int32 triangle_index[TRIANGLE_BLOCK_WIDTH];
 	};
 
 	struct TreeData{
@@ -395,6 +722,10 @@ namespace MeshKDTree{
 		// to index into here in a contiguous range.
 		std::vector<Triangle> intersect_data;
 		std::vector<TriangleSurfaceData> surface_data; 
+
+		// SIMD-friendly copy of intersect_data. Leaves index into this
+		// through their block_range.
+		std::vector<TriangleBlock> triangle_blocks;
 	};
 
 	class MKDTree{
@@ -403,9 +734,12 @@ namespace MeshKDTree{
 			MKDTree(TreeData data);
 			~MKDTree();
 
+			const TreeData* data() const;
+
 		private:
 			TreeData m_data;
 	};
 
 	TreeData buildTree(const TriangleMesh& mesh);
+	void packTriangleBlocks(TreeData& tree, Range32 triangle_range);
 };
@@ -1,5 +1,11 @@
 #include "ChunkGenerator.hpp"
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 
 //-------------------------------------------------------------------------------------------------
 // Coordinate Hashing
@@ -60,6 +66,19 @@ IVec3 biasedIntVector(FVec3 float_vec){
 	return output;
 }
 
+Int32 firstCoarseVoxelAtOrAfter(float vox_position, Int32 vox_origin, Int32 voxel_scale){
+	/*
+	Index of the first voxel at or past the position, in a chunk's row of 
+	voxels that starts at vox_origin and steps voxel_scale voxels at a time.
+	Clamped to the chunk. Like biasedIntVector(), positions within half a 
+	voxel of one count as being on it.
+	*/
+
+	float local_position = (vox_position - vox_origin) / voxel_scale;
+	Int32 index = (Int32) ceil(local_position - 0.5f / voxel_scale);
+	return std::min(std::max(index, 0), CHUNK_LEN);
+}
+
 
 RawVoxelChunk NoiseLayers::generate(const ChunkTable* table, IVec3 coords){
 	/*
@@ -72,8 +91,6 @@ RawVoxelChunk NoiseLayers::generate(const ChunkTable* table, IVec3 coords){
 		the round-trip through floating point math.
 	*/
 
-	RawVoxelChunk chunk;
-
 	// TODO: Remove after testing
 	for(const Layer& layer : m_layers){
 		for(Int32 i = 0; i < 3; ++i){
@@ -150,74 +167,79 @@ RawVoxelChunk NoiseLayers::generate(const ChunkTable* table, IVec3 coords){
 		}
 	}
 
-	// Now iterate through the results and adjust their densities based on 
-	// global properties. For now that's just their height.
-	Int32 linear_index = 0;
-	for(Int32 z = 0; z < CHUNK_LEN; ++z)
-	for(Int32 y = 0; y < CHUNK_LEN; ++y)
-	for(Int32 x = 0; x < CHUNK_LEN; ++x){
-		float height_adjustment = -(z + vox_offset_chunk_base.z) * 0.17;
-		float final_density = m_noise_scratch_buffer[linear_index] + height_adjustment;
-		m_noise_scratch_buffer[linear_index] = final_density;
+	return voxelsFromDensities(vox_offset_chunk_base, 1);
+}
 
-		++linear_index;
-	}
+RawVoxelChunk NoiseLayers::generateLodChunk(const ChunkTable* table, IVec3 coords, 
+	int lod_power){
+	/*
+	Samples the same noise as generate(), but only at every (2^lod_power)th
+	voxel along each axis, starting from the corner chunk's first voxel. The
+	cages are found per axis in coarse voxels, so the cost is about that of
+	one full resolution chunk whatever the power.
 
-	constexpr Int32 NUM_PALETTE_OPTIONS = 8;
-	constexpr Voxel PALETTE[] = {
-		{VoxelType::Air}, 
-		{VoxelType::Dirt},
-		{VoxelType::Dirt},
-		{VoxelType::Dirt},
-		{VoxelType::Dirt},
-		{VoxelType::Stone},
-		{VoxelType::Dirt},
-		{VoxelType::Stone},
-	};
+	NOTE: Coarse voxels are point samples, so features thinner than a coarse
+		voxel can vanish. The grass check looks one coarse voxel up.
+	*/
 
-	// Determine what block types to emit based on density
-	linear_index = 0;
-	for(Int32 z = 0; z < CHUNK_LEN; ++z)
-	for(Int32 y = 0; y < CHUNK_LEN; ++y)
-	for(Int32 x = 0; x < CHUNK_LEN; ++x){
-		float density = m_noise_scratch_buffer[linear_index];
-		Voxel voxel = clampDensityToPalette(PALETTE, NUM_PALETTE_OPTIONS, density);
-		
-		// Dirt blocks exposed to air on top should be grass.
-		if(voxel.type == VoxelType::Dirt){
-			bool is_above_air;
-			if(z == CHUNK_LEN - 1){
-				/*
-				We're at the top of a chunk. Extrapolate if the block should be
-				grass based on how fast the density drops vertically.
-				*/
+	assert(lod_power >= 0);
+	Int32 voxel_scale = 1 << lod_power;
 
-				float below_density = m_noise_scratch_buffer[linearChunkIndex(x, y, z - 1)];
-				float density_delta = density - below_density;
-				Int32 extrapolation = (Int32) floor(density + density_delta);
-				bool is_above_predicted_to_be_air = extrapolation <= 0;
-				is_above_air = is_above_predicted_to_be_air;
-			}else{
-				/*
-				We're inside the chunk, with layers above us. Just peek up by one and 
-				see if the density will be 0.
-				*/
+	setNoiseScratchBufferValue(0);
+	IVec3 vox_origin = coords * CHUNK_LEN;
+	for(Layer layer : m_layers){
+		Int32 layer_range_extent = layer.value_range.y - layer.value_range.x;
+		FVec3 voxels_per_sample = layer.scale * NUM_VOXELS_PER_METER;
 
-				float above_density = m_noise_scratch_buffer[linearChunkIndex(x, y, z + 1)];
-				Int32 above_palette_index = (Int32) floor(above_density);
-				is_above_air = above_palette_index <= 0;
+		// Sample space cells holding the first through last coarse voxel
+		IVec2 ssr[3];
+		for(Int32 i = 0; i < 3; ++i){
+			float first_t = vox_origin[i] / voxels_per_sample[i];
+			float last_t = (vox_origin[i] + (CHUNK_LEN - 1) * voxel_scale) / voxels_per_sample[i];
+			ssr[i] = {(Int32) floor(first_t), (Int32) floor(last_t) + 1};
+		}
+
+		for(Int32 z = ssr[INDEX_Z][INDEX_VALUE_MIN]; z < ssr[INDEX_Z][INDEX_VALUE_MAX]; ++z)
+		for(Int32 y = ssr[INDEX_Y][INDEX_VALUE_MIN]; y < ssr[INDEX_Y][INDEX_VALUE_MAX]; ++y)
+		for(Int32 x = ssr[INDEX_X][INDEX_VALUE_MIN]; x < ssr[INDEX_X][INDEX_VALUE_MAX]; ++x){
+			IVec3 sample_coord_low = {x, y, z};
+
+			SampleCage cage;
+			bool is_empty = false;
+			for(Int32 i = 0; i < 3; ++i){
+				Int32 first = firstCoarseVoxelAtOrAfter(sample_coord_low[i] * voxels_per_sample[i], 
+					vox_origin[i], voxel_scale);
+				Int32 end = firstCoarseVoxelAtOrAfter((sample_coord_low[i] + 1) * voxels_per_sample[i], 
+					vox_origin[i], voxel_scale);
+				is_empty |= end <= first;
+
+				float first_t = (vox_origin[i] + first * voxel_scale) / voxels_per_sample[i];
+				cage.cage_local_volume.origin[i] = first;
+				cage.cage_local_volume.extent[i] = end - first;
+				cage.t_local_initial[i] = clamp(first_t - sample_coord_low[i], 0.0, 1.0);
+				cage.t_increment[i] = voxel_scale / voxels_per_sample[i];
+			}
+			if(is_empty){
+				continue;
 			}
 
-			if(is_above_air){
-				voxel.type = VoxelType::Grass;
+			SampleCoords sample_coords = sampleCoordsFromPosition(sample_coord_low);
+			for(Int32 i = 0; i < NUM_CORNERS_PER_CUBE; ++i){
+				IVec3 sample_coord = sample_coords.coords[i];
+				Hash::CoordHash hash = Hash::modifiedSquirrelNoise(sample_coord, m_seed);
+				Range32 rand_range = {layer.value_range.x, layer_range_extent};
+				cage.samples[i] = MathUtils::Random::randInRange(hash, rand_range);
 			}
-		}
 
-		chunk.data[linear_index] = voxel;
-		++linear_index;
+			iterateCageValues(cage);
+		}
 	}
 
-	return chunk;
+	return voxelsFromDensities(vox_origin, voxel_scale);
+}
+
+GenerationAlgorithm* NoiseLayers::clone() const{
+	return new NoiseLayers(*this);
 }
 
 void NoiseLayers::addNoiseLayer(Layer layer){
@@ -241,6 +263,10 @@ void NoiseLayers::iterateCageValues(SampleCage cage){
 	/*
 	All samples will fall within the sample cage. Helps avoid unnecessary
 	re-sampling for noise layers with very large distances between samples.
+
+	The t values are accumulated exactly the way the per-voxel loop used to
+	accumulate them, so the vectorized rows stay bit-identical to calling
+	trilinearInterpolation() on every voxel.
 	*/
 	
 	ICuboid vol = cage.cage_local_volume;
@@ -250,20 +276,115 @@ void NoiseLayers::iterateCageValues(SampleCage cage){
 		assert(end[i] <= CHUNK_LEN);
 	}
 
-	FVec3 curr_t = cage.t_local_initial;
+	Int32 row_len = vol.extent.x;
+	if(row_len <= 0){
+		return;
+	}
+
+	// Every row of the cage sees the same sequence of t.x values
+	float t_x_values[CHUNK_LEN];
+	float curr_t_x = cage.t_local_initial.x;
+	for(Int32 i = 0; i < row_len; ++i){
+		t_x_values[i] = curr_t_x;
+		curr_t_x += cage.t_increment.x;
+	}
+
+	float curr_t_z = cage.t_local_initial.z;
 	for(int z = vol.origin.z; z < end.z; ++z){
+		float curr_t_y = cage.t_local_initial.y;
 		for(int y = vol.origin.y; y < end.y; ++y){
-			for(int x = vol.origin.x; x < end.x; ++x){
-				float value = trilinearInterpolation(cage.samples, curr_t);
-				m_noise_scratch_buffer[linearChunkIndex(x, y, z)] += value;
-				
-				curr_t.x += cage.t_increment.x;
+			#if defined(CHUNK_MORTON_LAYOUT)
+			// Rows aren't contiguous, so gather them into a temporary first.
+			float row[CHUNK_LEN];
+			for(Int32 i = 0; i < row_len; ++i){
+				row[i] = m_noise_scratch_buffer[linearChunkIndex(vol.origin.x + i, y, z)];
 			}
-			curr_t.x = cage.t_local_initial.x;
-			curr_t.y += cage.t_increment.y;
+			accumulateCageRow(cage, t_x_values, curr_t_y, curr_t_z, row_len, row);
+			for(Int32 i = 0; i < row_len; ++i){
+				m_noise_scratch_buffer[linearChunkIndex(vol.origin.x + i, y, z)] = row[i];
+			}
+			#else
+			float* row = &m_noise_scratch_buffer[linearChunkIndex(vol.origin.x, y, z)];
+			accumulateCageRow(cage, t_x_values, curr_t_y, curr_t_z, row_len, row);
+			#endif
+			
+			curr_t_y += cage.t_increment.y;
 		}
-		curr_t.y = cage.t_local_initial.y;
-		curr_t.z += cage.t_increment.z;
+		curr_t_z += cage.t_increment.z;
+	}
+}
+
+void NoiseLayers::accumulateCageRow(const SampleCage& cage, const float* t_x_values, 
+	float t_y, float t_z, Int32 count, float* output) const{
+	/*
+	Adds the interpolated cage value for a run of voxels along x to the output.
+	Lanes follow the same lerp order as trilinearInterpolation(): x, then y, then
+	z, each as ((1 - t) * a) + (t * b). Leftover voxels go through the scalar path.
+
+	WARNING: Bit-identical output depends on the compiler not contracting the
+		multiply/add pairs into FMAs on only one of the two paths. Don't build
+		this file with -mfma unless -ffp-contract=off is also set.
+	*/
+
+	const float* samples = cage.samples;
+	Int32 i = 0;
+
+	#if defined(__AVX__)
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 ty = _mm256_set1_ps(t_y);
+	const __m256 tz = _mm256_set1_ps(t_z);
+	const __m256 one_minus_ty = _mm256_sub_ps(one, ty);
+	const __m256 one_minus_tz = _mm256_sub_ps(one, tz);
+	__m256 s[NUM_CORNERS_PER_CUBE];
+	for(Int32 c = 0; c < NUM_CORNERS_PER_CUBE; ++c){
+		s[c] = _mm256_set1_ps(samples[c]);
+	}
+
+	for(; i + 8 <= count; i += 8){
+		__m256 tx = _mm256_loadu_ps(t_x_values + i);
+		__m256 one_minus_tx = _mm256_sub_ps(one, tx);
+
+		__m256 x1 = _mm256_add_ps(_mm256_mul_ps(one_minus_tx, s[0]), _mm256_mul_ps(tx, s[1]));
+		__m256 x2 = _mm256_add_ps(_mm256_mul_ps(one_minus_tx, s[2]), _mm256_mul_ps(tx, s[3]));
+		__m256 x3 = _mm256_add_ps(_mm256_mul_ps(one_minus_tx, s[4]), _mm256_mul_ps(tx, s[5]));
+		__m256 x4 = _mm256_add_ps(_mm256_mul_ps(one_minus_tx, s[6]), _mm256_mul_ps(tx, s[7]));
+
+		__m256 y1 = _mm256_add_ps(_mm256_mul_ps(one_minus_ty, x1), _mm256_mul_ps(ty, x2));
+		__m256 y2 = _mm256_add_ps(_mm256_mul_ps(one_minus_ty, x3), _mm256_mul_ps(ty, x4));
+
+		__m256 z1 = _mm256_add_ps(_mm256_mul_ps(one_minus_tz, y1), _mm256_mul_ps(tz, y2));
+		_mm256_storeu_ps(output + i, _mm256_add_ps(_mm256_loadu_ps(output + i), z1));
+	}
+	#elif defined(__SSE2__)
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 ty = _mm_set1_ps(t_y);
+	const __m128 tz = _mm_set1_ps(t_z);
+	const __m128 one_minus_ty = _mm_sub_ps(one, ty);
+	const __m128 one_minus_tz = _mm_sub_ps(one, tz);
+	__m128 s[NUM_CORNERS_PER_CUBE];
+	for(Int32 c = 0; c < NUM_CORNERS_PER_CUBE; ++c){
+		s[c] = _mm_set1_ps(samples[c]);
+	}
+
+	for(; i + 4 <= count; i += 4){
+		__m128 tx = _mm_loadu_ps(t_x_values + i);
+		__m128 one_minus_tx = _mm_sub_ps(one, tx);
+
+		__m128 x1 = _mm_add_ps(_mm_mul_ps(one_minus_tx, s[0]), _mm_mul_ps(tx, s[1]));
+		__m128 x2 = _mm_add_ps(_mm_mul_ps(one_minus_tx, s[2]), _mm_mul_ps(tx, s[3]));
+		__m128 x3 = _mm_add_ps(_mm_mul_ps(one_minus_tx, s[4]), _mm_mul_ps(tx, s[5]));
+		__m128 x4 = _mm_add_ps(_mm_mul_ps(one_minus_tx, s[6]), _mm_mul_ps(tx, s[7]));
+
+		__m128 y1 = _mm_add_ps(_mm_mul_ps(one_minus_ty, x1), _mm_mul_ps(ty, x2));
+		__m128 y2 = _mm_add_ps(_mm_mul_ps(one_minus_ty, x3), _mm_mul_ps(ty, x4));
+
+		__m128 z1 = _mm_add_ps(_mm_mul_ps(one_minus_tz, y1), _mm_mul_ps(tz, y2));
+		_mm_storeu_ps(output + i, _mm_add_ps(_mm_loadu_ps(output + i), z1));
+	}
+	#endif
+
+	for(; i < count; ++i){
+		output[i] += trilinearInterpolation(samples, {t_x_values[i], t_y, t_z});
 	}
 }
 
@@ -289,6 +410,82 @@ float NoiseLayers::trilinearInterpolation(const float* samples, FVec3 t_values)
 	return lerp_z1;
 }
 
+RawVoxelChunk NoiseLayers::voxelsFromDensities(IVec3 vox_origin, Int32 voxel_scale){
+	/*
+	Turns the summed layer densities in the scratch buffer into voxels. The
+	chunk's first voxel is at vox_origin, and its voxels are voxel_scale 
+	apart.
+	*/
+
+	RawVoxelChunk chunk;
+
+	// Now iterate through the results and adjust their densities based on 
+	// global properties. For now that's just their height.
+	for(Int32 z = 0; z < CHUNK_LEN; ++z)
+	for(Int32 y = 0; y < CHUNK_LEN; ++y)
+	for(Int32 x = 0; x < CHUNK_LEN; ++x){
+		Int32 voxel_index = linearChunkIndex(x, y, z);
+		float height_adjustment = -(z * voxel_scale + vox_origin.z) * 0.17;
+		float final_density = m_noise_scratch_buffer[voxel_index] + height_adjustment;
+		m_noise_scratch_buffer[voxel_index] = final_density;
+	}
+
+	constexpr Int32 NUM_PALETTE_OPTIONS = 8;
+	constexpr Voxel PALETTE[] = {
+		{VoxelType::Air}, 
+		{VoxelType::Dirt},
+		{VoxelType::Dirt},
+		{VoxelType::Dirt},
+		{VoxelType::Dirt},
+		{VoxelType::Stone},
+		{VoxelType::Dirt},
+		{VoxelType::Stone},
+	};
+
+	// Determine what block types to emit based on density
+	for(Int32 z = 0; z < CHUNK_LEN; ++z)
+	for(Int32 y = 0; y < CHUNK_LEN; ++y)
+	for(Int32 x = 0; x < CHUNK_LEN; ++x){
+		Int32 voxel_index = linearChunkIndex(x, y, z);
+		float density = m_noise_scratch_buffer[voxel_index];
+		Voxel voxel = clampDensityToPalette(PALETTE, NUM_PALETTE_OPTIONS, density);
+		
+		// Dirt blocks exposed to air on top should be grass.
+		if(voxel.type == VoxelType::Dirt){
+			bool is_above_air;
+			if(z == CHUNK_LEN - 1){
+				/*
+				We're at the top of a chunk. Extrapolate if the block should be
+				grass based on how fast the density drops vertically.
+				*/
+
+				float below_density = m_noise_scratch_buffer[linearChunkIndex(x, y, z - 1)];
+				float density_delta = density - below_density;
+				Int32 extrapolation = (Int32) floor(density + density_delta);
+				bool is_above_predicted_to_be_air = extrapolation <= 0;
+				is_above_air = is_above_predicted_to_be_air;
+			}else{
+				/*
+				We're inside the chunk, with layers above us. Just peek up by one and 
+				see if the density will be 0.
+				*/
+
+				float above_density = m_noise_scratch_buffer[linearChunkIndex(x, y, z + 1)];
+				Int32 above_palette_index = (Int32) floor(above_density);
+				is_above_air = above_palette_index <= 0;
+			}
+
+			if(is_above_air){
+				voxel.type = VoxelType::Grass;
+			}
+		}
+
+		chunk.data[voxel_index] = voxel;
+	}
+
+	return chunk;
+}
+
 void NoiseLayers::setNoiseScratchBufferValue(float value){
 	for(Int32 i = 0; i < CHUNK_VOLUME; ++i){
 		m_noise_scratch_buffer[i] = value;
@@ -300,7 +497,14 @@ void NoiseLayers::setNoiseScratchBufferValue(float value){
 // Fractal
 //-----------------------------------------------
 RawVoxelChunk Fractal::generate(const ChunkTable* table, IVec3 coords){
+	return generateLodChunk(table, coords, 0);
+}
+
+RawVoxelChunk Fractal::generateLodChunk(const ChunkTable* table, IVec3 coords, 
+	int lod_power){
 	/*
+	Coarse voxels are point samples of the full resolution pattern.
+
 	WARNING: Incomplete function
 	*/
 
@@ -308,12 +512,13 @@ RawVoxelChunk Fractal::generate(const ChunkTable* table, IVec3 coords){
 	
 	float density;
 
+	Int32 voxel_scale = 1 << lod_power;
 	IVec3 offset = coords * CHUNK_LEN;
 	for(int z = 0; z < CHUNK_LEN; ++z)
 	for(int y = 0; y < CHUNK_LEN; ++y)
 	for(int x = 0; x < CHUNK_LEN; ++x){
 		IVec3 local_coord = {x, y, z};
-		IVec3 world_coord = offset + local_coord;
+		IVec3 world_coord = offset + local_coord * voxel_scale;
 		density = !(
 			std::abs(world_coord.x) ^ 
 			std::abs(world_coord.y) ^ 
@@ -328,23 +533,22 @@ RawVoxelChunk Fractal::generate(const ChunkTable* table, IVec3 coords){
 	return chunk;
 }
 
-/*
-RawVoxelChunk Fractal::generateLodChunk(const ChunkTable* table, IVec3 coords, 
-	int lod_power){
-	//WARNING: Incomplete function
-	assert(false);
-	RawVoxelChunk chunk;
-	return chunk;
+GenerationAlgorithm* Fractal::clone() const{
+	return new Fractal(*this);
 }
-*/
 
 
 //-----------------------------------------------
 // Centered Sphere
 //-----------------------------------------------
 RawVoxelChunk CenteredSphere::generate(const ChunkTable* table, IVec3 coords){
+	return generateLodChunk(table, coords, 0);
+}
+
+RawVoxelChunk CenteredSphere::generateLodChunk(const ChunkTable* table, IVec3 coords, 
+	int lod_power){
 	/*
-	
+	Coarse voxels are point samples of the full resolution sphere.
 	*/
 
 	RawVoxelChunk chunk;
@@ -355,11 +559,12 @@ RawVoxelChunk CenteredSphere::generate(const ChunkTable* table, IVec3 coords){
 	float radius = std::max(0.0f, std::min((float)m_seed, MAX_RADIUS));
 	float distance, density;
 
+	Int32 voxel_scale = 1 << lod_power;
 	for(int z = 0; z < CHUNK_LEN; ++z)
 	for(int y = 0; y < CHUNK_LEN; ++y)
 	for(int x = 0; x < CHUNK_LEN; ++x){
 		IVec3 local_pos = {x, y, z};
-		IVec3 global_pos = (coords * CHUNK_LEN) + local_pos;
+		IVec3 global_pos = (coords * CHUNK_LEN) + local_pos * voxel_scale;
 		FVec3 from_origin = toFloatVector(global_pos) - origin;
 		distance = from_origin.length();
 		density = (radius - distance / 2);
@@ -371,42 +576,19 @@ RawVoxelChunk CenteredSphere::generate(const ChunkTable* table, IVec3 coords){
 	return chunk;
 }
 
-/*
-RawVoxelChunk CenteredSphere::generateLodChunk(const ChunkTable* table, IVec3 coords, 
-	int lod_power){
-
-
-	RawVoxelChunk chunk;
-
-	FVec3 origin = {0, 0, 0};
-
-	int voxel_scale_factor = 1 << lod_power;
-	int chunk_scale_factor = CHUNK_LEN * voxel_scale_factor;
-	IVec3 chunk_voxel_coords = coords * chunk_scale_factor;
-
-	float distance, density;
-
-	for(int z = 0; z < CHUNK_LEN; ++z)
-	for(int y = 0; y < CHUNK_LEN; ++y)
-	for(int x = 0; x < CHUNK_LEN; ++x){
-		IVec3 local_pos = {x, y, z};
-		IVec3 global_pos = chunk_voxel_coords + local_pos * voxel_scale_factor;
-		FVec3 from_origin = toFloatVector(global_pos) - origin;
-		distance = from_origin.length();
-		density = (50 - distance / 2);
-
-		chunk.data[linearChunkIndex(x, y, z)] = clampDensityToPalette(
-			DEFAULT_VOXEL_PALETTE, NUM_DEFAULT_PALETTE_OPTIONS, density);
-	}
-
-	return chunk;
+GenerationAlgorithm* CenteredSphere::clone() const{
+	return new CenteredSphere(*this);
 }
-*/
+
 
 //-----------------------------------------------
 // Scratch
 //-----------------------------------------------
 RawVoxelChunk Scratch::generate(const ChunkTable* table, IVec3 coords){
+	return generateLodChunk(table, coords, 0);
+}
+
+RawVoxelChunk Scratch::generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power){
 	RawVoxelChunk chunk;
 
 	FVec3 origin = {0, 0, 0};
@@ -414,11 +596,12 @@ RawVoxelChunk Scratch::generate(const ChunkTable* table, IVec3 coords){
 	float distance, density;
 	constexpr int NOISE_MAX = 5;
 
+	Int32 voxel_scale = 1 << lod_power;
 	for(int z = 0; z < CHUNK_LEN; ++z)
 	for(int y = 0; y < CHUNK_LEN; ++y)
 	for(int x = 0; x < CHUNK_LEN; ++x){
 		IVec3 local_pos = {x, y, z};
-		FVec3 global_pos = toFloatVector((coords * CHUNK_LEN) + local_pos);
+		FVec3 global_pos = toFloatVector((coords * CHUNK_LEN) + local_pos * voxel_scale);
 		FVec3 from_origin = global_pos - origin;
 		distance = from_origin.length();
 		density = (20 - distance / 10);
@@ -432,20 +615,23 @@ RawVoxelChunk Scratch::generate(const ChunkTable* table, IVec3 coords){
 	return chunk;
 }
 
-/*
-RawVoxelChunk Scratch::generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power){
-	//WARNING: Incomplete function
-	assert(false);
-	RawVoxelChunk chunk;
-	return chunk;
+GenerationAlgorithm* Scratch::clone() const{
+	return new Scratch(*this);
 }
-*/
+
 
 //-----------------------------------------------
 // Pillars And Caves
 //-----------------------------------------------
 RawVoxelChunk PillarsAndCaves::generate(const ChunkTable* table, IVec3 coords){
+	return generateLodChunk(table, coords, 0);
+}
+
+RawVoxelChunk PillarsAndCaves::generateLodChunk(const ChunkTable* table, IVec3 coords, 
+	int lod_power){
 	/*
+	Coarse voxels are point samples of the full resolution pillars.
+
 	https://iquilezles.org/articles/distfunctions/
 	float opRep(FVec3 p, FVec3 c, in sdf3d primitive){
 		vec3 q = mod(p+0.5*c,c)-0.5*c;
@@ -467,13 +653,14 @@ RawVoxelChunk PillarsAndCaves::generate(const ChunkTable* table, IVec3 coords){
 	constexpr int PILLAR_MARGIN = 5;
 	constexpr int CELL_SHIFT_AMOUNT = 17;
 
+	Int32 voxel_scale = 1 << lod_power;
 	IVec3 chunk_corner_pos = coords * CHUNK_LEN;
 
 	for(int z = 0; z < CHUNK_LEN; ++z)
 	for(int y = 0; y < CHUNK_LEN; ++y)
 	for(int x = 0; x < CHUNK_LEN; ++x){
 		IVec3 local_pos = {x, y, z};
-		IVec3 global_pos = local_pos + chunk_corner_pos;
+		IVec3 global_pos = local_pos * voxel_scale + chunk_corner_pos;
 
 		IVec3 hash_pos = {
 			(global_pos.x / CELL_SHIFT_AMOUNT) * CELL_SHIFT_AMOUNT,
@@ -516,14 +703,9 @@ RawVoxelChunk PillarsAndCaves::generate(const ChunkTable* table, IVec3 coords){
 	return chunk;
 }
 
-/*
-RawVoxelChunk PillarsAndCaves::generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power){
-	//WARNING: Incomplete function
-	assert(false);
-	RawVoxelChunk chunk;
-	return chunk;
+GenerationAlgorithm* PillarsAndCaves::clone() const{
+	return new PillarsAndCaves(*this);
 }
-*/
 
 
 //-----------------------------------------------
@@ -545,6 +727,10 @@ bool containsVoxel(ICuboid cuboid, IVec3 voxel_coord){
 }
 
 RawVoxelChunk MeshTesting::generate(const ChunkTable* table, IVec3 coords){
+	return generateLodChunk(table, coords, 0);
+}
+
+RawVoxelChunk MeshTesting::generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power){
 	RawVoxelChunk chunk;
 	constexpr int NUM_PALETTE_OPTIONS = 2;
 	Voxel VOXEL_PALETTE[] = {
@@ -561,13 +747,14 @@ RawVoxelChunk MeshTesting::generate(const ChunkTable* table, IVec3 coords){
 	};
 
 
+	Int32 voxel_scale = 1 << lod_power;
 	IVec3 chunk_corner_pos = coords * CHUNK_LEN;
 
 	for(int z = 0; z < CHUNK_LEN; ++z)
 	for(int y = 0; y < CHUNK_LEN; ++y)
 	for(int x = 0; x < CHUNK_LEN; ++x){
 		IVec3 local_pos = {x, y, z};
-		IVec3 global_pos = local_pos + chunk_corner_pos;
+		IVec3 global_pos = local_pos * voxel_scale + chunk_corner_pos;
 
 		density = containsVoxel(solid_range, global_pos);
 
@@ -579,20 +766,18 @@ RawVoxelChunk MeshTesting::generate(const ChunkTable* table, IVec3 coords){
 	return chunk;
 }
 
-/*
-RawVoxelChunk MeshTesting::generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power){
-	//WARNING: Incomplete function
-	
-	assert(false);
-	RawVoxelChunk chunk;
-	return chunk;
+GenerationAlgorithm* MeshTesting::clone() const{
+	return new MeshTesting(*this);
 }
-*/
 
 
 //-------------------------------------------------------------------------------------------------
 // Chunk Generator
 //-------------------------------------------------------------------------------------------------
+ChunkGenerator::ChunkGenerator(){
+	m_num_workers = 1;
+}
+
 void ChunkGenerator::setSeed(Bytes8 seed){
 	if(seed == 0){
 		seed = time(NULL);
@@ -601,21 +786,48 @@ void ChunkGenerator::setSeed(Bytes8 seed){
 	srand(seed);
 
 	m_algorithm->setSeed(seed);
+	cloneWorkerAlgorithms();
 }
 
 void ChunkGenerator::setAlgorithm(std::shared_ptr<GenerationAlgorithm> new_generator){
 	m_algorithm = new_generator;
+	cloneWorkerAlgorithms();
 }
 
-RawVoxelChunk ChunkGenerator::generate(const ChunkTable* table, IVec3 coords){
-	return m_algorithm->generate(table, coords);
+void ChunkGenerator::setNumWorkers(Int32 num_workers){
+	assert(num_workers > 0);
+	m_num_workers = num_workers;
+	cloneWorkerAlgorithms();
 }
 
-/*
-RawVoxelChunk ChunkGenerator::generateLodChunk(const ChunkTable* table, IVec3 coords, 
-	int lod_power){
+Int32 ChunkGenerator::numWorkers() const{
+	return m_num_workers;
+}
 
-	return m_algorithm->generateLodChunk(table, coords, lod_power);
+RawVoxelChunk ChunkGenerator::generate(const ChunkTable* table, IVec3 coords, Int32 worker_index){
+	assert(worker_index >= 0 && worker_index < (Int32) m_worker_algorithms.size());
+	return m_worker_algorithms[worker_index]->generate(table, coords);
 }
-*/
 
+RawVoxelChunk ChunkGenerator::generateLodChunk(const ChunkTable* table, IVec3 coords, 
+	int lod_power, Int32 worker_index){
+	assert(worker_index >= 0 && worker_index < (Int32) m_worker_algorithms.size());
+	return m_worker_algorithms[worker_index]->generateLodChunk(table, coords, lod_power);
+}
+
+void ChunkGenerator::cloneWorkerAlgorithms(){
+	/*
+	Gives every worker but the first its own copy of the algorithm, seed
+	and all. Called whenever the algorithm changes.
+	*/
+
+	m_worker_algorithms.clear();
+	if(m_algorithm == NULL){
+		return;
+	}
+
+	m_worker_algorithms.push_back(m_algorithm);
+	for(Int32 i = 1; i < m_num_workers; ++i){
+		m_worker_algorithms.push_back(std::shared_ptr<GenerationAlgorithm>(m_algorithm->clone()));
+	}
+}
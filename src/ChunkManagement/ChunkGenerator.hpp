@@ -34,12 +34,23 @@ inline Voxel clampDensityToPalette(const Voxel* palette_ptr, int num_palette_opt
 // Base Class
 //-----------------------------------------------
 struct GenerationAlgorithm{
+	/*
+	THREADING: An algorithm may keep scratch state between calls, so each 
+		thread generating at once needs its own, see clone().
+
+	NOTE: generateLodChunk() fills one chunk's worth of voxels that covers the
+		(2^lod_power)^3 chunks starting at coords, the same area as the LOD cell
+		with that corner address. Power 0 is the same as generate().
+	*/
+
 	public:
 		GenerationAlgorithm();
+		virtual ~GenerationAlgorithm() = default;
 		
 		RawVoxelChunk virtual generate(const ChunkTable* table, IVec3 coords) = 0;
-		//RawVoxelChunk virtual generateLodChunk(const ChunkTable* table, IVec3 coords, 
-		//	int lod_power) = 0;
+		virtual GenerationAlgorithm* clone() const = 0;
+		RawVoxelChunk virtual generateLodChunk(const ChunkTable* table, IVec3 coords, 
+			int lod_power) = 0;
 		void setSeed(Bytes8 seed);
 
 	protected:
@@ -58,8 +69,9 @@ class NoiseLayers: public GenerationAlgorithm{
 
 	public:
 		RawVoxelChunk generate(const ChunkTable* table, IVec3 coords);
+		GenerationAlgorithm* clone() const;
 		void addNoiseLayer(Layer layer);
-		//RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
+		RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
 
 	private:
 		struct SampleCage{
@@ -78,7 +90,10 @@ class NoiseLayers: public GenerationAlgorithm{
 	private:
 		SampleCoords sampleCoordsFromPosition(IVec3 coord);
 		void iterateCageValues(SampleCage cage);
+		void accumulateCageRow(const SampleCage& cage, const float* t_x_values, 
+			float t_y, float t_z, Int32 count, float* output) const;
 		float trilinearInterpolation(const float* samples, FVec3 t_values) const;
+		RawVoxelChunk voxelsFromDensities(IVec3 vox_origin, Int32 voxel_scale);
 
 		void setNoiseScratchBufferValue(float value);
 
@@ -90,31 +105,36 @@ class NoiseLayers: public GenerationAlgorithm{
 class Fractal: public GenerationAlgorithm{
 	public:
 		RawVoxelChunk generate(const ChunkTable* table, IVec3 coords);
-		//RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
+		GenerationAlgorithm* clone() const;
+		RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
 };
 
 class CenteredSphere: public GenerationAlgorithm{
 	public:
 		RawVoxelChunk generate(const ChunkTable* table, IVec3 coords);
-		//RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
+		GenerationAlgorithm* clone() const;
+		RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
 };
 
 class Scratch: public GenerationAlgorithm{
 	public:
 		RawVoxelChunk generate(const ChunkTable* table, IVec3 coords);
-		//RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
+		GenerationAlgorithm* clone() const;
+		RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
 };
 
 class PillarsAndCaves: public GenerationAlgorithm{
 	public:
 		RawVoxelChunk generate(const ChunkTable* table, IVec3 coords);
-		//RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power); 
+		GenerationAlgorithm* clone() const;
+		RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
 };
 
 class MeshTesting: public GenerationAlgorithm{
 	public:
 		RawVoxelChunk generate(const ChunkTable* table, IVec3 coords);
-		//RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
+		GenerationAlgorithm* clone() const;
+		RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
 };
 
 //-----------------------------------------------
@@ -123,16 +143,29 @@ class MeshTesting: public GenerationAlgorithm{
 class ChunkGenerator{
 	/*
 	TODO: Add support for multiple algorithms running simultaneously.
+
+	THREADING: Each worker has its own copy of the algorithm, so different 
+		workers can generate at the same time. A single worker can't.
 	*/
 
 	public:
+		ChunkGenerator();
+
 		void setSeed(Bytes8 seed);
 		void setAlgorithm(std::shared_ptr<GenerationAlgorithm> algorithm);
-		RawVoxelChunk generate(const ChunkTable* table, IVec3 coords);
-		//RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power);
+		void setNumWorkers(Int32 num_workers);
+		Int32 numWorkers() const;
+		RawVoxelChunk generate(const ChunkTable* table, IVec3 coords, Int32 worker_index=0);
+		RawVoxelChunk generateLodChunk(const ChunkTable* table, IVec3 coords, int lod_power, 
+			Int32 worker_index=0);
+
+	private:
+		void cloneWorkerAlgorithms();
 
 	private:
-		std::shared_ptr<GenerationAlgorithm> m_algorithm;
+		Int32 m_num_workers;
+		std::shared_ptr<GenerationAlgorithm> m_algorithm;  // Worker 0's
+		std::vector<std::shared_ptr<GenerationAlgorithm>> m_worker_algorithms;  // Indexed by worker
 		//std::vector<std::shared_ptr<GenerationAlgorithm>> m_algorithm_list;
 };
 
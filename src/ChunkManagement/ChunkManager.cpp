@@ -1,5 +1,11 @@
 #include "ChunkManager.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <sys/stat.h>  // For mkdir
+
 
 //-------------------------------------------------------------------------------------------------
 // Chunk Manager
@@ -7,14 +13,30 @@
 ChunkManager::ChunkManager(){
 	//ChunkManagerConfig default_config = initDefaultConfig();
 	//init(default_config);
+	m_camera_pos = {0, 0, 0};
+	m_frame = 0;
+	m_config.streaming_settings = {0, 0, 0};
+	m_should_stop_streaming = false;
+	m_stream_center = {0, 0, 0};
+	m_stream_view_dir = {0, 0, 0};
+	m_stream_frames_since_requeue = 0;
 }
 
 ChunkManager::ChunkManager(std::weak_ptr<Settings> settings){
+	m_camera_pos = {0, 0, 0};
+	m_frame = 0;
+	m_should_stop_streaming = false;
+	m_stream_center = {0, 0, 0};
+	m_stream_view_dir = {0, 0, 0};
+	m_stream_frames_since_requeue = 0;
 	updateWithSettings(settings);
 }
 
 ChunkManager::~ChunkManager(){
-
+	stopStreaming();
+	for(RawVoxelChunk* chunk_ptr : m_lod_chunk_slots){
+		delete chunk_ptr;
+	}
 }
 
 /*
@@ -34,18 +56,35 @@ void ChunkManager::addInstruction(ChunkInstruction instruction){
 	m_waiting_instructions.push_back(instruction);
 }
 
+void ChunkManager::addEdits(const VoxelEditBatch& batch){
+	/*
+	Queues voxel edits for the next processInstructions(). Edits to chunks
+	that aren't loaded by then are dropped, but evicted chunks are paged 
+	back in for them.
+	*/
+
+	m_waiting_edits.append(batch);
+}
+
 void ChunkManager::processInstructions(){
 	/*
-	TODO: More efficient instruction batching
+	Instructions for LOD cells (lod_power above 0) go to the LOD cell store
+	instead of the table. Only generating, erasing and using them is 
+	supported.
 
-	WARNING: Does not take LOD levels into account
+	TODO: More efficient instruction batching
 	*/
 
 	assert(m_managed_table_ptr != NULL);
 
 	std::unordered_map<ChunkInstructionType, std::vector<IVec3>> batched_instructions;
+	std::unordered_map<ChunkInstructionType, std::vector<CellAddress>> batched_lod_instructions;
 	for(ChunkInstruction instruction : m_waiting_instructions){
-		batched_instructions[instruction.type].push_back(instruction.lod_addr.corner_addr);
+		if(instruction.lod_addr.lod_power > 0){
+			batched_lod_instructions[instruction.type].push_back(instruction.lod_addr);
+		}else{
+			batched_instructions[instruction.type].push_back(instruction.lod_addr.corner_addr);
+		}
 	}
 	m_waiting_instructions.clear();
 
@@ -61,6 +100,9 @@ void ChunkManager::processInstructions(){
 			case CHUNK_ERASE:
 				eraseChunks(batched_coords);
 				break;
+			case CHUNK_USE:
+				useChunks(batched_coords);
+				break;
 			case CHUNK_LOAD_FROM_FILE:
 				loadChunksFromFile(batched_coords);
 				break;
@@ -75,17 +117,143 @@ void ChunkManager::processInstructions(){
 				assert(false);
 		}
 	}
+
+	for(auto iter : batched_lod_instructions){
+		ChunkInstructionType instruction_type = iter.first;
+		std::vector<CellAddress>& batched_cells = iter.second;
+		switch(instruction_type){
+			case CHUNK_INVALID:
+				continue;
+			case CHUNK_GENERATE:
+				generateLodChunks(batched_cells);
+				break;
+			case CHUNK_ERASE:
+				eraseLodChunks(batched_cells);
+				break;
+			case CHUNK_USE:
+				useLodChunks(batched_cells);
+				break;
+			default:
+				printf("ERROR: Chunk instruction type %i isn't supported for LOD cells\n", 
+					instruction_type);
+		}
+	}
+
+	applyWaitingEdits();
+}
+
+void ChunkManager::updateResidency(FVec3 camera_pos){
+	/*
+	Call once per frame. Moves the table to a new read frame, pages back in
+	the evicted chunks something looked at last frame, and evicts the least
+	valuable chunks if the table holds more than the resident budget. 
+	Evicting down to a bit under the budget means this doesn't evict a 
+	handful of chunks every single frame.
+	*/
+
+	constexpr float ARBITRARY_EVICTION_TARGET = 0.9;
+
+	assert(m_managed_table_ptr != NULL);
+	m_camera_pos = camera_pos;
+	++m_frame;
+	m_managed_table_ptr->setReadFrame(m_frame);
+
+	// Ray walks and region rebuilds stamp the evicted chunks they need
+	std::vector<IVec3> wanted_coords = m_managed_table_ptr->evictedChunksReadSince(m_frame - 1);
+	useChunks(wanted_coords);
+
+	Uint64 budget_bytes = m_config.resident_budget_bytes;
+	if(budget_bytes == 0){
+		return;
+	}
+
+	Uint64 resident_bytes = m_managed_table_ptr->numResidentBytes();
+	if(resident_bytes > budget_bytes){
+		Uint64 target_bytes = budget_bytes * ARBITRARY_EVICTION_TARGET;
+		evictChunks(resident_bytes - target_bytes, 0);
+	}
+}
+
+std::vector<IVec3> ChunkManager::updateStreaming(FVec3 camera_pos, FVec3 view_dir){
+	/*
+	Call once per frame. Keeps every chunk within the stream radius of the
+	camera's chunk loaded without blocking. Missing chunks are read or 
+	generated on the streaming threads, closest and most in view first, and
+	at most chunks_per_frame of them are added to the table per call. 
+	Returns the coordinates added, so meshes can be made for them.
+
+	Requests for chunks that leave the radius are cancelled, and chunks 
+	that leave it while being generated are dropped once they're done.
+	*/
+
+	constexpr Uint32 ARBITRARY_FRAMES_PER_REQUEUE = 30;
+	constexpr float ARBITRARY_REQUEUE_VIEW_COS = 0.9;  // About 25 degrees
+
+	if(!isStreaming()){
+		return {};
+	}
+
+	assert(m_managed_table_ptr != NULL);
+	bool is_starting = m_stream_threads.size() == 0;
+	if(is_starting){
+		startStreaming();
+	}
+
+	// Chunks in range can also go missing through eviction or erasure, so
+	// the queue is rebuilt every so often even if the camera holds still.
+	IVec3 camera_voxel = {
+		(Int32) floor(camera_pos.x), (Int32) floor(camera_pos.y), (Int32) floor(camera_pos.z)
+	};
+	IVec3 center_chunk = chunkCoordFromVoxelCoord(camera_voxel);
+	bool has_moved = !(center_chunk == m_stream_center);
+	bool has_turned = view_dir.dot(m_stream_view_dir) < ARBITRARY_REQUEUE_VIEW_COS;
+	++m_stream_frames_since_requeue;
+	if(is_starting || has_moved || has_turned 
+		|| m_stream_frames_since_requeue >= ARBITRARY_FRAMES_PER_REQUEUE){
+		
+		requeueStreamRequests(center_chunk, view_dir);
+	}
+
+	return integrateStreamedChunks();
+}
+
+bool ChunkManager::isStreaming() const{
+	return m_config.streaming_settings.radius > 0;
+}
+
+const RawVoxelChunk* ChunkManager::lodChunkPtr(CellAddress addr) const{
+	/*
+	Returns NULL if the LOD cell wasn't generated. The pointer stays valid
+	until the cell is erased or regenerated.
+	*/
+
+	CellQuery query = m_lod_cells.cellData(addr);
+	if(!query.is_valid){
+		return NULL;
+	}
+	return m_lod_chunk_slots[query.cell.data];
+}
+
+std::vector<CellAddress> ChunkManager::allLodCells() const{
+	return m_lod_cells.allAddresses();
 }
 
 void ChunkManager::setManagedTable(ChunkTable& table){
+	stopStreaming();
 	m_managed_table_ptr = &table;
+	if(!table.setMaxLoadedChunks(m_config.max_loaded_chunks)){
+		printf("ERROR: Table keeps its capacity of %i chunks\n", table.maxLoadedChunks());
+	}
 }
 
 void ChunkManager::updateWithSettings(std::weak_ptr<Settings> settings_ptr){
 	/*
-	Initializes the ChunkManager
+	Initializes the ChunkManager. Streaming threads are stopped, since the
+	generator they use is about to be replaced. The next updateStreaming()
+	restarts them.
 	*/
 
+	stopStreaming();
 	m_settings_ptr = settings_ptr;
 	auto shared_ptr = settings_ptr.lock();
 	assert(shared_ptr);
@@ -99,6 +267,52 @@ void ChunkManager::updateWithSettings(std::weak_ptr<Settings> settings_ptr){
 	Int32 seed = seed_data.val_int;
 	printf("Running with seed %i\n", seed);
 
+	// Settings built in code (like the benchmark's) may not set a capacity
+	PODVariant max_chunks_data = gen_settings["MaxLoadedChunks"];
+	m_config.max_loaded_chunks = ChunkTable::DEFAULT_MAX_LOADED_CHUNKS;
+	if(max_chunks_data.type == PODVariant::DATATYPE_INT32){
+		m_config.max_loaded_chunks = max_chunks_data.val_int;
+	}
+	PODVariant budget_data = gen_settings["ResidentBudgetMB"];
+	m_config.resident_budget_bytes = 0;
+	if(budget_data.type == PODVariant::DATATYPE_INT32 && budget_data.val_int > 0){
+		m_config.resident_budget_bytes = (Uint64) budget_data.val_int << 20;
+	}
+	PODVariant directory_data = gen_settings["ChunkDirectory"];
+	m_config.chunk_directory = PODString::init("Chunks");
+	if(directory_data.type == PODVariant::DATATYPE_STRING){
+		m_config.chunk_directory = directory_data.val_string;
+	}
+	m_config.generator_settings.algorithm_name = name;
+	m_config.generator_settings.seed = seed;
+
+	// Generation runs on up to this many threads. 0 or less means one per core.
+	Int32 num_cores = std::max(1u, std::thread::hardware_concurrency());
+	PODVariant threads_data = shared_ptr->namespaceRef("ENGINE")["NumWorkerThreads"];
+	m_config.max_parallel_generators = 1;
+	if(threads_data.type == PODVariant::DATATYPE_INT32){
+		m_config.max_parallel_generators = threads_data.val_int > 0 
+			? std::min(threads_data.val_int, num_cores) : num_cores;
+	}
+
+	// Streaming is off unless a radius is given
+	PODVariant radius_data = gen_settings["StreamRadius"];
+	PODVariant stream_threads_data = gen_settings["StreamThreads"];
+	PODVariant chunks_per_frame_data = gen_settings["StreamChunksPerFrame"];
+	m_config.streaming_settings.radius = 0;
+	m_config.streaming_settings.num_threads = 1;
+	m_config.streaming_settings.chunks_per_frame = 4;
+	if(radius_data.type == PODVariant::DATATYPE_INT32 && radius_data.val_int > 0){
+		m_config.streaming_settings.radius = radius_data.val_int;
+	}
+	if(stream_threads_data.type == PODVariant::DATATYPE_INT32 && stream_threads_data.val_int > 0){
+		m_config.streaming_settings.num_threads = stream_threads_data.val_int;
+	}
+	if(chunks_per_frame_data.type == PODVariant::DATATYPE_INT32 
+		&& chunks_per_frame_data.val_int > 0){
+		m_config.streaming_settings.chunks_per_frame = chunks_per_frame_data.val_int;
+	}
+
 	GenerationAlgorithm* generator_ptr = NULL;
 	if(name == "Default"){
 		generator_ptr = new NoiseLayers;
@@ -123,6 +337,11 @@ void ChunkManager::updateWithSettings(std::weak_ptr<Settings> settings_ptr){
 	std::shared_ptr<GenerationAlgorithm> default_algorithm(generator_ptr);
 	m_generator.setAlgorithm(default_algorithm);
 	m_generator.setSeed(seed);
+
+	// Streaming threads get the workers after generateChunks()'s, so both
+	// can generate at the same time.
+	Int32 num_stream_workers = isStreaming() ? m_config.streaming_settings.num_threads : 0;
+	m_generator.setNumWorkers(m_config.max_parallel_generators + num_stream_workers);
 	m_managed_table_ptr = NULL;
 }
 
@@ -138,15 +357,91 @@ void printChunkList(std::vector<IVec3>& coords){
 
 void ChunkManager::generateChunks(std::vector<IVec3>& coords){
 	/*
+	Generates on up to max_parallel_generators threads, each with its own 
+	copy of the algorithm. Threads claim one chunk at a time and insert 
+	what they've generated a few chunks at a time, so the table's lock is 
+	taken once per batch and the calling thread isn't left inserting 
+	everything at the end.
+
 	WARNING: Function not complete
 	WARNING: Blindly overwrites any existing chunks at the given coordinates.
 	*/
 	//printf("Generating %li chunks:\n", coords.size());
 	//printChunkList(coords);
 
-	for(IVec3 coord : coords){
-		RawVoxelChunk new_chunk = m_generator.generate(m_managed_table_ptr, coord);
-		m_managed_table_ptr->setChunk(coord, new_chunk);
+	constexpr Int32 ARBITRARY_CHUNKS_PER_INSERT = 8;
+
+	if(coords.size() == 0){
+		return;
+	}
+	makeRoomFor(coords);
+
+	ChunkTable* table_ptr = m_managed_table_ptr;
+	std::atomic<Uint64> next_coord_index{0};
+	std::vector<Uint8> is_set_by_index(coords.size(), false);
+	auto generate_chunks = [&](Int32 worker_index){
+		std::vector<Uint64> batch_indices;
+		std::vector<IVec3> batch_coords;
+		std::vector<RawVoxelChunk> batch_chunks;
+		batch_indices.reserve(ARBITRARY_CHUNKS_PER_INSERT);
+		batch_coords.reserve(ARBITRARY_CHUNKS_PER_INSERT);
+		batch_chunks.reserve(ARBITRARY_CHUNKS_PER_INSERT);
+
+		Uint64 coord_index;
+		while((coord_index = next_coord_index++) < coords.size()){
+			IVec3 coord = coords[coord_index];
+			batch_indices.push_back(coord_index);
+			batch_coords.push_back(coord);
+			batch_chunks.push_back(m_generator.generate(table_ptr, coord, worker_index));
+			if(batch_chunks.size() < ARBITRARY_CHUNKS_PER_INSERT){
+				continue;
+			}
+
+			std::vector<bool> is_set = table_ptr->setChunks(batch_coords, batch_chunks);
+			for(Uint64 i = 0; i < batch_indices.size(); ++i){
+				is_set_by_index[batch_indices[i]] = is_set[i];
+			}
+			batch_indices.clear();
+			batch_coords.clear();
+			batch_chunks.clear();
+		}
+
+		// Whatever's left once every chunk has been claimed
+		if(batch_chunks.size() > 0){
+			std::vector<bool> is_set = table_ptr->setChunks(batch_coords, batch_chunks);
+			for(Uint64 i = 0; i < batch_indices.size(); ++i){
+				is_set_by_index[batch_indices[i]] = is_set[i];
+			}
+		}
+	};
+
+	Int32 num_threads = std::min((Uint64) m_config.max_parallel_generators, coords.size());
+	std::vector<std::thread> threads;
+	for(Int32 i = 1; i < num_threads; ++i){
+		threads.push_back(std::thread(generate_chunks, i));
+	}
+	generate_chunks(0);
+	for(std::thread& thread : threads){
+		thread.join();
+	}
+
+	Int32 num_refused = 0;
+	for(Uint64 i = 0; i < coords.size(); ++i){
+		IVec3 coord = coords[i];
+		if(is_set_by_index[i]){
+			// Paging in would bring back the saved chunk instead
+			if(isChunkFileSaved(coord)){
+				m_unsaved_chunks.insert(coord);
+			}else{
+				m_unsaved_chunks.erase(coord);
+			}
+		}else{
+			++num_refused;
+		}
+	}
+	if(num_refused > 0){
+		printf("ERROR: Chunk table is full (%i chunks). %i chunks weren't loaded.\n",
+			m_managed_table_ptr->maxLoadedChunks(), num_refused);
 	}
 }
 
@@ -159,44 +454,610 @@ void ChunkManager::eraseChunks(std::vector<IVec3>& coords){
 	//printChunkList(coords);
 
 	m_managed_table_ptr->eraseChunks(coords);
+	for(IVec3 coord : coords){
+		m_unsaved_chunks.erase(coord);
+	}
+}
+
+void ChunkManager::useChunks(std::vector<IVec3>& coords){
+	/*
+	Pages in any of the chunks that aren't loaded. Saved chunks are loaded
+	from their files, and the rest are generated. Loaded chunks count as 
+	read, so they aren't evicted right away.
+	*/
+
+	std::vector<IVec3> saved_coords;
+	std::vector<IVec3> generated_coords;
+	for(IVec3 coord : coords){
+		if(m_managed_table_ptr->touchChunk(coord)){
+			continue;
+		}else if(isChunkFileSaved(coord)){
+			saved_coords.push_back(coord);
+		}else{
+			generated_coords.push_back(coord);
+		}
+	}
+
+	loadChunksFromFile(saved_coords);
+	generateChunks(generated_coords);
 }
 
 void ChunkManager::loadChunksFromFile(std::vector<IVec3>& coords){
 	/*
-	WARNING: Function not implemented
+	WARNING: Blindly overwrites any existing chunks at the given coordinates.
 	*/
-	
-	//printf("Loading %li chunks:\n", coords.size());
-	//printChunkList(coords);
 
+	makeRoomFor(coords);
+
+	RawVoxelChunk chunk_data;
 	for(IVec3 coord : coords){
-		
+		if(!readChunkFile(coord, chunk_data)){
+			continue;
+		}
+		if(m_managed_table_ptr->setChunk(coord, chunk_data)){
+			m_unsaved_chunks.erase(coord);
+		}else{
+			printf("ERROR: Chunk table is full (%i chunks). Couldn't load {%i, %i, %i}.\n",
+				m_managed_table_ptr->maxLoadedChunks(), coord.x, coord.y, coord.z);
+		}
 	}
 }
 
 void ChunkManager::saveChunksToFile(std::vector<IVec3>& coords){
 	/*
-	WARNING: Function not implemented
+	Saves every given chunk that's loaded. The rest are skipped.
 	*/
-	
-	//printf("Saving %li chunks:\n", coords.size());
-	//printChunkList(coords);
 
+	ChunkTable::ReadGuard read_guard(*m_managed_table_ptr);
 	for(IVec3 coord : coords){
-		
+		const RawVoxelChunk* chunk_ptr = m_managed_table_ptr->getChunkPtr(coord);
+		if(chunk_ptr != NULL && writeChunkFile(coord, *chunk_ptr)){
+			m_unsaved_chunks.erase(coord);
+		}
 	}
 }
 
 void ChunkManager::eraseChunksFromFile(std::vector<IVec3>& coords){
 	/*
-	WARNING: Function not implemented
+	Loaded chunks are kept, but now only exist in memory.
+
+	THREADING: Streaming threads may be reading the same files. Waits for 
+		them to finish those chunks and drops any streamed chunk that came
+		from an erased file, since it would otherwise be integrated as if 
+		it were saved. Files are removed with the lock held, so a chunk 
+		claimed afterwards is generated instead.
 	*/
-	//printf("Erasing %li chunks from file:\n", coords.size());
-	//printChunkList(coords);
+
+	std::unordered_set<IVec3, PODHasher> erased_coords(coords.begin(), coords.end());
+	auto is_erased = [&erased_coords](IVec3 coord){
+		return erased_coords.count(coord) > 0;
+	};
+
+	std::unique_lock<std::mutex> lock(m_stream_mutex);
+	m_stream_finished_condition.wait(lock, [&]{
+		return std::none_of(m_stream_claimed_coords.begin(), m_stream_claimed_coords.end(), 
+			is_erased);
+	});
+
+	std::vector<StreamResult*> kept_results;
+	for(StreamResult* result_ptr : m_stream_results){
+		if(result_ptr->is_from_file && is_erased(result_ptr->coord)){
+			m_stream_busy_coords.erase(result_ptr->coord);
+			delete result_ptr;
+		}else{
+			kept_results.push_back(result_ptr);
+		}
+	}
+	m_stream_results.swap(kept_results);
 
 	for(IVec3 coord : coords){
-		
+		if(std::remove(chunkFilepath(coord).c_str()) == 0 
+			&& m_managed_table_ptr->isLoaded(coord)){
+			m_unsaved_chunks.insert(coord);
+		}
+	}
+}
+
+void ChunkManager::applyWaitingEdits(){
+	/*
+	Applies every queued edit in one batch. Edited chunks can't be 
+	regenerated, so they're saved before being evicted. Caches built from 
+	the table see the edits through its change journal.
+	*/
+
+	if(m_waiting_edits.numEdits() == 0){
+		return;
+	}
+
+	// The table drops edits to evicted chunks, so those come back first.
+	// Loaded ones are touched so paging in doesn't evict them instead.
+	std::unordered_set<IVec3, PODHasher> evicted_coords;
+	for(const VoxelEdit& edit : m_waiting_edits.edits()){
+		IVec3 first = chunkCoordFromVoxelCoord(edit.bounds.origin);
+		IVec3 last = chunkCoordFromVoxelCoord(
+			edit.bounds.origin + edit.bounds.extent - IVec3{1, 1, 1});
+		for(Int32 z = first.z; z <= last.z; ++z)
+		for(Int32 y = first.y; y <= last.y; ++y)
+		for(Int32 x = first.x; x <= last.x; ++x){
+			IVec3 coord = {x, y, z};
+			if(!m_managed_table_ptr->touchChunk(coord) && m_managed_table_ptr->isEvicted(coord)){
+				evicted_coords.insert(coord);
+			}
+		}
+	}
+	std::vector<IVec3> paged_coords(evicted_coords.begin(), evicted_coords.end());
+	useChunks(paged_coords);
+
+	std::vector<IVec3> edited_coords = m_managed_table_ptr->applyEdits(m_waiting_edits);
+	m_waiting_edits.clear();
+	for(IVec3 coord : edited_coords){
+		m_unsaved_chunks.insert(coord);
+	}
+}
+
+void ChunkManager::generateLodChunks(std::vector<CellAddress>& cells){
+	/*
+	Generates each cell's coarse chunk straight from the algorithm, so a cell
+	costs about as much as one full resolution chunk however many chunks it
+	covers. Cells that were already generated are generated again. Runs on
+	the same threads as generateChunks().
+
+	WARNING: LOD cells aren't evicted and don't count towards the resident
+		budget. Erase them once they're out of use.
+	*/
+
+	// Every distinct cell gets its slot up front, so threads only write 
+	// to the slots they claimed
+	std::unordered_set<CellAddress, PODHasher> seen_cells;
+	std::vector<CellAddress> unique_cells;
+	std::vector<RawVoxelChunk*> output_ptrs;
+	for(CellAddress addr : cells){
+		assert(addr.lod_power > 0);
+		if(!seen_cells.insert(addr).second){
+			continue;
+		}
+
+		CellQuery query = m_lod_cells.cellData(addr);
+		Uint32 slot_index;
+		if(query.is_valid){
+			slot_index = query.cell.data;
+		}else{
+			if(m_free_lod_slots.size() > 0){
+				slot_index = m_free_lod_slots.back();
+				m_free_lod_slots.pop_back();
+			}else{
+				slot_index = m_lod_chunk_slots.size();
+				m_lod_chunk_slots.push_back(NULL);
+			}
+			m_lod_chunk_slots[slot_index] = new RawVoxelChunk;
+			m_lod_cells.addCell(addr, {slot_index});
+		}
+		unique_cells.push_back(addr);
+		output_ptrs.push_back(m_lod_chunk_slots[slot_index]);
+	}
+
+	if(unique_cells.size() == 0){
+		return;
+	}
+
+	std::atomic<Uint64> next_cell_index{0};
+	auto generate_cells = [&](Int32 worker_index){
+		Uint64 cell_index;
+		while((cell_index = next_cell_index++) < unique_cells.size()){
+			CellAddress addr = unique_cells[cell_index];
+			*output_ptrs[cell_index] = m_generator.generateLodChunk(m_managed_table_ptr, 
+				addr.corner_addr, addr.lod_power, worker_index);
+		}
+	};
+
+	Int32 num_threads = std::min((Uint64) m_config.max_parallel_generators, unique_cells.size());
+	std::vector<std::thread> threads;
+	for(Int32 i = 1; i < num_threads; ++i){
+		threads.push_back(std::thread(generate_cells, i));
+	}
+	generate_cells(0);
+	for(std::thread& thread : threads){
+		thread.join();
+	}
+}
+
+void ChunkManager::eraseLodChunks(std::vector<CellAddress>& cells){
+	for(CellAddress addr : cells){
+		CellQuery query = m_lod_cells.cellData(addr);
+		if(!query.is_valid){
+			continue;
+		}
+
+		Uint32 slot_index = query.cell.data;
+		delete m_lod_chunk_slots[slot_index];
+		m_lod_chunk_slots[slot_index] = NULL;
+		m_free_lod_slots.push_back(slot_index);
+		m_lod_cells.eraseData(addr);
+	}
+}
+
+void ChunkManager::useLodChunks(std::vector<CellAddress>& cells){
+	/*
+	Generates the cells that weren't generated yet.
+	*/
+
+	std::vector<CellAddress> missing_cells;
+	for(CellAddress addr : cells){
+		if(!m_lod_cells.cellData(addr).is_valid){
+			missing_cells.push_back(addr);
+		}
+	}
+	generateLodChunks(missing_cells);
+}
+
+Int32 ChunkManager::evictChunks(Uint64 num_bytes_to_free, Int32 num_chunks_to_free){
+	/*
+	Evicts the least valuable chunks until both amounts are freed, or no 
+	evictable chunks are left. Unsaved chunks are saved first. Returns the
+	number of chunks evicted.
+
+	Evicted chunks stay in the world, see ChunkTable::evictChunks(), so 
+	caches built from the table keep them. Paging one back in from its 
+	file, or by generating it again, brings back the same voxels.
+
+	A chunk's value drops with its distance from the camera and with the 
+	frames since it was last read. Chunks read in the last couple of 
+	frames are never evicted, since something is still using them.
+	*/
+
+	constexpr Uint32 ARBITRARY_MIN_IDLE_FRAMES = 2;
+	constexpr float ARBITRARY_IDLE_FRAMES_PER_CHUNK_DISTANCE = 30;
+
+	std::vector<ChunkTable::ChunkResidency> residency_info = 
+		m_managed_table_ptr->residencyInfo();
+	std::vector<std::pair<float, Int32>> ranked_chunks;  // Score and info index
+	ranked_chunks.reserve(residency_info.size());
+	for(Uint64 i = 0; i < residency_info.size(); ++i){
+		const ChunkTable::ChunkResidency& residency = residency_info[i];
+		Uint32 idle_frames = m_frame - residency.last_read_frame;
+		if(idle_frames < ARBITRARY_MIN_IDLE_FRAMES){
+			continue;
+		}
+
+		FVec3 chunk_center = (toFloatVector(residency.coord) + FVec3{0.5, 0.5, 0.5}) * CHUNK_LEN;
+		float distance = (chunk_center - m_camera_pos).length() / CHUNK_LEN;
+		float score = distance + idle_frames / ARBITRARY_IDLE_FRAMES_PER_CHUNK_DISTANCE;
+		ranked_chunks.push_back({score, (Int32) i});
+	}
+	std::sort(ranked_chunks.begin(), ranked_chunks.end(), 
+		[](const auto& a, const auto& b){return a.first > b.first;});
+
+	std::vector<IVec3> evicted_coords;
+	Uint64 num_bytes_freed = 0;
+	{
+		ChunkTable::ReadGuard read_guard(*m_managed_table_ptr);
+		for(auto [score, info_index] : ranked_chunks){
+			bool is_done = num_bytes_freed >= num_bytes_to_free 
+				&& (Int32) evicted_coords.size() >= num_chunks_to_free;
+			if(is_done){
+				break;
+			}
+
+			// Chunks that can't be saved stay loaded
+			IVec3 coord = residency_info[info_index].coord;
+			if(m_unsaved_chunks.count(coord)){
+				const RawVoxelChunk* chunk_ptr = m_managed_table_ptr->getChunkPtr(coord);
+				if(chunk_ptr == NULL || !writeChunkFile(coord, *chunk_ptr)){
+					continue;
+				}
+				m_unsaved_chunks.erase(coord);
+			}
+			evicted_coords.push_back(coord);
+			num_bytes_freed += residency_info[info_index].num_bytes;
+		}
+	}
+
+	m_managed_table_ptr->evictChunks(evicted_coords);
+	return evicted_coords.size();
+}
+
+void ChunkManager::makeRoomFor(const std::vector<IVec3>& coords){
+	/*
+	Evicts chunks until the table can take every given chunk that isn't 
+	loaded yet. 
+	*/
+
+	Int32 num_new_chunks = 0;
+	for(IVec3 coord : coords){
+		num_new_chunks += !m_managed_table_ptr->isLoaded(coord);
+	}
+
+	Int32 num_free_chunks = m_managed_table_ptr->maxLoadedChunks() 
+		- m_managed_table_ptr->numLoadedChunks();
+	if(num_new_chunks > num_free_chunks){
+		evictChunks(0, num_new_chunks - num_free_chunks);
+	}
+}
+
+std::string ChunkManager::chunkFilepath(IVec3 coord) const{
+	return std::string(m_config.chunk_directory.text) + "/chunk_" + std::to_string(coord.x) 
+		+ "_" + std::to_string(coord.y) + "_" + std::to_string(coord.z) + ".bin";
+}
+
+bool ChunkManager::isChunkFileSaved(IVec3 coord) const{
+	struct stat file_info;
+	return stat(chunkFilepath(coord).c_str(), &file_info) == 0;
+}
+
+bool ChunkManager::writeChunkFile(IVec3 coord, const RawVoxelChunk& chunk_data){
+	/*
+	Returns False if the file couldn't be written.
+
+	THREADING: Streaming threads read chunk files without the lock, so the
+		chunk is written to a temporary file that replaces the old one in a
+		single rename(). Readers see either the whole old file or the whole
+		new one.
+	*/
+
+	// Fails harmlessly once the directory exists
+	mkdir(m_config.chunk_directory.text, 0755);
+
+	ChunkFileHeader header;
+	memset(&header, 0, sizeof(ChunkFileHeader));
+	memcpy(header.magic, CHUNK_FILE_MAGIC, sizeof(CHUNK_FILE_MAGIC));
+	header.version = CHUNK_FILE_VERSION;
+	header.voxel_layout = CHUNK_VOXEL_LAYOUT;
+	header.coord = coord;
+
+	std::string filepath = chunkFilepath(coord);
+	std::string temp_filepath = filepath + ".tmp";
+	std::ofstream file(temp_filepath, std::ios::binary | std::ios::trunc);
+	file.write((const char*) &header, sizeof(ChunkFileHeader));
+	file.write((const char*) chunk_data.data, sizeof(RawVoxelChunk));
+	file.close();
+	if(!file.good() || std::rename(temp_filepath.c_str(), filepath.c_str()) != 0){
+		printf("ERROR: Couldn't write '%s'!\n", filepath.c_str());
+		std::remove(temp_filepath.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool ChunkManager::readChunkFile(IVec3 coord, RawVoxelChunk& output) const{
+	/*
+	Returns False if the file is missing or isn't a chunk file for the 
+	coordinate.
+	*/
+
+	std::string filepath = chunkFilepath(coord);
+	std::ifstream file(filepath, std::ios::binary);
+	ChunkFileHeader header;
+	file.read((char*) &header, sizeof(ChunkFileHeader));
+	file.read((char*) output.data, sizeof(RawVoxelChunk));
+	if(!file.good()){
+		printf("ERROR: Couldn't read '%s'!\n", filepath.c_str());
+		return false;
+	}
+
+	bool is_valid = memcmp(header.magic, CHUNK_FILE_MAGIC, sizeof(CHUNK_FILE_MAGIC)) == 0
+		&& header.version == CHUNK_FILE_VERSION && header.voxel_layout == CHUNK_VOXEL_LAYOUT 
+		&& header.coord == coord;
+	if(!is_valid){
+		printf("ERROR: '%s' isn't a chunk file for {%i, %i, %i}!\n", filepath.c_str(), 
+			coord.x, coord.y, coord.z);
+	}
+	return is_valid;
+}
+
+void ChunkManager::startStreaming(){
+	/*
+	Streaming threads use the generator workers after generateChunks()'s.
+	*/
+
+	assert(m_stream_threads.size() == 0);
+	m_should_stop_streaming = false;
+	m_stream_frames_since_requeue = 0;
+
+	Int32 first_worker_index = m_config.max_parallel_generators;
+	for(Int32 i = 0; i < m_config.streaming_settings.num_threads; ++i){
+		m_stream_threads.push_back(
+			std::thread(&ChunkManager::streamChunks, this, first_worker_index + i));
+	}
+}
+
+void ChunkManager::stopStreaming(){
+	/*
+	Cancels every request, waits for the chunks being generated, and drops
+	them along with any that weren't integrated yet.
+	*/
+
+	if(m_stream_threads.size() == 0){
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_stream_mutex);
+		m_should_stop_streaming = true;
+		m_stream_queue.clear();
+	}
+	m_stream_condition.notify_all();
+	for(std::thread& thread : m_stream_threads){
+		thread.join();
+	}
+	m_stream_threads.clear();
+
+	for(StreamResult* result_ptr : m_stream_results){
+		delete result_ptr;
+	}
+	m_stream_results.clear();
+	m_stream_busy_coords.clear();
+	m_stream_claimed_coords.clear();
+}
+
+void ChunkManager::streamChunks(Int32 worker_index){
+	/*
+	Body of each streaming thread. Takes the next request, reads the chunk 
+	if it was saved and generates it otherwise, then leaves it for 
+	integrateStreamedChunks(). Runs until stopStreaming().
+
+	THREADING: The table is never written from here, and the generator is
+		only used through this thread's own worker. Chunk files are replaced
+		whole by writeChunkFile(), and eraseChunksFromFile() waits for the 
+		chunks it erases to finish here.
+	*/
+
+	while(true){
+		StreamRequest request;
+		{
+			std::unique_lock<std::mutex> lock(m_stream_mutex);
+			m_stream_condition.wait(lock, [this]{
+				return m_should_stop_streaming || m_stream_queue.size() > 0;
+			});
+			if(m_should_stop_streaming){
+				return;
+			}
+
+			request = m_stream_queue.back();
+			m_stream_queue.pop_back();
+			m_stream_busy_coords.insert(request.coord);
+			m_stream_claimed_coords.insert(request.coord);
+		}
+
+		StreamResult* result_ptr = new StreamResult;
+		result_ptr->coord = request.coord;
+		result_ptr->is_from_file = isChunkFileSaved(request.coord) 
+			&& readChunkFile(request.coord, result_ptr->chunk_data);
+		if(!result_ptr->is_from_file){
+			result_ptr->chunk_data = m_generator.generate(m_managed_table_ptr, 
+				request.coord, worker_index);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_stream_mutex);
+			m_stream_results.push_back(result_ptr);
+			m_stream_claimed_coords.erase(request.coord);
+		}
+		m_stream_finished_condition.notify_all();
+	}
+}
+
+void ChunkManager::requeueStreamRequests(IVec3 center_chunk, FVec3 view_dir){
+	/*
+	Replaces the queue with every missing chunk in range, which cancels 
+	the requests that aren't in range anymore. Priority is the distance
+	from the camera's chunk, scaled up for chunks away from the view 
+	direction. A chunk right behind the camera waits as long as one twice 
+	as far ahead.
+	*/
+
+	constexpr float ARBITRARY_BEHIND_PENALTY = 1.0;
+
+	m_stream_center = center_chunk;
+	m_stream_view_dir = view_dir;
+	m_stream_frames_since_requeue = 0;
+
+	Int32 radius = m_config.streaming_settings.radius;
+	std::vector<StreamRequest> requests;
+	for(Int32 z = -radius; z <= radius; ++z)
+	for(Int32 y = -radius; y <= radius; ++y)
+	for(Int32 x = -radius; x <= radius; ++x){
+		IVec3 coord = center_chunk + IVec3{x, y, z};
+		if(!isInStreamRange(coord) || m_managed_table_ptr->isLoaded(coord)){
+			continue;
+		}
+
+		FVec3 offset = toFloatVector(IVec3{x, y, z});
+		float distance = offset.length();
+		float facing = (distance > 0) ? offset.dot(view_dir) / distance : 1;
+		float priority = distance * (1 + ARBITRARY_BEHIND_PENALTY * (1 - facing) / 2);
+		requests.push_back({coord, priority});
+	}
+	std::sort(requests.begin(), requests.end(), 
+		[](const auto& a, const auto& b){return a.priority > b.priority;});
+
+	{
+		// Claimed and finished chunks are already on their way
+		std::lock_guard<std::mutex> lock(m_stream_mutex);
+		auto is_busy = [this](const StreamRequest& request){
+			return m_stream_busy_coords.count(request.coord) > 0;
+		};
+		requests.erase(std::remove_if(requests.begin(), requests.end(), is_busy), 
+			requests.end());
+		m_stream_queue.swap(requests);
 	}
+	m_stream_condition.notify_all();
+}
+
+std::vector<IVec3> ChunkManager::integrateStreamedChunks(){
+	/*
+	Adds up to chunks_per_frame finished chunks to the table, in the order
+	they finished. Chunks that left the stream radius or were loaded some 
+	other way in the meantime are dropped, and don't count towards the 
+	limit. Returns the coordinates of the chunks added.
+	*/
+
+	std::vector<StreamResult*> finished_results;
+	{
+		std::lock_guard<std::mutex> lock(m_stream_mutex);
+		finished_results.swap(m_stream_results);
+	}
+	if(finished_results.size() == 0){
+		return {};
+	}
+
+	std::vector<StreamResult*> accepted_results;
+	std::vector<StreamResult*> waiting_results;
+	std::vector<IVec3> done_coords;
+	for(StreamResult* result_ptr : finished_results){
+		IVec3 coord = result_ptr->coord;
+		bool is_wanted = isInStreamRange(coord) && !m_managed_table_ptr->isLoaded(coord);
+		if(!is_wanted){
+			done_coords.push_back(coord);
+			delete result_ptr;
+		}else if((Int32) accepted_results.size() < m_config.streaming_settings.chunks_per_frame){
+			accepted_results.push_back(result_ptr);
+		}else{
+			waiting_results.push_back(result_ptr);
+		}
+	}
+
+	std::vector<IVec3> accepted_coords;
+	for(StreamResult* result_ptr : accepted_results){
+		accepted_coords.push_back(result_ptr->coord);
+	}
+	makeRoomFor(accepted_coords);
+
+	std::vector<IVec3> integrated_coords;
+	for(StreamResult* result_ptr : accepted_results){
+		IVec3 coord = result_ptr->coord;
+		if(m_managed_table_ptr->setChunk(coord, result_ptr->chunk_data)){
+			// Same bookkeeping as loadChunksFromFile() and generateChunks()
+			if(!result_ptr->is_from_file && isChunkFileSaved(coord)){
+				m_unsaved_chunks.insert(coord);
+			}else{
+				m_unsaved_chunks.erase(coord);
+			}
+			integrated_coords.push_back(coord);
+		}else{
+			printf("ERROR: Chunk table is full (%i chunks). Couldn't stream {%i, %i, %i}.\n",
+				m_managed_table_ptr->maxLoadedChunks(), coord.x, coord.y, coord.z);
+		}
+		done_coords.push_back(coord);
+		delete result_ptr;
+	}
+
+	// Chunks past the limit go back ahead of the ones finished since
+	{
+		std::lock_guard<std::mutex> lock(m_stream_mutex);
+		m_stream_results.insert(m_stream_results.begin(), 
+			waiting_results.begin(), waiting_results.end());
+		for(IVec3 coord : done_coords){
+			m_stream_busy_coords.erase(coord);
+		}
+	}
+
+	return integrated_coords;
+}
+
+bool ChunkManager::isInStreamRange(IVec3 coord) const{
+	IVec3 offset = coord - m_stream_center;
+	Int32 radius = m_config.streaming_settings.radius;
+	return offset.x * offset.x + offset.y * offset.y + offset.z * offset.z <= radius * radius;
 }
 
 void ChunkManager::initNoiseLayers(NoiseLayers* layers_algorithm){
@@ -8,20 +8,51 @@
 
 #include "Debug.hpp"
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
+#include <unordered_set>
+#include <string>
 
 //-------------------------------------------------------------------------------------------------
 // Chunk Manager
 //-------------------------------------------------------------------------------------------------
 struct ChunkManagerConfig{
-	int max_parallel_generators;
-	int max_loaded_chunks;
+	int max_parallel_generators;  // Threads generateChunks() can use
+	int max_loaded_chunks;  // Capacity of the managed table
+	Uint64 resident_budget_bytes;  // 0 if unlimited
+	PODString chunk_directory;  // Where evicted chunks are saved
 
 	struct{
 		PODString algorithm_name;
 		Bytes8 seed;
 	}generator_settings;
+
+	struct{
+		Int32 radius;  // In chunks, around the camera's chunk. 0 if streaming is off
+		Int32 num_threads;  // Background threads, on top of max_parallel_generators
+		Int32 chunks_per_frame;  // Most streamed chunks added to the table each frame
+	}streaming_settings;
+};
+
+//-------------------------------------------------------------------------------------------------
+// Chunk Files
+//-------------------------------------------------------------------------------------------------
+constexpr char CHUNK_FILE_MAGIC[8] = {'V', 'G', 'C', 'H', 'U', 'N', 'K', '\0'};
+constexpr Uint32 CHUNK_FILE_VERSION = 2;
+
+struct ChunkFileHeader{
+	/*
+	Followed by the RawVoxelChunk, in the voxel layout the program was 
+	built with. One file per chunk.
+	*/
+
+	char magic[8];  // Must == CHUNK_FILE_MAGIC
+	Uint32 version;
+	Uint32 voxel_layout;  // Must == CHUNK_VOXEL_LAYOUT
+	IVec3 coord;
 };
 
 class ChunkManager{
@@ -32,26 +63,97 @@ class ChunkManager{
 
 		//static ChunkManagerConfig initDefaultConfig();
 		void addInstruction(ChunkInstruction instruction);
+		void addEdits(const VoxelEditBatch& batch);
 		void processInstructions();
 		void setManagedTable(ChunkTable& table);
 		void updateWithSettings(std::weak_ptr<Settings> settings_ptr);
+		void updateResidency(FVec3 camera_pos);
+		std::vector<IVec3> updateStreaming(FVec3 camera_pos, FVec3 view_dir);
+		bool isStreaming() const;
+		const RawVoxelChunk* lodChunkPtr(CellAddress addr) const;
+		std::vector<CellAddress> allLodCells() const;
+
+	private:
+		struct StreamRequest{
+			IVec3 coord;
+			float priority;  // Lower is sooner
+		};
+
+		struct StreamResult{
+			IVec3 coord;
+			bool is_from_file;
+			RawVoxelChunk chunk_data;
+		};
 
 	private:
 		// Chunk Instruction Handling
 		void generateChunks(std::vector<IVec3>& coords);
 		void eraseChunks(std::vector<IVec3>& coords);
+		void useChunks(std::vector<IVec3>& coords);
 		void loadChunksFromFile(std::vector<IVec3>& coords);
 		void saveChunksToFile(std::vector<IVec3>& coords);
 		void eraseChunksFromFile(std::vector<IVec3>& coords);
+		void applyWaitingEdits();
+
+		// LOD Cells
+		void generateLodChunks(std::vector<CellAddress>& cells);
+		void eraseLodChunks(std::vector<CellAddress>& cells);
+		void useLodChunks(std::vector<CellAddress>& cells);
+
+		// Residency
+		Int32 evictChunks(Uint64 num_bytes_to_free, Int32 num_chunks_to_free);
+		void makeRoomFor(const std::vector<IVec3>& coords);
+		std::string chunkFilepath(IVec3 coord) const;
+		bool isChunkFileSaved(IVec3 coord) const;
+		bool writeChunkFile(IVec3 coord, const RawVoxelChunk& chunk_data);
+		bool readChunkFile(IVec3 coord, RawVoxelChunk& output) const;
+
+		// Streaming
+		void startStreaming();
+		void stopStreaming();
+		void streamChunks(Int32 worker_index);
+		void requeueStreamRequests(IVec3 center_chunk, FVec3 view_dir);
+		std::vector<IVec3> integrateStreamedChunks();
+		bool isInStreamRange(IVec3 coord) const;
 		
 		// Init functions
 		void initNoiseLayers(NoiseLayers* layers_algorithm);
 
 	private:
 		std::weak_ptr<Settings> m_settings_ptr;
+		ChunkManagerConfig m_config;
 		ChunkGenerator m_generator;
 		ChunkTable* m_managed_table_ptr;
 		std::vector<ChunkInstruction> m_waiting_instructions;
+		VoxelEditBatch m_waiting_edits;  // Applied after the instructions
+
+		// Loaded chunks that paging back in wouldn't reproduce, so they're
+		// saved before being evicted
+		std::unordered_set<IVec3, PODHasher> m_unsaved_chunks;
+
+		// Coarse chunks for LOD cells, which the table doesn't hold. Each 
+		// cell's data is the index of its slot.
+		MultiresGrid m_lod_cells;
+		std::vector<RawVoxelChunk*> m_lod_chunk_slots;  // NULL if free
+		std::vector<Uint32> m_free_lod_slots;
+
+		FVec3 m_camera_pos;
+		Uint32 m_frame;
+
+		// Streaming. Everything from m_stream_queue to m_should_stop_streaming
+		// is shared with the streaming threads and guarded by m_stream_mutex.
+		std::vector<std::thread> m_stream_threads;
+		std::mutex m_stream_mutex;
+		std::condition_variable m_stream_condition;
+		std::condition_variable m_stream_finished_condition;  // Signalled as chunks finish
+		std::vector<StreamRequest> m_stream_queue;  // Sorted so the next request is last
+		std::vector<StreamResult*> m_stream_results;  // Finished, waiting to be integrated
+		std::unordered_set<IVec3, PODHasher> m_stream_busy_coords;  // Claimed or finished
+		std::unordered_set<IVec3, PODHasher> m_stream_claimed_coords;  // Claimed, not finished
+		bool m_should_stop_streaming;
+		IVec3 m_stream_center;  // Camera's chunk when the queue was last built
+		FVec3 m_stream_view_dir;
+		Uint32 m_stream_frames_since_requeue;
 };
 
 
@@ -44,6 +44,67 @@ ICuboid chunkspaceLoadedWorldBounds(const std::vector<IVec3>& coords){
 	return output;
 }
 
+ICuboid wholeChunkBox(){
+	return {
+		.origin={0, 0, 0},
+		.extent={CHUNK_LEN, CHUNK_LEN, CHUNK_LEN},
+	};
+}
+
+void applyEditToChunk(const VoxelEdit& edit, IVec3 chunk_coord, RawVoxelChunk& chunk, 
+	IVec3 dirty_bounds[2]){
+	/*
+	Applies the part of the edit inside the chunk, growing the bounds 
+	(chunk local, max exclusive) around every voxel that actually changed.
+	*/
+
+	IVec3 chunk_origin = chunk_coord * CHUNK_LEN;
+	IVec3 first = edit.bounds.origin - chunk_origin;
+	IVec3 last = first + edit.bounds.extent - IVec3{1, 1, 1};
+	for(int i = 0; i < NUM_3D_AXES; ++i){
+		first[i] = std::max(first[i], 0);
+		last[i] = std::min(last[i], CHUNK_LEN - 1);
+	}
+
+	bool is_sphere = edit.type == EDIT_FILL_SPHERE;
+	Int32 radius = edit.bounds.extent.x / 2;
+	IVec3 center = edit.bounds.origin - chunk_origin + IVec3{radius, radius, radius};
+	Int64 radius_squared = (Int64) radius * radius;
+	for(Int32 z = first.z; z <= last.z; ++z){
+		for(Int32 y = first.y; y <= last.y; ++y){
+			Int64 yz_squared = (Int64) (y - center.y) * (y - center.y) 
+				+ (Int64) (z - center.z) * (z - center.z);
+			if(is_sphere && yz_squared > radius_squared){
+				continue;
+			}
+
+			Int32 first_changed_x = CHUNK_LEN;
+			Int32 last_changed_x = -1;
+			for(Int32 x = first.x; x <= last.x; ++x){
+				if(is_sphere && (Int64) (x - center.x) * (x - center.x) + yz_squared > radius_squared){
+					continue;
+				}
+				Voxel& voxel = chunk.data[linearChunkIndex(x, y, z)];
+				if(voxel.type != edit.voxel_type){
+					voxel.type = edit.voxel_type;
+					first_changed_x = std::min(first_changed_x, x);
+					last_changed_x = x;
+				}
+			}
+
+			if(last_changed_x >= 0){
+				IVec3 row_bounds[2] = {{first_changed_x, y, z}, {last_changed_x + 1, y + 1, z + 1}};
+				for(int i = 0; i < NUM_3D_AXES; ++i){
+					dirty_bounds[INDEX_VALUE_MIN][i] = std::min(dirty_bounds[INDEX_VALUE_MIN][i], 
+						row_bounds[INDEX_VALUE_MIN][i]);
+					dirty_bounds[INDEX_VALUE_MAX][i] = std::max(dirty_bounds[INDEX_VALUE_MAX][i], 
+						row_bounds[INDEX_VALUE_MAX][i]);
+				}
+			}
+		}
+	}
+}
+
 bool isFullyContained(ICuboid volume, IVec3 coord){
 	for(int i = 0; i < NUM_3D_AXES; ++i){
 		int max_volume = volume.origin[i] + volume.extent[i];
@@ -104,65 +165,562 @@ void printChunkStats(const RawVoxelChunk& chunk){
 }
 
 
+//--------------------------------------------------------------------------------------------------
+// Voxel Edits
+//--------------------------------------------------------------------------------------------------
+void VoxelEditBatch::setVoxel(VoxelCoord coord, VoxelType type){
+	m_edits.push_back({
+		.type=EDIT_SET_VOXEL, 
+		.voxel_type=type, 
+		.bounds={.origin=coord, .extent={1, 1, 1}},
+	});
+}
+
+void VoxelEditBatch::fillBox(ICuboid box, VoxelType type){
+	/*
+	Boxes with no volume are ignored
+	*/
+
+	if(box.extent.x <= 0 || box.extent.y <= 0 || box.extent.z <= 0){
+		return;
+	}
+	m_edits.push_back({
+		.type=EDIT_FILL_BOX, 
+		.voxel_type=type, 
+		.bounds=box,
+	});
+}
+
+void VoxelEditBatch::fillSphere(VoxelCoord center, Int32 radius, VoxelType type){
+	/*
+	Fills every voxel whose coordinate is within the radius of the center.
+	A radius of 0 is just the center voxel. Negative radii are ignored.
+	*/
+
+	if(radius < 0){
+		return;
+	}
+	Int32 diameter = 2 * radius + 1;
+	m_edits.push_back({
+		.type=EDIT_FILL_SPHERE, 
+		.voxel_type=type, 
+		.bounds={
+			.origin=center - IVec3{radius, radius, radius}, 
+			.extent={diameter, diameter, diameter}
+		},
+	});
+}
+
+void VoxelEditBatch::append(const VoxelEditBatch& other){
+	m_edits.insert(m_edits.end(), other.m_edits.begin(), other.m_edits.end());
+}
+
+void VoxelEditBatch::clear(){
+	m_edits.clear();
+}
+
+Int64 VoxelEditBatch::numEdits() const{
+	return m_edits.size();
+}
+
+const std::vector<VoxelEdit>& VoxelEditBatch::edits() const{
+	return m_edits;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Block Pool
+//--------------------------------------------------------------------------------------------------
+BlockPool::BlockPool(Uint64 block_bytes, Int32 blocks_per_slab){
+	m_block_bytes = block_bytes;
+	m_blocks_per_slab = blocks_per_slab;
+	m_num_blocks_created = 0;
+}
+
+BlockPool::~BlockPool(){
+	for(Bytes1* slab : m_slabs){
+		free(slab);
+	}
+}
+
+Bytes1* BlockPool::acquire(){
+	/*
+	Returns NULL if a new slab was needed and couldn't be allocated
+	*/
+
+	if(m_free_blocks.size() > 0){
+		Bytes1* block = m_free_blocks.back();
+		m_free_blocks.pop_back();
+		return block;
+	}
+
+	Int32 index_in_slab = m_num_blocks_created % m_blocks_per_slab;
+	if(index_in_slab == 0){
+		Bytes1* slab = (Bytes1*) malloc(m_blocks_per_slab * m_block_bytes);
+		if(slab == NULL){
+			return NULL;
+		}
+		m_slabs.push_back(slab);
+	}
+	++m_num_blocks_created;
+	return m_slabs.back() + index_in_slab * m_block_bytes;
+}
+
+void BlockPool::release(Bytes1* block){
+	if(block != NULL){
+		m_free_blocks.push_back(block);
+	}
+}
+
+void BlockPool::reserve(Int32 num_blocks){
+	/*
+	Makes room to track the given number of blocks, so releasing them 
+	never allocates. Doesn't create any blocks.
+	*/
+
+	m_slabs.reserve((num_blocks + m_blocks_per_slab - 1) / m_blocks_per_slab);
+	m_free_blocks.reserve(num_blocks);
+}
+
+Uint64 BlockPool::numBytesInUse() const{
+	return (m_num_blocks_created - m_free_blocks.size()) * m_block_bytes;
+}
+
+
 //--------------------------------------------------------------------------------------------------
 // Chunk Table
 //--------------------------------------------------------------------------------------------------
-ChunkTable::ChunkTable(){
+thread_local ChunkTable::ThreadReader 
+ChunkTable::s_thread_readers[ARBITRARY_MAX_TABLES_PER_THREAD] = {};
+thread_local ChunkTable::DecompressionCache ChunkTable::s_decompression_cache;
+
+ChunkTable::ReadGuard::ReadGuard(const ChunkTable& table){
+	m_table_ptr = &table;
+	m_reader_slot = table.enterReader();
+}
+
+ChunkTable::ReadGuard::~ReadGuard(){
+	m_table_ptr->exitReader(m_reader_slot);
+}
+
+ChunkTable::ChunkIndex::ChunkIndex(Uint64 num_entries): entries(num_entries){
+	num_used_entries = 0;
+}
+
+ChunkTable::DecompressionCache::~DecompressionCache(){
+	for(DecompressedChunk& chunk : chunks){
+		free(chunk.chunk_ptr);
+	}
+}
+
+
+ChunkTable::ChunkTable():
+	m_version_pool(sizeof(ChunkVersion), BLOCKS_PER_SLAB),
+	m_raw_pool(sizeof(RawVoxelChunk) + BLOCK_PADDING, BLOCKS_PER_SLAB),
+	m_palette_pools{
+		{CHUNK_VOLUME * ENCODING_PALETTE_1 / BITS_PER_BYTE + BLOCK_PADDING, BLOCKS_PER_SLAB},
+		{CHUNK_VOLUME * ENCODING_PALETTE_2 / BITS_PER_BYTE + BLOCK_PADDING, BLOCKS_PER_SLAB},
+		{CHUNK_VOLUME * ENCODING_PALETTE_4 / BITS_PER_BYTE + BLOCK_PADDING, BLOCKS_PER_SLAB},
+	}{
+
 	m_bounds = {
 		.origin={0,0,0}, 
 		.extent={0,0,0}
 	};
+	m_max_loaded_chunks = 0;
+	m_num_loaded_chunks = 0;
+	m_num_evicted_chunks = 0;
+	m_index = new ChunkIndex(1);
+	m_read_frame = 0;
+	m_version = 0;
+	m_journal_start_version = 0;
+	m_epoch = 0;
+	m_num_overflow_readers = 0;
+
+	static std::atomic<Uint64> next_table_id{0};
+	m_table_id = next_table_id++;
+	setMaxLoadedChunks(DEFAULT_MAX_LOADED_CHUNKS);
 }
 
 ChunkTable::~ChunkTable(){
+	/*
+	WARNING: Every guard on the table has to be closed by now.
+	*/
+
+	// Versions are retired so they're reclaimed with everything else. 
+	// Blocks go away with their pools.
+	ChunkIndex* index_ptr = m_index.load();
+	for(IndexEntry& entry : index_ptr->entries){
+		ChunkVersion* version_ptr = entry.version.load();
+		if(version_ptr != NULL && version_ptr != &m_erased_version){
+			retire(RETIRED_VERSION, version_ptr);
+		}
+	}
+	retire(RETIRED_INDEX, index_ptr);
+	reclaimRetired(true);
 
+	for(RawVoxelChunk* chunk_ptr : m_uniform_chunks){
+		free(chunk_ptr);
+	}
 }
 
 
 bool ChunkTable::isLoaded(IVec3 coord) const{
-	return m_loaded_chunks.find(coord) != m_loaded_chunks.end();
+	ReadGuard read_guard(*this);
+	return findVersion(*m_index.load(), coord) != NULL;
+}
+
+bool ChunkTable::isEvicted(IVec3 coord) const{
+	ReadGuard read_guard(*this);
+	const ChunkVersion* version_ptr = findVersion(*m_index.load(), coord, true);
+	return version_ptr != NULL && version_ptr->encoded.encoding == ENCODING_EVICTED;
 }
 
-void ChunkTable::setChunk(IVec3 coord, RawVoxelChunk chunk_data){
+bool ChunkTable::touchChunk(IVec3 coord) const{
 	/*
-	YAGNI: Do this against the current bounds instead of stupidly
+	Stamps the chunk as read without reading it. Returns False if it isn't
+	loaded. Evicted chunks are stamped too, which asks for them back.
 	*/
 
-	m_loaded_chunks[coord] = chunk_data;
-	m_bounds = expandIfNecessary(m_bounds, coord);
+	ReadGuard read_guard(*this);
+	const ChunkVersion* version_ptr = findVersion(*m_index.load(), coord, true);
+	if(version_ptr == NULL){
+		return false;
+	}
+	version_ptr->last_read_frame.store(m_read_frame.load(std::memory_order_relaxed),
+		std::memory_order_relaxed);
+	return version_ptr->encoded.encoding != ENCODING_EVICTED;
 }
 
-RawVoxelChunk& ChunkTable::getChunkRef(IVec3 coord){
-	assert(m_loaded_chunks.find(coord) != m_loaded_chunks.end());
-	return m_loaded_chunks[coord];
+bool ChunkTable::setChunk(IVec3 coord, const RawVoxelChunk& chunk_data){
+	/*
+	Publishes a new version of the chunk in the smallest encoding that 
+	fits. Readers see either the old version or the new one, never a mix.
+	Setting a chunk to what it already holds publishes nothing and leaves
+	the table version alone.
+
+	Returns False if the table is full or a block couldn't be allocated.
+	*/
+
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	bool is_set = writeChunk(coord, chunk_data);
+	reclaimRetired();
+	return is_set;
 }
 
-const RawVoxelChunk* const ChunkTable::getChunkPtr(IVec3 coord) const{
-	auto iter = m_loaded_chunks.find(coord);
-	if(iter != m_loaded_chunks.end()){
-		return &(iter->second);
+std::vector<bool> ChunkTable::setChunks(const std::vector<IVec3>& coords, 
+	const std::vector<RawVoxelChunk>& chunks){
+	/*
+	Same as setChunk() for each chunk, but under a single lock. Returns 
+	whether each one was set.
+	*/
+
+	assert(coords.size() == chunks.size());
+
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	std::vector<bool> is_set(coords.size());
+	for(Uint64 i = 0; i < coords.size(); ++i){
+		is_set[i] = writeChunk(coords[i], chunks[i]);
+	}
+	reclaimRetired();
+	return is_set;
+}
+
+bool ChunkTable::copyChunk(IVec3 coord, const ChunkTable& source){
+	/*
+	Copies a chunk from another table without decoding it. Returns False
+	if the source doesn't have the chunk or this table can't take it.
+	*/
+
+	ReadGuard source_guard(source);
+	const ChunkVersion* source_ptr = source.findVersion(*source.m_index.load(), coord);
+	if(source_ptr == NULL){
+		return false;
+	}
+
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	ChunkVersion* version_ptr = createVersion();
+	if(version_ptr == NULL){
+		return false;
+	}
+
+	EncodedChunk& encoded = version_ptr->encoded;
+	encoded = source_ptr->encoded;
+	encoded.data_ptr = NULL;
+	bool is_copied;
+	if(encoded.encoding == ENCODING_UNIFORM){
+		is_copied = createUniformChunk(encoded.palette[0]);
 	}else{
+		encoded.data_ptr = poolFor(encoded.encoding)->acquire();
+		is_copied = encoded.data_ptr != NULL;
+		if(is_copied){
+			memcpy(encoded.data_ptr, source_ptr->encoded.data_ptr, 
+				CHUNK_VOLUME * encoded.encoding / BITS_PER_BYTE);
+		}
+	}
+
+	if(!is_copied || !publishVersion(coord, version_ptr, wholeChunkBox())){
+		destroyVersion(version_ptr);
+		return false;
+	}
+
+	reclaimRetired();
+	return true;
+}
+
+std::vector<IVec3> ChunkTable::applyEdits(const VoxelEditBatch& batch){
+	/*
+	Applies the whole batch under one lock. Edits are grouped by chunk, 
+	and each chunk is decoded, edited and published once, with a single 
+	journaled change covering everything the batch did to it. Returns the
+	chunks that actually changed.
+
+	Edits landing in chunks that aren't loaded, evicted ones included, are
+	dropped.
+	*/
+
+	const std::vector<VoxelEdit>& edits = batch.edits();
+	if(edits.size() == 0){
+		return {};
+	}
+
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+
+	// Edit indices per chunk, in batch order so later edits win
+	std::vector<IVec3> chunk_order;
+	std::unordered_map<IVec3, std::vector<Int32>, PODHasher> edits_by_chunk;
+	for(Int32 edit_index = 0; edit_index < (Int32) edits.size(); ++edit_index){
+		const ICuboid& bounds = edits[edit_index].bounds;
+		IVec3 first = chunkCoordFromVoxelCoord(bounds.origin);
+		IVec3 last = chunkCoordFromVoxelCoord(bounds.origin + bounds.extent - IVec3{1, 1, 1});
+		for(Int32 z = first.z; z <= last.z; ++z)
+		for(Int32 y = first.y; y <= last.y; ++y)
+		for(Int32 x = first.x; x <= last.x; ++x){
+			std::vector<Int32>& chunk_edits = edits_by_chunk[{x, y, z}];
+			if(chunk_edits.size() == 0){
+				chunk_order.push_back({x, y, z});
+			}
+			chunk_edits.push_back(edit_index);
+		}
+	}
+
+	std::vector<IVec3> changed_chunks;
+	RawVoxelChunk* chunk_ptr = (RawVoxelChunk*) malloc(sizeof(RawVoxelChunk));
+	assert(chunk_ptr != NULL);
+	for(IVec3 coord : chunk_order){
+		const ChunkVersion* old_version_ptr = findVersion(*m_index.load(), coord);
+		if(old_version_ptr == NULL){
+			continue;
+		}
+
+		unpackVoxels(old_version_ptr->encoded, 0, CHUNK_VOLUME, chunk_ptr->data);
+		IVec3 dirty_bounds[2] = {{CHUNK_LEN, CHUNK_LEN, CHUNK_LEN}, {0, 0, 0}};
+		for(Int32 edit_index : edits_by_chunk[coord]){
+			applyEditToChunk(edits[edit_index], coord, *chunk_ptr, dirty_bounds);
+		}
+		if(dirty_bounds[INDEX_VALUE_MAX].x == 0){
+			continue;
+		}
+
+		ICuboid dirty_box = {
+			.origin=dirty_bounds[INDEX_VALUE_MIN], 
+			.extent=dirty_bounds[INDEX_VALUE_MAX] - dirty_bounds[INDEX_VALUE_MIN],
+		};
+		ChunkVersion* version_ptr = createVersion();
+		if(version_ptr == NULL){
+			printf("ERROR: Couldn't allocate an edited version of chunk ");
+			printPODStruct(coord);
+			printf("\n");
+			continue;
+		}
+		bool is_encoded = patchChunk(old_version_ptr->encoded, *chunk_ptr, dirty_box, 
+			version_ptr->encoded) || encodeChunk(*chunk_ptr, version_ptr->encoded);
+		if(!is_encoded || !publishVersion(coord, version_ptr, dirty_box)){
+			destroyVersion(version_ptr);
+			continue;
+		}
+		changed_chunks.push_back(coord);
+	}
+	free(chunk_ptr);
+
+	reclaimRetired();
+	return changed_chunks;
+}
+
+const RawVoxelChunk* const ChunkTable::getChunkPtr(IVec3 coord) const{
+	/*
+	NULL if the chunk isn't loaded. The chunk must not be written through
+	the pointer, since other readers may share it.
+	*/
+
+	const ChunkVersion* version_ptr = findVersion(*m_index.load(), coord);
+	if(version_ptr == NULL){
 		return NULL;
 	}
+
+	// Only written once per frame, so readers don't fight over the line
+	Uint32 read_frame = m_read_frame.load(std::memory_order_relaxed);
+	if(version_ptr->last_read_frame.load(std::memory_order_relaxed) != read_frame){
+		version_ptr->last_read_frame.store(read_frame, std::memory_order_relaxed);
+	}
+	return readVersion(version_ptr);
+}
+
+ChunkTable::ChunkView ChunkTable::getChunkView(IVec3 coord) const{
+	/*
+	Same as getChunkPtr(), but the voxels are read in place. The palette is
+	NULL if the chunk isn't loaded. Evicted chunks read as a uniform chunk 
+	of their stand in type until they're paged back in.
+	*/
+
+	const ChunkVersion* version_ptr = findVersion(*m_index.load(), coord, true);
+	if(version_ptr == NULL){
+		return {.palette_ptr=NULL, .data_ptr=NULL, .bits_per_voxel=0};
+	}
+
+	Uint32 read_frame = m_read_frame.load(std::memory_order_relaxed);
+	if(version_ptr->last_read_frame.load(std::memory_order_relaxed) != read_frame){
+		version_ptr->last_read_frame.store(read_frame, std::memory_order_relaxed);
+	}
+
+	const EncodedChunk& encoded = version_ptr->encoded;
+	if(encoded.encoding == ENCODING_EVICTED){
+		return {.palette_ptr=encoded.palette, .data_ptr=NULL, .bits_per_voxel=0};
+	}
+	return {
+		.palette_ptr=encoded.palette,
+		.data_ptr=encoded.data_ptr,
+		.bits_per_voxel=encoded.encoding,
+	};
 }
 
 void ChunkTable::eraseChunks(std::vector<IVec3> coords){
 	/*
+	Erased entries keep their place in the index, so probe runs stay 
+	intact for readers. They're dropped the next time the index is rebuilt.
+	Evicted chunks are erased like loaded ones.
+
 	YAGNI: Find a smarter way to recalculate the boundary than just
 	scanning the whole table with every deletion. Perhaps batch the
 	chunks into edge regions and only trigger the resize if they're
 	found there?
 	*/
 
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	ChunkIndex& index = *m_index.load();
+	Uint64 mask = index.entries.size() - 1;
 	bool is_resize_avoidable = true;
 	for(IVec3 coord : coords){
 		is_resize_avoidable &= isFullyContained(m_bounds, coord);
-		m_loaded_chunks.erase(coord);	
+
+		Uint64 i = homeEntry(index, coord);
+		ChunkVersion* version_ptr;
+		while((version_ptr = index.entries[i].version.load()) != NULL){
+			if(version_ptr != &m_erased_version && index.entries[i].coord == coord){
+				if(version_ptr->encoded.encoding == ENCODING_EVICTED){
+					--m_num_evicted_chunks;
+				}else{
+					--m_num_loaded_chunks;
+				}
+				index.entries[i].version.store(&m_erased_version);
+				retire(RETIRED_VERSION, version_ptr);
+				recordChange(coord, wholeChunkBox(), true);
+				break;
+			}
+			i = (i + 1) & mask;
+		}
 	}
 
 	if(!is_resize_avoidable){
-		m_bounds = chunkspaceLoadedWorldBounds(allLoadedChunks());
+		m_bounds = chunkspaceLoadedWorldBounds(loadedChunks(index, true));
 	}
+	reclaimRetired();
+}
+
+void ChunkTable::evictChunks(const std::vector<IVec3>& coords){
+	/*
+	Frees the voxels of the given chunks, but keeps them in the world. See
+	the class comment. Chunks that aren't loaded are skipped. Whoever pages
+	them back in has to set the same voxels for the table to notice nothing
+	changed.
+
+	YAGNI: Evicted entries are never dropped, so a world explored forever 
+	keeps growing the index by a version per chunk ever evicted.
+	*/
+
+	const ICuboid NO_VOXELS = {.origin={0, 0, 0}, .extent={0, 0, 0}};
+
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	ChunkIndex& index = *m_index.load();
+	Uint64 mask = index.entries.size() - 1;
+	for(IVec3 coord : coords){
+		Uint64 i = homeEntry(index, coord);
+		ChunkVersion* old_version_ptr;
+		while((old_version_ptr = index.entries[i].version.load()) != NULL){
+			bool is_match = old_version_ptr != &m_erased_version 
+				&& index.entries[i].coord == coord;
+			if(!is_match){
+				i = (i + 1) & mask;
+				continue;
+			}else if(old_version_ptr->encoded.encoding == ENCODING_EVICTED){
+				break;
+			}
+
+			ChunkVersion* version_ptr = createVersion();
+			if(version_ptr == NULL){
+				printf("ERROR: Couldn't allocate an evicted version of chunk ");
+				printPODStruct(coord);
+				printf("\n");
+				break;
+			}
+
+			// Evicting a chunk doesn't count as reading it
+			EncodedChunk& encoded = version_ptr->encoded;
+			encoded.encoding = ENCODING_EVICTED;
+			encoded.palette_size = 1;
+			encoded.palette[0] = mostCommonSolidType(old_version_ptr->encoded);
+			version_ptr->content_hash = chunkHash(coord, old_version_ptr->encoded);
+			version_ptr->last_read_frame.store(
+				old_version_ptr->last_read_frame.load(std::memory_order_relaxed),
+				std::memory_order_relaxed);
+			version_ptr->table_version = recordChange(coord, NO_VOXELS, false, true);
+
+			index.entries[i].version.store(version_ptr);
+			retire(RETIRED_VERSION, old_version_ptr);
+			--m_num_loaded_chunks;
+			++m_num_evicted_chunks;
+			break;
+		}
+	}
+	reclaimRetired();
+}
+
+std::vector<IVec3> ChunkTable::evictedChunksReadSince(Uint32 frame) const{
+	/*
+	Evicted chunks that something looked at during or after the given 
+	frame, see setReadFrame(). Those are the ones worth paging back in.
+	*/
+
+	std::vector<IVec3> read_chunks;
+	if(m_num_evicted_chunks.load() == 0){
+		return read_chunks;
+	}
+
+	ReadGuard read_guard(*this);
+	for(const IndexEntry& entry : m_index.load()->entries){
+		const ChunkVersion* version_ptr = entry.version.load();
+		bool is_evicted = version_ptr != NULL && version_ptr != &m_erased_version
+			&& version_ptr->encoded.encoding == ENCODING_EVICTED;
+		if(!is_evicted){
+			continue;
+		}
+
+		// Frames wrap, so compare the distance between them
+		Uint32 last_read_frame = version_ptr->last_read_frame.load(std::memory_order_relaxed);
+		if((Int32) (last_read_frame - frame) >= 0){
+			read_chunks.push_back(entry.coord);
+		}
+	}
+	return read_chunks;
 }
 
 std::vector<IVec3> ChunkTable::allLoadedChunks() const{
@@ -170,11 +728,8 @@ std::vector<IVec3> ChunkTable::allLoadedChunks() const{
 	Returns a vector containing the addresses of all loaded chunks
 	*/
 
-	std::vector<IVec3> loaded_chunks;
-	for(auto iter = m_loaded_chunks.begin(); iter != m_loaded_chunks.end(); ++iter){
-		loaded_chunks.push_back(iter->first);
-	}
-	return loaded_chunks;
+	ReadGuard read_guard(*this);
+	return loadedChunks(*m_index.load());
 }
 
 ICuboid ChunkTable::boundingVolumeChunkspace() const{
@@ -195,5 +750,919 @@ ICuboid ChunkTable::boundingVolumeChunkspace() const{
 		};
 	*/
 
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
 	return m_bounds;
 }
+
+Uint64 ChunkTable::contentHash() const{
+	/*
+	Hash of every chunk in the world and where it is. Used to tell whether
+	data cached from the table is stale. Chunk hashes are summed, so the 
+	index's iteration order doesn't matter. Evicted chunks count with the 
+	hash of the voxels they had, so residency doesn't change the hash.
+	*/
+
+	ReadGuard read_guard(*this);
+	Uint64 num_chunks = 0;
+	Uint64 table_hash = 0;
+	for(const IndexEntry& entry : m_index.load()->entries){
+		const ChunkVersion* version_ptr = entry.version.load();
+		if(version_ptr == NULL || version_ptr == &m_erased_version){
+			continue;
+		}
+
+		if(version_ptr->encoded.encoding == ENCODING_EVICTED){
+			table_hash += version_ptr->content_hash;
+		}else{
+			table_hash += chunkHash(entry.coord, version_ptr->encoded);
+		}
+		++num_chunks;
+	}
+	return table_hash + num_chunks;
+}
+
+bool ChunkTable::setMaxLoadedChunks(Int32 max_loaded_chunks){
+	/*
+	Sizes the index for the given number of chunks. The pools only grow as
+	chunks are set. Returns False if more chunks than that are already 
+	loaded.
+	*/
+
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	if(max_loaded_chunks < m_num_loaded_chunks || max_loaded_chunks <= 0){
+		printf("ERROR: Can't limit a table with %i chunks to %i chunks!\n",
+			m_num_loaded_chunks.load(), max_loaded_chunks);
+		return false;
+	}
+
+	rebuildIndex(indexSizeFor(max_loaded_chunks + m_num_evicted_chunks));
+
+	m_max_loaded_chunks = max_loaded_chunks;
+	m_version_pool.reserve(max_loaded_chunks);
+	m_raw_pool.reserve(max_loaded_chunks);
+	for(BlockPool& pool : m_palette_pools){
+		pool.reserve(max_loaded_chunks);
+	}
+	reclaimRetired();
+	return true;
+}
+
+Int32 ChunkTable::maxLoadedChunks() const{
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	return m_max_loaded_chunks;
+}
+
+Int32 ChunkTable::numLoadedChunks() const{
+	return m_num_loaded_chunks;
+}
+
+Uint64 ChunkTable::numResidentBytes() const{
+	/*
+	Bytes of chunk data currently held, versions waiting to be reclaimed 
+	included. Slack in partly used slabs isn't counted, and neither are the
+	readers' decompressed copies, since they're capped per thread.
+	*/
+
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	Uint64 num_bytes = m_version_pool.numBytesInUse() + m_raw_pool.numBytesInUse();
+	for(const BlockPool& pool : m_palette_pools){
+		num_bytes += pool.numBytesInUse();
+	}
+	for(const RawVoxelChunk* chunk_ptr : m_uniform_chunks){
+		num_bytes += (chunk_ptr != NULL) * sizeof(RawVoxelChunk);
+	}
+	return num_bytes;
+}
+
+void ChunkTable::setReadFrame(Uint32 frame){
+	/*
+	Chunks read or set from now on are stamped with the frame
+	*/
+
+	m_read_frame.store(frame, std::memory_order_relaxed);
+}
+
+std::vector<ChunkTable::ChunkResidency> ChunkTable::residencyInfo() const{
+	/*
+	What every loaded chunk costs and when it was last read. Uniform chunks
+	only cost their version, since the chunk they share is never freed.
+	Evicted chunks aren't loaded, so they're left out.
+	*/
+
+	ReadGuard read_guard(*this);
+	std::vector<ChunkResidency> residency_info;
+	residency_info.reserve(m_num_loaded_chunks);
+	for(const IndexEntry& entry : m_index.load()->entries){
+		const ChunkVersion* version_ptr = entry.version.load();
+		if(version_ptr == NULL || version_ptr == &m_erased_version 
+			|| version_ptr->encoded.encoding == ENCODING_EVICTED){
+			continue;
+		}
+
+		ChunkEncoding encoding = version_ptr->encoded.encoding;
+		Uint32 num_bytes = sizeof(ChunkVersion);
+		if(encoding != ENCODING_UNIFORM){
+			num_bytes += CHUNK_VOLUME * encoding / BITS_PER_BYTE + BLOCK_PADDING;
+		}
+		residency_info.push_back({
+			.coord=entry.coord, 
+			.num_bytes=num_bytes,
+			.last_read_frame=version_ptr->last_read_frame.load(std::memory_order_relaxed),
+		});
+	}
+	return residency_info;
+}
+
+Uint64 ChunkTable::currentVersion() const{
+	/*
+	Starts at 0 and goes up by one with every change
+	*/
+
+	return m_version.load();
+}
+
+Uint64 ChunkTable::chunkVersion(IVec3 coord) const{
+	/*
+	Table version of the chunk's last change, or 0 if it isn't loaded
+	*/
+
+	ReadGuard read_guard(*this);
+	const ChunkVersion* version_ptr = findVersion(*m_index.load(), coord);
+	if(version_ptr == NULL){
+		return 0;
+	}
+	return version_ptr->table_version;
+}
+
+ChunkTable::ChangeList ChunkTable::changesSince(Uint64 seen_version) const{
+	/*
+	Every change made after the given table version, oldest first. A chunk
+	changed several times shows up once per change.
+
+	If the journal already dropped some of those changes, the list comes 
+	back incomplete and the caller has to treat everything as changed.
+	*/
+
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	ChangeList change_list;
+	change_list.version = m_version.load();
+	change_list.is_complete = seen_version >= m_journal_start_version;
+
+	auto first_unseen = std::upper_bound(m_journal.begin(), m_journal.end(), seen_version, 
+		[](Uint64 version, const ChunkChange& change){
+			return version < change.version;
+		}
+	);
+	change_list.changes.assign(first_unseen, m_journal.end());
+	return change_list;
+}
+
+Int32 ChunkTable::enterReader() const{
+	/*
+	Opens a guard for this thread. Returns the reader slot it holds, which
+	is shared with any guard the thread already has open on the table.
+	*/
+
+	ThreadReader* reader_ptr = findThreadReader();
+	if(reader_ptr != NULL){
+		++reader_ptr->num_open_guards;
+		return reader_ptr->reader_slot;
+	}
+
+	Int32 reader_slot = claimReaderSlot();
+	for(ThreadReader& reader : s_thread_readers){
+		if(reader.table_ptr == NULL){
+			reader = {.table_ptr=this, .reader_slot=reader_slot, .num_open_guards=1};
+			break;
+		}
+	}
+	return reader_slot;
+}
+
+void ChunkTable::exitReader(Int32 reader_slot) const{
+	/*
+	Closes a guard opened by enterReader(). The slot is released with the 
+	thread's last guard on the table.
+
+	NOTE: A thread with guards open on more tables than it can track 
+		claims a slot per guard on the extra tables.
+	*/
+
+	ThreadReader* reader_ptr = findThreadReader();
+	if(reader_ptr != NULL){
+		assert(reader_ptr->reader_slot == reader_slot);
+		if(--reader_ptr->num_open_guards > 0){
+			return;
+		}
+		reader_ptr->table_ptr = NULL;
+	}
+	releaseReaderSlot(reader_slot);
+}
+
+Int32 ChunkTable::claimReaderSlot() const{
+	/*
+	Claims a reader slot and marks it with the current epoch. Threads start
+	at different slots so they rarely fight over one. If every slot is 
+	taken, the reader is counted as an overflow reader instead, which stops
+	all reclamation until it leaves.
+
+	NOTE: The slot is claimed before the index is loaded, so a writer that 
+		doesn't see the claim must have published its changes before the
+		reader looks. Everything here is sequentially consistent for that,
+		and the overflow count works the same way.
+	*/
+
+	Int32 first_slot = std::hash<std::thread::id>{}(std::this_thread::get_id()) 
+		% MAX_CONCURRENT_READERS;
+	for(Int32 i = 0; i < MAX_CONCURRENT_READERS; ++i){
+		Int32 reader_slot = (first_slot + i) % MAX_CONCURRENT_READERS;
+		std::atomic<Uint64>& slot_epoch = m_reader_slots[reader_slot].epoch;
+		Uint64 expected = IDLE_READER_EPOCH;
+		if(slot_epoch.load(std::memory_order_relaxed) == IDLE_READER_EPOCH 
+			&& slot_epoch.compare_exchange_strong(expected, m_epoch.load())){
+			return reader_slot;
+		}
+	}
+
+	++m_num_overflow_readers;
+	return OVERFLOW_READER_SLOT;
+}
+
+void ChunkTable::releaseReaderSlot(Int32 reader_slot) const{
+	if(reader_slot == OVERFLOW_READER_SLOT){
+		--m_num_overflow_readers;
+		return;
+	}
+	m_reader_slots[reader_slot].epoch.store(IDLE_READER_EPOCH, std::memory_order_release);
+}
+
+ChunkTable::ThreadReader* ChunkTable::findThreadReader() const{
+	/*
+	This thread's entry for the table, or NULL if it has no guard open on it
+	*/
+
+	for(ThreadReader& reader : s_thread_readers){
+		if(reader.table_ptr == this){
+			return &reader;
+		}
+	}
+	return NULL;
+}
+
+void ChunkTable::retire(RetiredType type, void* item_ptr){
+	/*
+	Queues something readers might still see to be reclaimed later.
+	Must hold the write lock.
+	*/
+
+	m_retired.push_back({m_epoch.load(), type, item_ptr});
+}
+
+void ChunkTable::reclaimRetired(bool should_ignore_readers){
+	/*
+	Moves to a new epoch, then reclaims everything retired before the 
+	oldest open guard entered. Must hold the write lock, unless the table
+	is being destroyed.
+	*/
+
+	if(m_retired.size() == 0){
+		return;
+	}
+
+	Uint64 oldest_epoch = m_epoch.fetch_add(1) + 1;
+	for(Int32 i = 0; i < MAX_CONCURRENT_READERS && !should_ignore_readers; ++i){
+		oldest_epoch = std::min(oldest_epoch, m_reader_slots[i].epoch.load());
+	}
+
+	// Overflow readers don't record when they entered, so nothing is safe
+	if(!should_ignore_readers && m_num_overflow_readers.load() > 0){
+		return;
+	}
+
+	Uint64 num_kept = 0;
+	for(const RetiredItem& item : m_retired){
+		if(item.epoch >= oldest_epoch){
+			m_retired[num_kept++] = item;
+			continue;
+		}
+
+		switch(item.type){
+			case RETIRED_VERSION:
+				destroyVersion((ChunkVersion*) item.item_ptr);
+				break;
+			case RETIRED_INDEX:
+				delete (ChunkIndex*) item.item_ptr;
+				break;
+		}
+	}
+	m_retired.resize(num_kept);
+}
+
+ChunkTable::ChunkVersion* ChunkTable::findVersion(const ChunkIndex& index, IVec3 coord,
+	bool should_include_evicted) const{
+	/*
+	Current version of the chunk at the coordinate, or NULL if it isn't 
+	loaded. Evicted chunks count as not loaded unless asked for.
+	*/
+
+	Uint64 mask = index.entries.size() - 1;
+	Uint64 i = homeEntry(index, coord);
+	ChunkVersion* version_ptr;
+	while((version_ptr = index.entries[i].version.load()) != NULL){
+		if(version_ptr != &m_erased_version && index.entries[i].coord == coord){
+			bool is_evicted = version_ptr->encoded.encoding == ENCODING_EVICTED;
+			return (is_evicted && !should_include_evicted) ? NULL : version_ptr;
+		}
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+Uint64 ChunkTable::homeEntry(const ChunkIndex& index, IVec3 coord) const{
+	/*
+	Each axis gets its own odd multiplier, and the high bits (which every 
+	input bit reaches) are folded down into the bits the mask keeps.
+	*/
+
+	constexpr Uint64 AXIS_MULTIPLIERS[] = {
+		0x9E3779B97F4A7C15, 
+		0xC2B2AE3D27D4EB4F, 
+		0x165667B19E3779F9
+	};
+
+	Uint64 hash = 0;
+	for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+		hash ^= (Uint64) (Uint32) coord[axis] * AXIS_MULTIPLIERS[axis];
+	}
+	hash ^= hash >> 29;
+	return hash & (index.entries.size() - 1);
+}
+
+bool ChunkTable::writeChunk(IVec3 coord, const RawVoxelChunk& chunk_data){
+	/*
+	Encodes and publishes the chunk, unless it's unchanged. Returns False 
+	if the table is full or a block couldn't be allocated. Must hold the 
+	write lock.
+
+	An evicted chunk paged back in with the voxels it had is journaled as
+	a residency only change, since nothing in the world moved.
+
+	YAGNI: Do this against the current bounds instead of stupidly
+	*/
+
+	ICuboid dirty_box = wholeChunkBox();
+	const ChunkVersion* old_version_ptr = findVersion(*m_index.load(), coord, true);
+	bool is_paging_in = old_version_ptr != NULL 
+		&& old_version_ptr->encoded.encoding == ENCODING_EVICTED;
+	if(old_version_ptr != NULL && !is_paging_in){
+		dirty_box = changedVoxels(old_version_ptr->encoded, chunk_data);
+		if(volume(dirty_box) == 0){
+			old_version_ptr->last_read_frame.store(
+				m_read_frame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	ChunkVersion* version_ptr = createVersion();
+	if(version_ptr == NULL){
+		return false;
+	}
+	if(!encodeChunk(chunk_data, version_ptr->encoded)){
+		destroyVersion(version_ptr);
+		return false;
+	}
+
+	bool is_residency_only = is_paging_in 
+		&& chunkHash(coord, version_ptr->encoded) == old_version_ptr->content_hash;
+	if(is_residency_only){
+		dirty_box = {.origin={0, 0, 0}, .extent={0, 0, 0}};
+	}
+	if(!publishVersion(coord, version_ptr, dirty_box, is_residency_only)){
+		destroyVersion(version_ptr);
+		return false;
+	}
+	return true;
+}
+
+bool ChunkTable::publishVersion(IVec3 coord, ChunkVersion* version_ptr, ICuboid dirty_box,
+	bool is_residency_only){
+	/*
+	Makes the version the chunk's current one, retiring any older version,
+	and journals the change. Returns False if the chunk isn't loaded and 
+	the table is full. Must hold the write lock.
+	*/
+
+	ChunkIndex* index_ptr = m_index.load();
+	Uint64 mask = index_ptr->entries.size() - 1;
+	Uint64 i = homeEntry(*index_ptr, coord);
+	ChunkVersion* old_version_ptr;
+	while((old_version_ptr = index_ptr->entries[i].version.load()) != NULL){
+		if(old_version_ptr != &m_erased_version && index_ptr->entries[i].coord == coord){
+			if(old_version_ptr->encoded.encoding == ENCODING_EVICTED){
+				if(m_num_loaded_chunks >= m_max_loaded_chunks){
+					return false;
+				}
+				++m_num_loaded_chunks;
+				--m_num_evicted_chunks;
+			}
+
+			version_ptr->table_version = recordChange(coord, dirty_box, false, 
+				is_residency_only);
+			index_ptr->entries[i].version.store(version_ptr);
+			retire(RETIRED_VERSION, old_version_ptr);
+			return true;
+		}
+		i = (i + 1) & mask;
+	}
+
+	if(m_num_loaded_chunks >= m_max_loaded_chunks){
+		return false;
+	}
+
+	// Erased entries count against the load factor until they're dropped.
+	// Evicted ones never are, so the index grows to fit them.
+	if(2 * (index_ptr->num_used_entries + 1) > (Int64) index_ptr->entries.size()){
+		Uint64 num_entries = std::max((Uint64) index_ptr->entries.size(),
+			indexSizeFor(m_num_loaded_chunks + m_num_evicted_chunks + 1));
+		index_ptr = rebuildIndex(num_entries);
+		mask = index_ptr->entries.size() - 1;
+		i = homeEntry(*index_ptr, coord);
+		while(index_ptr->entries[i].version.load() != NULL){
+			i = (i + 1) & mask;
+		}
+	}
+
+	// Readers only look at the coordinate once the version is there
+	version_ptr->table_version = recordChange(coord, dirty_box, false);
+	index_ptr->entries[i].coord = coord;
+	index_ptr->entries[i].version.store(version_ptr);
+	++index_ptr->num_used_entries;
+	++m_num_loaded_chunks;
+	m_bounds = expandIfNecessary(m_bounds, coord);
+	return true;
+}
+
+Uint64 ChunkTable::recordChange(IVec3 coord, ICuboid dirty_box, bool is_erased, 
+	bool is_residency_only){
+	/*
+	Bumps the table version and journals the change under it. Returns the
+	new version. Must hold the write lock.
+
+	Once the journal is full, the older half is dropped in one go, so the
+	copy is paid once per half a journal of changes.
+	*/
+
+	if(m_journal.size() >= ARBITRARY_JOURNAL_CAPACITY){
+		Uint64 num_dropped = m_journal.size() / 2;
+		m_journal_start_version = m_journal[num_dropped - 1].version;
+		m_journal.erase(m_journal.begin(), m_journal.begin() + num_dropped);
+	}
+
+	Uint64 version = m_version.load() + 1;
+	m_journal.push_back({
+		.version=version, 
+		.coord=coord, 
+		.dirty_box=dirty_box, 
+		.is_erased=is_erased,
+		.is_residency_only=is_residency_only,
+	});
+	m_version.store(version);
+	return version;
+}
+
+ChunkTable::ChunkIndex* ChunkTable::rebuildIndex(Uint64 num_entries){
+	/*
+	Publishes a new index of the given size holding every loaded and 
+	evicted chunk, and retires the old one. Must hold the write lock.
+	*/
+
+	ChunkIndex* old_index_ptr = m_index.load();
+	ChunkIndex* new_index_ptr = new ChunkIndex(num_entries);
+	Uint64 mask = num_entries - 1;
+	for(IndexEntry& entry : old_index_ptr->entries){
+		ChunkVersion* version_ptr = entry.version.load();
+		if(version_ptr == NULL || version_ptr == &m_erased_version){
+			continue;
+		}
+
+		Uint64 i = homeEntry(*new_index_ptr, entry.coord);
+		while(new_index_ptr->entries[i].version.load(std::memory_order_relaxed) != NULL){
+			i = (i + 1) & mask;
+		}
+		new_index_ptr->entries[i].coord = entry.coord;
+		new_index_ptr->entries[i].version.store(version_ptr, std::memory_order_relaxed);
+		++new_index_ptr->num_used_entries;
+	}
+
+	m_index.store(new_index_ptr);
+	retire(RETIRED_INDEX, old_index_ptr);
+	return new_index_ptr;
+}
+
+Uint64 ChunkTable::indexSizeFor(Int32 num_chunks) const{
+	/*
+	Keeps the load factor at or below 1/2 so probe runs stay short
+	*/
+
+	Uint64 num_entries = 1;
+	while(num_entries < 2 * (Uint64) num_chunks){
+		num_entries <<= 1;
+	}
+	return num_entries;
+}
+
+std::vector<IVec3> ChunkTable::loadedChunks(const ChunkIndex& index, 
+	bool should_include_evicted) const{
+	std::vector<IVec3> loaded_chunks;
+	loaded_chunks.reserve(m_num_loaded_chunks);
+	for(const IndexEntry& entry : index.entries){
+		const ChunkVersion* version_ptr = entry.version.load();
+		if(version_ptr == NULL || version_ptr == &m_erased_version){
+			continue;
+		}
+		if(should_include_evicted || version_ptr->encoded.encoding != ENCODING_EVICTED){
+			loaded_chunks.push_back(entry.coord);
+		}
+	}
+	return loaded_chunks;
+}
+
+ChunkTable::ChunkVersion* ChunkTable::createVersion(){
+	/*
+	An empty version, or NULL if it couldn't be allocated. Must hold the 
+	write lock.
+	*/
+
+	Bytes1* block_ptr = m_version_pool.acquire();
+	if(block_ptr == NULL){
+		return NULL;
+	}
+
+	ChunkVersion* version_ptr = new (block_ptr) ChunkVersion();
+	version_ptr->encoded.encoding = ENCODING_UNIFORM;
+	version_ptr->encoded.data_ptr = NULL;
+	version_ptr->last_read_frame = m_read_frame.load(std::memory_order_relaxed);
+	version_ptr->table_version = 0;
+	version_ptr->content_hash = 0;
+	return version_ptr;
+}
+
+void ChunkTable::destroyVersion(ChunkVersion* version_ptr){
+	/*
+	Returns the version and its blocks to their pools. Must hold the write
+	lock, and no reader can still be using it.
+	*/
+
+	BlockPool* pool_ptr = poolFor(version_ptr->encoded.encoding);
+	if(pool_ptr != NULL){
+		pool_ptr->release(version_ptr->encoded.data_ptr);
+	}
+
+	version_ptr->~ChunkVersion();
+	m_version_pool.release((Bytes1*) version_ptr);
+}
+
+bool ChunkTable::encodeChunk(const RawVoxelChunk& chunk_data, EncodedChunk& output){
+	/*
+	Picks the smallest encoding that fits the chunk and fills it in.
+	Returns False if a block couldn't be allocated.
+	*/
+
+	Int32 palette_index_by_type[NUM_POSSIBLE_TYPES];
+	for(Int32 i = 0; i < NUM_POSSIBLE_TYPES; ++i){
+		palette_index_by_type[i] = -1;
+	}
+
+	output.palette_size = 0;
+	bool is_too_varied = false;
+	for(Int32 i = 0; i < CHUNK_VOLUME && !is_too_varied; ++i){
+		VoxelType type = chunk_data.data[i].type;
+		if(palette_index_by_type[type] == -1){
+			is_too_varied = output.palette_size == MAX_PALETTE_SIZE;
+			if(!is_too_varied){
+				palette_index_by_type[type] = output.palette_size;
+				output.palette[output.palette_size++] = type;
+			}
+		}
+	}
+
+	if(is_too_varied){
+		output.encoding = ENCODING_RAW;
+		output.palette_size = 0;
+	}else if(output.palette_size == 1){
+		output.encoding = ENCODING_UNIFORM;
+	}else if(output.palette_size <= 2){
+		output.encoding = ENCODING_PALETTE_1;
+	}else if(output.palette_size <= 4){
+		output.encoding = ENCODING_PALETTE_2;
+	}else{
+		output.encoding = ENCODING_PALETTE_4;
+	}
+
+	output.data_ptr = NULL;
+	if(output.encoding == ENCODING_UNIFORM){
+		return createUniformChunk(output.palette[0]);
+	}
+
+	output.data_ptr = poolFor(output.encoding)->acquire();
+	if(output.data_ptr == NULL){
+		return false;
+	}
+	if(output.encoding == ENCODING_RAW){
+		memcpy(output.data_ptr, chunk_data.data, sizeof(RawVoxelChunk));
+		return true;
+	}
+
+	// Voxel i sits at bit (i * bits) % 8 of byte (i * bits) / 8
+	Int32 bits = output.encoding;
+	Int32 voxels_per_byte = BITS_PER_BYTE / bits;
+	Int32 num_bytes = CHUNK_VOLUME / voxels_per_byte;
+	for(Int32 byte_index = 0; byte_index < num_bytes; ++byte_index){
+		const Voxel* voxels = &chunk_data.data[byte_index * voxels_per_byte];
+		Bytes1 packed = 0;
+		for(Int32 v = 0; v < voxels_per_byte; ++v){
+			packed |= palette_index_by_type[voxels[v].type] << (v * bits);
+		}
+		output.data_ptr[byte_index] = packed;
+	}
+	return true;
+}
+
+bool ChunkTable::patchChunk(const EncodedChunk& old_encoded, const RawVoxelChunk& chunk_data, 
+	ICuboid dirty_box, EncodedChunk& output){
+	/*
+	Encodes an edited chunk by copying the old encoding and repacking the
+	voxels in the dirty box, instead of rescanning the whole chunk. Returns 
+	False if that isn't possible (uniform chunks, or palettes missing a 
+	type the edit brought in), or a block couldn't be allocated.
+
+	NOTE: The old encoding is kept, so a chunk edited down to fewer types 
+		only shrinks the next time it's set whole.
+	*/
+
+	if(old_encoded.encoding == ENCODING_UNIFORM){
+		return false;
+	}else if(old_encoded.encoding == ENCODING_RAW){
+		output = old_encoded;
+		output.data_ptr = m_raw_pool.acquire();
+		if(output.data_ptr == NULL){
+			return false;
+		}
+		memcpy(output.data_ptr, chunk_data.data, sizeof(RawVoxelChunk));
+		return true;
+	}
+
+	Int32 palette_index_by_type[NUM_POSSIBLE_TYPES];
+	for(Int32 i = 0; i < NUM_POSSIBLE_TYPES; ++i){
+		palette_index_by_type[i] = -1;
+	}
+	for(Int32 i = 0; i < old_encoded.palette_size; ++i){
+		palette_index_by_type[old_encoded.palette[i]] = i;
+	}
+
+	IVec3 first = dirty_box.origin;
+	IVec3 last = dirty_box.origin + dirty_box.extent - IVec3{1, 1, 1};
+	for(Int32 z = first.z; z <= last.z; ++z)
+	for(Int32 y = first.y; y <= last.y; ++y)
+	for(Int32 x = first.x; x <= last.x; ++x){
+		if(palette_index_by_type[chunk_data.data[linearChunkIndex(x, y, z)].type] == -1){
+			return false;
+		}
+	}
+
+	output = old_encoded;
+	output.data_ptr = poolFor(output.encoding)->acquire();
+	if(output.data_ptr == NULL){
+		return false;
+	}
+
+	// Voxel i sits at bit (i * bits) % 8 of byte (i * bits) / 8
+	Int32 bits = output.encoding;
+	Int32 voxels_per_byte = BITS_PER_BYTE / bits;
+	Bytes1 index_mask = (1 << bits) - 1;
+	memcpy(output.data_ptr, old_encoded.data_ptr, CHUNK_VOLUME / voxels_per_byte);
+	for(Int32 z = first.z; z <= last.z; ++z)
+	for(Int32 y = first.y; y <= last.y; ++y)
+	for(Int32 x = first.x; x <= last.x; ++x){
+		Int32 voxel_index = linearChunkIndex(x, y, z);
+		Int32 shift = (voxel_index % voxels_per_byte) * bits;
+		Bytes1& packed = output.data_ptr[voxel_index / voxels_per_byte];
+		packed &= ~(index_mask << shift);
+		packed |= palette_index_by_type[chunk_data.data[voxel_index].type] << shift;
+	}
+	return true;
+}
+
+bool ChunkTable::createUniformChunk(VoxelType type){
+	/*
+	Makes the chunk shared by every uniform chunk of the type, if it 
+	doesn't exist yet. Returns False if it couldn't be allocated.
+	*/
+
+	if(m_uniform_chunks[type] == NULL){
+		RawVoxelChunk* chunk_ptr = (RawVoxelChunk*) malloc(sizeof(RawVoxelChunk));
+		if(chunk_ptr == NULL){
+			return false;
+		}
+		memset(chunk_ptr->data, type, sizeof(RawVoxelChunk));
+		m_uniform_chunks[type] = chunk_ptr;
+	}
+	return true;
+}
+
+void ChunkTable::unpackVoxels(const EncodedChunk& encoded, Int32 first_voxel, 
+	Int32 num_voxels, Voxel* output) const{
+	/*
+	Decodes a run of voxels. Palette runs have to start on a byte.
+	*/
+
+	if(encoded.encoding == ENCODING_UNIFORM){
+		memset(output, encoded.palette[0], num_voxels * sizeof(Voxel));
+		return;
+	}else if(encoded.encoding == ENCODING_RAW){
+		memcpy(output, encoded.data_ptr + first_voxel, num_voxels * sizeof(Voxel));
+		return;
+	}
+
+	Int32 bits = encoded.encoding;
+	Int32 voxels_per_byte = BITS_PER_BYTE / bits;
+	Bytes1 index_mask = (1 << bits) - 1;
+	assert(first_voxel % voxels_per_byte == 0 && num_voxels % voxels_per_byte == 0);
+
+	const Bytes1* packed_ptr = encoded.data_ptr + first_voxel / voxels_per_byte;
+	Int32 num_bytes = num_voxels / voxels_per_byte;
+	for(Int32 byte_index = 0; byte_index < num_bytes; ++byte_index){
+		Bytes1 packed = packed_ptr[byte_index];
+		Voxel* voxels = &output[byte_index * voxels_per_byte];
+		for(Int32 v = 0; v < voxels_per_byte; ++v){
+			voxels[v].type = encoded.palette[(packed >> (v * bits)) & index_mask];
+		}
+	}
+}
+
+ICuboid ChunkTable::changedVoxels(const EncodedChunk& old_encoded, 
+	const RawVoxelChunk& chunk_data) const{
+	/*
+	Smallest box around every voxel that differs between the encoded chunk
+	and the raw one. Has no volume if they're the same.
+
+	Compares a run of voxels at a time, so unchanged runs cost one memcmp.
+	Runs are in storage order, which keeps this independent of the layout.
+	*/
+
+	constexpr Int32 RUN_LEN = CHUNK_LEN;
+
+	IVec3 bounds[2] = {{CHUNK_LEN, CHUNK_LEN, CHUNK_LEN}, {0, 0, 0}};
+	Voxel old_run[RUN_LEN];
+	for(Int32 run_start = 0; run_start < CHUNK_VOLUME; run_start += RUN_LEN){
+		const Voxel* new_run = &chunk_data.data[run_start];
+		unpackVoxels(old_encoded, run_start, RUN_LEN, old_run);
+		if(memcmp(old_run, new_run, sizeof(old_run)) == 0){
+			continue;
+		}
+
+		for(Int32 i = 0; i < RUN_LEN; ++i){
+			if(old_run[i].type == new_run[i].type){
+				continue;
+			}
+
+			IVec3 coord = localVoxelCoordFromIndex(run_start + i);
+			for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+				bounds[INDEX_VALUE_MIN][axis] = std::min(bounds[INDEX_VALUE_MIN][axis], coord[axis]);
+				bounds[INDEX_VALUE_MAX][axis] = std::max(bounds[INDEX_VALUE_MAX][axis], coord[axis] + 1);
+			}
+		}
+	}
+
+	ICuboid dirty_box = {
+		.origin={0, 0, 0},
+		.extent={0, 0, 0},
+	};
+	if(bounds[INDEX_VALUE_MAX].x > 0){
+		dirty_box.origin = bounds[INDEX_VALUE_MIN];
+		dirty_box.extent = bounds[INDEX_VALUE_MAX] - bounds[INDEX_VALUE_MIN];
+	}
+	return dirty_box;
+}
+
+Uint64 ChunkTable::chunkHash(IVec3 coord, const EncodedChunk& encoded) const{
+	/*
+	Hash of the chunk's voxels and where it is. The encoding doesn't change
+	the hash.
+
+	NOTE: FNV-1a, but over 8 byte words instead of single bytes.
+	*/
+
+	constexpr Uint64 FNV_OFFSET_BASIS = 0xCBF29CE484222325;
+	constexpr Uint64 FNV_PRIME = 0x100000001B3;
+	constexpr Int32 VOXELS_PER_BATCH = 4096;
+	static_assert(CHUNK_VOLUME % VOXELS_PER_BATCH == 0);
+	static_assert(VOXELS_PER_BATCH % sizeof(Uint64) == 0);
+
+	Voxel batch[VOXELS_PER_BATCH];
+	Uint64 chunk_hash = FNV_OFFSET_BASIS ^ Hash::modifiedSquirrelNoise(coord, 0);
+	for(Int32 first = 0; first < CHUNK_VOLUME; first += VOXELS_PER_BATCH){
+		unpackVoxels(encoded, first, VOXELS_PER_BATCH, batch);
+		const Bytes1* bytes = (const Bytes1*) batch;
+		for(Uint64 i = 0; i < sizeof(batch); i += sizeof(Uint64)){
+			Uint64 word;
+			memcpy(&word, bytes + i, sizeof(Uint64));
+			chunk_hash = (chunk_hash ^ word) * FNV_PRIME;
+		}
+	}
+	return chunk_hash;
+}
+
+VoxelType ChunkTable::mostCommonSolidType(const EncodedChunk& encoded) const{
+	/*
+	What an evicted chunk reads as. Air if nothing in it is solid.
+	*/
+
+	constexpr Int32 VOXELS_PER_BATCH = 4096;
+
+	Int32 count_by_type[NUM_POSSIBLE_TYPES] = {};
+	Voxel batch[VOXELS_PER_BATCH];
+	for(Int32 first = 0; first < CHUNK_VOLUME; first += VOXELS_PER_BATCH){
+		unpackVoxels(encoded, first, VOXELS_PER_BATCH, batch);
+		for(Int32 i = 0; i < VOXELS_PER_BATCH; ++i){
+			++count_by_type[batch[i].type];
+		}
+	}
+
+	VoxelType common_type = VoxelType::Air;
+	Int32 common_count = 0;
+	for(Int32 type = 0; type < NUM_POSSIBLE_TYPES; ++type){
+		if(!isAir((VoxelType) type) && count_by_type[type] > common_count){
+			common_type = (VoxelType) type;
+			common_count = count_by_type[type];
+		}
+	}
+	return common_type;
+}
+
+const RawVoxelChunk* ChunkTable::readVersion(const ChunkVersion* version_ptr) const{
+	/*
+	The version as a raw chunk. Palette chunks are decompressed into the 
+	thread's cache, replacing the copy that was read the longest ago once 
+	it's full. Returns NULL if a copy couldn't be allocated.
+
+	THREADING: Versions are immutable and their table versions are never 
+		reused, so a copy made from one stays correct for as long as it's 
+		cached. Nothing here is shared between threads.
+	*/
+
+	const EncodedChunk& encoded = version_ptr->encoded;
+	if(encoded.encoding == ENCODING_UNIFORM){
+		return m_uniform_chunks[encoded.palette[0]];
+	}else if(encoded.encoding == ENCODING_RAW){
+		return (const RawVoxelChunk*) encoded.data_ptr;
+	}
+
+	DecompressionCache& cache = s_decompression_cache;
+	++cache.num_reads;
+	DecompressedChunk* oldest_ptr = NULL;
+	for(DecompressedChunk& chunk : cache.chunks){
+		if(chunk.table_id == m_table_id && chunk.table_version == version_ptr->table_version){
+			chunk.last_read = cache.num_reads;
+			return chunk.chunk_ptr;
+		}
+		if(oldest_ptr == NULL || chunk.last_read < oldest_ptr->last_read){
+			oldest_ptr = &chunk;
+		}
+	}
+
+	if(cache.chunks.size() < ARBITRARY_DECOMPRESSED_CHUNKS_PER_THREAD){
+		RawVoxelChunk* chunk_ptr = (RawVoxelChunk*) malloc(sizeof(RawVoxelChunk));
+		if(chunk_ptr == NULL){
+			printf("ERROR: No memory left to decompress a chunk!\n");
+			return NULL;
+		}
+		cache.chunks.push_back({.chunk_ptr=chunk_ptr});
+		oldest_ptr = &cache.chunks.back();
+	}
+
+	oldest_ptr->table_id = m_table_id;
+	oldest_ptr->table_version = version_ptr->table_version;
+	oldest_ptr->last_read = cache.num_reads;
+	unpackVoxels(encoded, 0, CHUNK_VOLUME, oldest_ptr->chunk_ptr->data);
+	return oldest_ptr->chunk_ptr;
+}
+
+BlockPool* ChunkTable::poolFor(ChunkEncoding encoding){
+	/*
+	NULL for uniform chunks, which don't have a block
+	*/
+
+	switch(encoding){
+		case ENCODING_PALETTE_1:
+			return &m_palette_pools[0];
+		case ENCODING_PALETTE_2:
+			return &m_palette_pools[1];
+		case ENCODING_PALETTE_4:
+			return &m_palette_pools[2];
+		case ENCODING_RAW:
+			return &m_raw_pool;
+		default:
+			return NULL;
+	}
+}
@@ -6,6 +6,9 @@
 #include <unordered_map>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
 
 //--------------------------------------------------------------------------------------------------
 // Constants
@@ -15,14 +18,71 @@ constexpr int CHUNK_AREA = CHUNK_LEN * CHUNK_LEN;
 constexpr int CHUNK_VOLUME = CHUNK_LEN * CHUNK_LEN * CHUNK_LEN;
 
 //--------------------------------------------------------------------------------------------------
-// Helper Functions
+// Voxel Layout
 //--------------------------------------------------------------------------------------------------
+/*
+Where each voxel of a chunk is stored. Anything that indexes a chunk sized 
+array has to go through linearChunkIndex() and localVoxelCoordFromIndex(),
+never through its own strides.
+
+Linear (default): x fastest, then y, then z. A step along z is 1KB away.
+Morton (-DCHUNK_MORTON_LAYOUT): The bits of x, y and z are interleaved, so 
+	every aligned 2x2x2, 4x4x4, etc block is contiguous. Voxels close in any
+	direction tend to share cache lines, at the cost of x rows no longer 
+	being contiguous.
+*/
+#if defined(CHUNK_MORTON_LAYOUT)
+constexpr Uint32 CHUNK_VOXEL_LAYOUT = 1;
+
+struct MortonTable{
+	/*
+	Each chunk local coordinate with its bits spread 3 apart
+	*/
+
+	constexpr MortonTable(): spread{}{
+		for(int value = 0; value < CHUNK_LEN; ++value){
+			for(int bit = 0; (1 << bit) < CHUNK_LEN; ++bit){
+				spread[value] |= ((value >> bit) & 1) << (3 * bit);
+			}
+		}
+	}
+
+	Uint16 spread[CHUNK_LEN];
+};
+inline constexpr MortonTable MORTON_TABLE{};
+static_assert(CHUNK_LEN == 32, "Morton decoding assumes 5 bits per axis");
+
+inline int linearChunkIndex(int x, int y, int z){
+	return MORTON_TABLE.spread[x] | (MORTON_TABLE.spread[y] << 1) | (MORTON_TABLE.spread[z] << 2);
+}
+
+inline int mortonCompact(int bits){
+	// Gathers bits 0, 3, 6, 9 and 12 into bits 0 through 4
+	bits &= 0x1249;
+	return (bits & 1) | ((bits >> 2) & 2) | ((bits >> 4) & 4) | ((bits >> 6) & 8) 
+		| ((bits >> 8) & 16);
+}
+
+inline IVec3 localVoxelCoordFromIndex(int index){
+	return {mortonCompact(index), mortonCompact(index >> 1), mortonCompact(index >> 2)};
+}
+#else
+constexpr Uint32 CHUNK_VOXEL_LAYOUT = 0;
+
 inline int linearChunkIndex(int x, int y, int z){
 	return (x) + (y * CHUNK_LEN) + (z * CHUNK_AREA);
 }
 
+inline IVec3 localVoxelCoordFromIndex(int index){
+	return {index % CHUNK_LEN, (index / CHUNK_LEN) % CHUNK_LEN, index / CHUNK_AREA};
+}
+#endif
+
+//--------------------------------------------------------------------------------------------------
+// Helper Functions
+//--------------------------------------------------------------------------------------------------
 inline int linearChunkIndex(IVec3 local_coords){
-	return (local_coords.x) + (local_coords.y * CHUNK_LEN) + (local_coords.z * CHUNK_AREA);
+	return linearChunkIndex(local_coords.x, local_coords.y, local_coords.z);
 }
 
 inline IVec3 localVoxelCoordFromGlobal(IVec3 global_coord){
@@ -119,35 +179,409 @@ struct RawVoxelChunk{
 RawVoxelChunk initVoxelChunk();
 void printChunkStats(const RawVoxelChunk& chunk);
 
+//--------------------------------------------------------------------------------------------------
+// Voxel Edits
+//--------------------------------------------------------------------------------------------------
+enum VoxelEditType: Uint8{
+	EDIT_SET_VOXEL,
+	EDIT_FILL_BOX,
+	EDIT_FILL_SPHERE,
+};
+
+struct VoxelEdit{
+	VoxelEditType type;
+	VoxelType voxel_type;
+
+	// Voxelspace. Every voxel the edit can touch. Spheres are centered in
+	// it, with a radius of half the extent rounded down.
+	ICuboid bounds;
+};
+
+class VoxelEditBatch{
+	/*
+	Voxel writes and fills to apply to a ChunkTable in one go, see 
+	ChunkTable::applyEdits(). Where edits overlap, the later one wins.
+	*/
+	public:
+		void setVoxel(VoxelCoord coord, VoxelType type);
+		void fillBox(ICuboid box, VoxelType type);
+		void fillSphere(VoxelCoord center, Int32 radius, VoxelType type);
+		void append(const VoxelEditBatch& other);
+		void clear();
+		Int64 numEdits() const;
+		const std::vector<VoxelEdit>& edits() const;
+
+	private:
+		std::vector<VoxelEdit> m_edits;
+};
+
+//--------------------------------------------------------------------------------------------------
+// Block Pool
+//--------------------------------------------------------------------------------------------------
+class BlockPool{
+	/*
+	Hands out fixed size blocks carved from larger slabs. Blocks never 
+	move, and released blocks are reused before new ones are carved off, 
+	so nothing is allocated once the pool has grown to its peak. Slabs are
+	only freed when the pool is destroyed.
+	*/
+	public:
+		BlockPool(Uint64 block_bytes, Int32 blocks_per_slab);
+		~BlockPool();
+
+		Bytes1* acquire();
+		void release(Bytes1* block);
+		void reserve(Int32 num_blocks);
+		Uint64 numBytesInUse() const;
+
+	private:
+		Uint64 m_block_bytes;
+		Int32 m_blocks_per_slab;
+		Int32 m_num_blocks_created;
+		std::vector<Bytes1*> m_slabs;
+		std::vector<Bytes1*> m_free_blocks;
+};
+
 //--------------------------------------------------------------------------------------------------
 // Chunk Table
 //--------------------------------------------------------------------------------------------------
 class ChunkTable{
 	/*
 	Abstracts chunk data management
-	TODO: Max loaded chunk count
-	YAGNI: Better data packing. Use fixed-size memory block with freelist allocator.
+
+	Chunks are stored in the smallest of these encodings that fits:
+		Uniform: Just the type. Costs no block at all.
+		Palette: Up to 16 types, with a 1, 2 or 4 bit index per voxel.
+		Raw: A full RawVoxelChunk.
+	Blocks come from one BlockPool per encoding, and a flat open addressing
+	index maps chunk coordinates to chunk versions. Once the pools have 
+	grown to their peak, setting and looking up chunks rarely allocates.
+
+	Reads are transparent. Uniform chunks share one read only chunk per 
+	type, and palette chunks are decompressed into a small cache owned by 
+	the reading thread. Those copies aren't part of the table, so they 
+	don't count towards numResidentBytes().
+
+	At most maxLoadedChunks() can be loaded. setChunk() refuses new chunks 
+	once the table is full.
+
+	Evicting a chunk frees its voxels without taking it out of the world.
+	It keeps its entry, along with a hash of its voxels and its most common
+	solid type, but it no longer counts as loaded. Ray walks see it as a 
+	solid block of that type, and anything that looks at it stamps it as 
+	read, so its owner can page it back in, see evictedChunksReadSince(). 
+	Evictions, and paging the same voxels back in, are journaled as 
+	residency only changes, which caches of the world can ignore.
+
+	Every change bumps the table version, and is stamped with it in a 
+	journal along with the box of voxels it touched. Consumers remember 
+	the last version they saw and ask changesSince() for what happened 
+	after it, instead of rescanning the table. The journal only keeps the
+	most recent changes. If a consumer falls further behind than that, 
+	the list comes back incomplete and it has to start over.
+
+	THREADING: Reads never lock. A reader opens a ReadGuard first, and every
+		pointer it gets from getChunkPtr() stays good until the guard 
+		closes, whatever writers do in the meantime. Writes take turns on 
+		an internal mutex. Every write publishes a new immutable version of
+		the chunk, and old versions are only reclaimed once no open guard 
+		could have seen them.
+
+		The writing thread can read without a guard, since only its own 
+		writes reclaim anything.
+
+		A pointer to a decompressed palette chunk is also only good until 
+		the same thread has read ARBITRARY_DECOMPRESSED_CHUNKS_PER_THREAD
+		other palette chunks, from any table. Hold one chunk at a time, or
+		copy what's needed. Code that only reads a few voxels from each 
+		chunk, like ray walks, should use getChunkView() instead, which 
+		never decompresses.
+
+		Guards nest. A thread that already has one open on the table 
+		reuses its reader slot, so nested guards only cost a lookup. If 
+		every slot is taken, readers fall back to a shared count that 
+		blocks reclamation until they leave, instead of waiting for a slot.
 	*/
+	public:
+		static constexpr Int32 DEFAULT_MAX_LOADED_CHUNKS = 2048;
+
+		struct ChunkResidency{
+			IVec3 coord;
+			Uint32 num_bytes;  // Freed by erasing the chunk
+			Uint32 last_read_frame;  // See setReadFrame()
+		};
+
+		struct ChunkChange{
+			Uint64 version;  // Table version after the change
+			IVec3 coord;
+			ICuboid dirty_box;  // Voxels that changed, relative to the chunk
+			bool is_erased;
+			bool is_residency_only;  // Evicted or paged back in. No voxels changed.
+		};
+
+		struct ChangeList{
+			std::vector<ChunkChange> changes;  // Oldest first
+			Uint64 version;  // What to pass to the next changesSince()
+			bool is_complete;  // False if some changes were already dropped
+		};
+
+		struct ChunkView{
+			/*
+			A chunk's voxels, read in place without decompressing it. Good
+			until the guard closes.
+			*/
+			VoxelType typeAt(Int32 voxel_index) const;
+
+			const VoxelType* palette_ptr;  // NULL if the chunk isn't loaded
+			const Bytes1* data_ptr;  // Indices or the raw chunk. NULL if uniform
+			Uint8 bits_per_voxel;  // 0 if uniform, 8 if raw
+		};
+
+		class ReadGuard{
+			/*
+			Keeps the chunks seen while it's open from being reclaimed.
+			Guards are cheap, but they hold back reclamation, so they 
+			shouldn't stay open for longer than a frame.
+			*/
+			public:
+				ReadGuard(const ChunkTable& table);
+				~ReadGuard();
+				ReadGuard(const ReadGuard&) = delete;
+				ReadGuard& operator=(const ReadGuard&) = delete;
+
+			private:
+				const ChunkTable* m_table_ptr;
+				Int32 m_reader_slot;
+		};
+
 	public:
 		ChunkTable();
 		~ChunkTable();
 
 		bool isLoaded(IVec3 coord) const;
-		void setChunk(IVec3 coord, RawVoxelChunk chunk_data);
-		RawVoxelChunk& getChunkRef(IVec3 coord);
+		bool isEvicted(IVec3 coord) const;
+		bool touchChunk(IVec3 coord) const;
+		bool setChunk(IVec3 coord, const RawVoxelChunk& chunk_data);
+		std::vector<bool> setChunks(const std::vector<IVec3>& coords, 
+			const std::vector<RawVoxelChunk>& chunks);
+		bool copyChunk(IVec3 coord, const ChunkTable& source);
+		std::vector<IVec3> applyEdits(const VoxelEditBatch& batch);
 		const RawVoxelChunk* const getChunkPtr(IVec3 coord) const;
+		ChunkView getChunkView(IVec3 coord) const;
 		void eraseChunks(std::vector<IVec3> coords);
+		void evictChunks(const std::vector<IVec3>& coords);
+		std::vector<IVec3> evictedChunksReadSince(Uint32 frame) const;
 		std::vector<IVec3> allLoadedChunks() const;
 		ICuboid boundingVolumeChunkspace() const;
+		Uint64 contentHash() const;
+		bool setMaxLoadedChunks(Int32 max_loaded_chunks);
+		Int32 maxLoadedChunks() const;
+		Int32 numLoadedChunks() const;
+		Uint64 numResidentBytes() const;
+		void setReadFrame(Uint32 frame);
+		std::vector<ChunkResidency> residencyInfo() const;
+		Uint64 currentVersion() const;
+		Uint64 chunkVersion(IVec3 coord) const;
+		ChangeList changesSince(Uint64 seen_version) const;
 
-	public:
-		std::mutex m_access_mutex;
+	private:
+		// Values are the bits per voxel
+		enum ChunkEncoding: Uint8{
+			ENCODING_UNIFORM   = 0,
+			ENCODING_PALETTE_1 = 1,
+			ENCODING_PALETTE_2 = 2,
+			ENCODING_PALETTE_4 = 4,
+			ENCODING_RAW       = 8,
+			ENCODING_EVICTED   = 255,  // No voxels. The palette holds the stand in type.
+		};
+
+		enum RetiredType: Uint8{
+			RETIRED_VERSION,
+			RETIRED_INDEX,
+		};
+
+		static constexpr Int32 MAX_PALETTE_SIZE = 16;
+		static constexpr Int32 NUM_POSSIBLE_TYPES = 256;
+		static constexpr Int32 BLOCKS_PER_SLAB = 64;
+		static constexpr Int32 MAX_CONCURRENT_READERS = 64;
+		static constexpr Int32 OVERFLOW_READER_SLOT = -1;
+		static constexpr Int32 ARBITRARY_MAX_TABLES_PER_THREAD = 4;
+		static constexpr Int32 ARBITRARY_DECOMPRESSED_CHUNKS_PER_THREAD = 16;
+		static constexpr Uint64 IDLE_READER_EPOCH = UINT64_MAX;
+		static constexpr Uint64 ARBITRARY_JOURNAL_CAPACITY = 1 << 15;
+
+		// Chunks are a multiple of 4KB long, so packed back to back the same
+		// voxel of every chunk would compete for the same cache sets. 
+		// Shifting each block by an extra cache line spreads them out.
+		static constexpr Uint64 BLOCK_PADDING = 64;
+
+		struct EncodedChunk{
+			ChunkEncoding encoding;
+			Uint8 palette_size;
+			VoxelType palette[MAX_PALETTE_SIZE];  // The type if uniform
+			Bytes1* data_ptr;  // Indices or the raw chunk. NULL if uniform
+		};
+
+		struct ChunkVersion{
+			EncodedChunk encoded;
+
+			// Frame of the last getChunkPtr() or set
+			mutable std::atomic<Uint32> last_read_frame{0};
+
+			// Table version that published it. Unique within the table.
+			Uint64 table_version;
+
+			// Hash of the voxels it stands in for. Only kept once evicted.
+			Uint64 content_hash;
+		};
+
+		struct IndexEntry{
+			IVec3 coord;  // Never changes once the entry is used
+
+			// NULL if the entry was never used, m_erased_version if erased.
+			// Evicted chunks keep a version of their own.
+			std::atomic<ChunkVersion*> version{NULL};
+		};
+
+		struct ChunkIndex{
+			/*
+			Entries are only ever filled in or have their version swapped.
+			Anything else makes a new index, so readers never see an 
+			entry move.
+			*/
+			ChunkIndex(Uint64 num_entries);
+
+			std::vector<IndexEntry> entries;  // Size is a power of two
+			Int32 num_used_entries;  // Loaded, evicted or erased
+		};
+
+		struct RetiredItem{
+			Uint64 epoch;
+			RetiredType type;
+			void* item_ptr;
+		};
+
+		// Each on its own cache line, so readers don't contend
+		struct alignas(64) ReaderSlot{
+			std::atomic<Uint64> epoch{IDLE_READER_EPOCH};
+		};
+
+		struct ThreadReader{
+			/*
+			A table this thread has guards open on. Unused if the table is 
+			NULL.
+			*/
+			const ChunkTable* table_ptr;
+			Int32 reader_slot;
+			Int32 num_open_guards;
+		};
+
+		struct DecompressedChunk{
+			Uint64 table_id;
+			Uint64 table_version;  // Of the version it was decompressed from
+			Uint64 last_read;  // Tick of the cache's last read
+			RawVoxelChunk* chunk_ptr;
+		};
+
+		struct DecompressionCache{
+			/*
+			The last few palette chunks a thread read, least recently read 
+			first to go. Copies are only seen by the thread that made them.
+			*/
+			~DecompressionCache();
+
+			std::vector<DecompressedChunk> chunks;
+			Uint64 num_reads{0};
+		};
+
+		Int32 enterReader() const;
+		void exitReader(Int32 reader_slot) const;
+		Int32 claimReaderSlot() const;
+		void releaseReaderSlot(Int32 reader_slot) const;
+		ThreadReader* findThreadReader() const;
+		void retire(RetiredType type, void* item_ptr);
+		void reclaimRetired(bool should_ignore_readers=false);
+
+		ChunkVersion* findVersion(const ChunkIndex& index, IVec3 coord, 
+			bool should_include_evicted=false) const;
+		Uint64 homeEntry(const ChunkIndex& index, IVec3 coord) const;
+		bool writeChunk(IVec3 coord, const RawVoxelChunk& chunk_data);
+		bool publishVersion(IVec3 coord, ChunkVersion* version_ptr, ICuboid dirty_box,
+			bool is_residency_only=false);
+		Uint64 recordChange(IVec3 coord, ICuboid dirty_box, bool is_erased, 
+			bool is_residency_only=false);
+		ChunkIndex* rebuildIndex(Uint64 num_entries);
+		Uint64 indexSizeFor(Int32 num_chunks) const;
+		std::vector<IVec3> loadedChunks(const ChunkIndex& index, 
+			bool should_include_evicted=false) const;
+
+		ChunkVersion* createVersion();
+		void destroyVersion(ChunkVersion* version_ptr);
+		bool encodeChunk(const RawVoxelChunk& chunk_data, EncodedChunk& output);
+		bool patchChunk(const EncodedChunk& old_encoded, const RawVoxelChunk& chunk_data, 
+			ICuboid dirty_box, EncodedChunk& output);
+		bool createUniformChunk(VoxelType type);
+		void unpackVoxels(const EncodedChunk& encoded, Int32 first_voxel, 
+			Int32 num_voxels, Voxel* output) const;
+		ICuboid changedVoxels(const EncodedChunk& old_encoded, 
+			const RawVoxelChunk& chunk_data) const;
+		Uint64 chunkHash(IVec3 coord, const EncodedChunk& encoded) const;
+		VoxelType mostCommonSolidType(const EncodedChunk& encoded) const;
+		const RawVoxelChunk* readVersion(const ChunkVersion* version_ptr) const;
+		BlockPool* poolFor(ChunkEncoding encoding);
 
 	private:
+		// Everything but the reader state is only touched by writers
+		mutable std::mutex m_write_mutex;
 		ICuboid m_bounds;
-		std::unordered_map<IVec3, RawVoxelChunk, PODHasher> m_loaded_chunks;
+		Int32 m_max_loaded_chunks;
+		std::atomic<Int32> m_num_loaded_chunks;
+		std::atomic<Int32> m_num_evicted_chunks;
+		std::atomic<ChunkIndex*> m_index;
+		std::atomic<Uint32> m_read_frame;
+		ChunkVersion m_erased_version;  // Only its address is used
+
+		// Changes after m_journal_start_version, oldest first
+		std::atomic<Uint64> m_version;
+		std::vector<ChunkChange> m_journal;
+		Uint64 m_journal_start_version;
+
+		// Uniform chunks point here instead of owning a block
+		RawVoxelChunk* m_uniform_chunks[NUM_POSSIBLE_TYPES]{};
 
+		BlockPool m_version_pool;
+		BlockPool m_raw_pool;
+		BlockPool m_palette_pools[3];  // 1, 2 and 4 bits per voxel
+
+		// Tells this table's decompressed copies apart from other tables'
+		Uint64 m_table_id;
+		static thread_local DecompressionCache s_decompression_cache;
+
+		// Epoch based reclamation. Items retired in an epoch are reclaimed
+		// once every open guard entered after it.
+		std::atomic<Uint64> m_epoch;
+		mutable ReaderSlot m_reader_slots[MAX_CONCURRENT_READERS];
+		mutable std::atomic<Int32> m_num_overflow_readers;
+		static thread_local ThreadReader s_thread_readers[ARBITRARY_MAX_TABLES_PER_THREAD];
+		std::vector<RetiredItem> m_retired;
 };
 
 static_assert(sizeof(Voxel) * CHUNK_VOLUME == sizeof(RawVoxelChunk), 
 	"RawVoxelChunk struct must be a dense array of Voxel structs");
+
+inline VoxelType ChunkTable::ChunkView::typeAt(Int32 voxel_index) const{
+	/*
+	Inlined, since ray walks call this for every voxel they step through
+	*/
+
+	if(bits_per_voxel == ENCODING_RAW){
+		return (VoxelType) data_ptr[voxel_index];
+	}else if(bits_per_voxel == ENCODING_UNIFORM){
+		return palette_ptr[0];
+	}
+
+	Int32 bit_index = voxel_index * bits_per_voxel;
+	Bytes1 packed = data_ptr[bit_index / BITS_PER_BYTE];
+	Bytes1 index_mask = (1 << bits_per_voxel) - 1;
+	return palette_ptr[(packed >> (bit_index % BITS_PER_BYTE)) & index_mask];
+}
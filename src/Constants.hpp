@@ -10,6 +10,7 @@ constexpr int BITS_PER_BYTE = 8;
 constexpr float ARBITRARY_EPSILON = 0.0000001;
 constexpr float LARGE_FLOAT = 99999999999;
 constexpr Uint64 MAX_INT32_VALUE = INT_MAX;
+constexpr Uint64 MAX_UINT32_VALUE = UINT_MAX;
 constexpr Uint64 MAX_INT64_VALUE = LLONG_MAX;
 constexpr Uint64 MAX_UINT64_VALUE = ULLONG_MAX;
 constexpr Int32 NUM_VERTICES_PER_TRIANGLE = 3;
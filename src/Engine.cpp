@@ -111,6 +111,29 @@ void VG::Engine::initTargetWorld(){
 	VoxelKDTree::BuildSettings settings;
 	settings.max_depth = tree_settings["MaxDepth"].val_int;
 	settings.mandatory_leaf_volume = tree_settings["MandatoryLeafVolume"].val_int;
+	settings.should_generate_ropes = tree_settings["ShouldGenerateRopes"].val_bool;
+	settings.should_cluster_treelets = tree_settings["ShouldClusterTreelets"].val_bool;
+	settings.num_build_threads = tree_settings["NumBuildThreads"].val_int;
+	settings.should_calculate_non_leaf_properties = 
+		tree_settings["ShouldCalculateNodeProperties"].val_bool;
+	settings.should_terminate_by_sah = tree_settings["ShouldTerminateBySah"].val_bool;
+
+	// Unrecognized or missing names keep the build settings default
+	PODVariant level_data = tree_settings["OptimizationLevel"];
+	if(level_data.type == PODVariant::DATATYPE_STRING){
+		PODString level_name = level_data.val_string;
+		if(level_name == "None"){
+			settings.optimization_level = OPTIMIZE_NONE;
+		}else if(level_name == "Low"){
+			settings.optimization_level = OPTIMIZE_LOW;
+		}else if(level_name == "Medium"){
+			settings.optimization_level = OPTIMIZE_MEDIUM;
+		}else if(level_name == "High"){
+			settings.optimization_level = OPTIMIZE_HIGH;
+		}else if(level_name == "Exhaustive"){
+			settings.optimization_level = OPTIMIZE_EXHAUSTIVE;
+		}
+	}
 	settings.bounds = {
 		chunkspace_bounds.origin * CHUNK_LEN,
 		chunkspace_bounds.extent * CHUNK_LEN,
@@ -543,6 +566,7 @@ Raytracer::RenderSettings initRenderSettings(std::shared_ptr<Settings> ptr){
 		.num_render_threads=ray_settings["NumRenderThreads"].val_int,
 		.num_rays_per_pixel=ray_settings["RaysPerPixel"].val_int,
 		.max_path_len=ray_settings["MaxPathLen"].val_int,
+		.lod_footprint_scale=ray_settings["LodFootprintScale"].val_float,
 
 		.sky_brightness=sky_brightness,
 		.sun_brightness=sun_brightness,
@@ -622,6 +646,7 @@ void VG::Engine::runMainLoop(){
 	
 	// Need to get initial widgets rendering
 	updateWidgetAssets(m_renderer);
+	m_simcache.updateEntityInstances();
 
 	// Switches to control what parts of the main loop update
 	bool should_exit = false;
@@ -766,7 +791,7 @@ void VG::Engine::runMainLoop(){
 						raytracer.renderImage(m_simcache, camera, render_settings);
 					}else{
 						printf("Previewing image (this might take a while)...\n");
-						raytracer.renderPreview(m_simcache, camera, render_settings.image_config);
+						raytracer.renderPreview(m_simcache, camera, render_settings);
 					}
 					renderer_should_update = true;
 				}
@@ -797,6 +822,29 @@ void VG::Engine::runMainLoop(){
 		if(should_execute_simulation){
 			// TODO: Add simulation code	
 		}
+
+		// Chunk changes are journaled by the table, and only rebuild the 
+		// regions of the voxel tree they're in, on a background thread. Rays
+		// use the old tree until then. Evictions don't change the world, so
+		// they don't rebuild anything.
+		m_chunk_manager->processInstructions();
+		m_chunk_manager->updateResidency(camera.pos);
+
+		// Chunks streamed in around the camera need meshes, same as the ones
+		// generated at startup. Only the voxel tree's bounds are ray traced.
+		for(IVec3 streamed_coord : m_chunk_manager->updateStreaming(camera.pos, camera.basis.v1)){
+			CellAddress cell_addr = {.corner_addr=streamed_coord, .lod_power=0};
+			ChunkInstruction meshing_instruction = {CHUNK_GENERATE_UNLIT_MESH, cell_addr, 1};
+			SystemInstruction sys_meshing_instruction = {
+				.type=INSTRUCTION_CHUNK,
+				.chunk_instruction=meshing_instruction
+			};
+			m_renderer.sendInstruction(sys_meshing_instruction);
+		}
+		m_simcache.updateAccelerationStructures();
+
+		// Moved entities need to be visible to ray queries
+		m_simcache.updateEntityInstances();
 		
 		// Render world state from player perspective
 		if(m_window_ptr){
@@ -868,6 +916,11 @@ Settings VG::Engine::defaultSettings(){
 	chunk_gen["GenerationAlgorithm"] = "Default";
 	chunk_gen["MinBounds"] = IVec3{-1, -1, -1};
 	chunk_gen["MaxBounds"] = IVec3{0, 0, 0};
+	chunk_gen["ResidentBudgetMB"] = 0;
+	chunk_gen["ChunkDirectory"] = "Chunks";
+	chunk_gen["StreamRadius"] = 0;
+	chunk_gen["StreamThreads"] = 1;
+	chunk_gen["StreamChunksPerFrame"] = 4;
 	settings.update("CHUNK_GEN", chunk_gen);
 
 	Settings::Namespace raytracing;
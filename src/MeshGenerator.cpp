@@ -77,9 +77,13 @@ MesherAdjacencyGrid generateAdjacencyGrid(const ChunkTable* table, CellAddress a
 
 	// Get the chunk data
 	assert(table != NULL);
-	const RawVoxelChunk* chunk_ptr = table->getChunkPtr(addr.corner_addr);
-	assert(chunk_ptr != NULL);
-	RawVoxelChunk chunk = *chunk_ptr;	
+	RawVoxelChunk chunk;
+	{
+		ChunkTable::ReadGuard read_guard(*table);
+		const RawVoxelChunk* chunk_ptr = table->getChunkPtr(addr.corner_addr);
+		assert(chunk_ptr != NULL);
+		chunk = *chunk_ptr;
+	}
 
 	return generateAdjacencyGrid(chunk);
 }
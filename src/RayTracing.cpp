@@ -1,5 +1,11 @@
 #include "RayTracing.hpp"
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 
 //-------------------------------------------------------------------------------------------------
 // Raytracing-specific helper functions
@@ -174,6 +180,16 @@ std::vector<Ray> Rendering::allRays(Camera camera, ImageConfig config){
 	return output_rays;
 }
 
+float Rendering::pixelConeSpread(Camera camera, IVec2 image_dims){
+	/*
+	Width of a single pixel's cone per unit of distance from the camera.
+	Matches the vertical field of view used by CameraRayGenerator.
+	*/
+
+	float image_plane_height = 2 * tan(degreesToRadians(camera.fov) * 0.5);
+	return image_plane_height / image_dims.y;
+}
+
 //-------------------------------------------------------------------------------------------------
 // Misc local helper functions
 //-------------------------------------------------------------------------------------------------
@@ -204,7 +220,7 @@ IVec3 rayStep(FVec3 direction){
 //-------------------------------------------------------------------------------------------------
 Intersection::Utils::GridRay
 Intersection::Utils::localChunkIntersection(
-	Intersection::Utils::GridRay grid_ray, const RawVoxelChunk& chunk){
+	Intersection::Utils::GridRay grid_ray, const ChunkTable::ChunkView& chunk){
 	/*
 	Using cached ray information, intersect the chunk and return whether or not a hit
 	occurred. This is a helper function for intersectChunks and should not be called elsewhere.
@@ -218,12 +234,7 @@ Intersection::Utils::localChunkIntersection(
 	*/
 	
 	IVec3& grid_coord = grid_ray.local_grid_coord;
-	int smallest;  // The last stepped axis is needed when the loop terminates
 	while(true){
-		smallest = smallestIndexBranchless(grid_ray.t_next_crossing);
-		grid_ray.t_next_crossing[smallest] += grid_ray.delta_t[smallest];
-		grid_coord[smallest] += grid_ray.step_dir[smallest];
-		
 		// Check if the ray went out of bounds
 		if(grid_coord.x >= CHUNK_LEN || grid_coord.y >= CHUNK_LEN || grid_coord.z >= CHUNK_LEN || 
 			grid_coord.x < 0 || grid_coord.y < 0 || grid_coord.z < 0){
@@ -231,14 +242,21 @@ Intersection::Utils::localChunkIntersection(
 			break;
 		}
 
-		VoxelType type = chunk.data[linearChunkIndex(grid_coord)].type;
+		// The voxel the ray is currently in is tested before stepping. Otherwise the
+		// first voxel of every chunk after the first gets skipped.
+		VoxelType type = chunk.typeAt(linearChunkIndex(grid_coord));
 		if(!isAir(type)){
 			grid_ray.is_hit = true;
 			grid_ray.hit_voxel_type = type;
 			break;
 		}
+
+		int smallest = smallestIndexBranchless(grid_ray.t_next_crossing);
+		grid_ray.t_curr = grid_ray.t_next_crossing[smallest];
+		grid_ray.t_next_crossing[smallest] += grid_ray.delta_t[smallest];
+		grid_coord[smallest] += grid_ray.step_dir[smallest];
+		grid_ray.last_stepped_axis = smallest;
 	}
-	grid_ray.last_stepped_axis = smallest;
 
 	return grid_ray;
 }
@@ -261,6 +279,7 @@ Intersection::Utils::traverseEmptyChunk(
 	int smallest;
 	while(true){
 		smallest = smallestIndexBranchless(grid_ray.t_next_crossing);
+		grid_ray.t_curr = grid_ray.t_next_crossing[smallest];
 		grid_ray.t_next_crossing[smallest] += grid_ray.delta_t[smallest];
 		grid_coord[smallest] += grid_ray.step_dir[smallest];
 		
@@ -276,55 +295,179 @@ Intersection::Utils::traverseEmptyChunk(
 	return grid_ray;
 }
 
+IVec3 voxelAtEntry(Ray ray, float t_min, float t_max, Axis entry_axis){
+	/*
+	The voxel the ray is in just after t_min. Sampled slightly inside the 
+	segment so it's never the neighbor on the other side of the entry face.
+
+	For grazing rays the sample offset can be lost to float rounding along
+	the entry axis, so if the ray crossed a face at t_min, that coordinate
+	comes from the (integer) face instead.
+	*/
+
+	float t_inside = t_min + min(0.5f * (t_max - t_min), 0.0001f);
+	FVec3 pos = posFromT(ray, t_inside);
+	IVec3 voxel = floorToInt(pos);
+	if(t_min > 0 && ray.dir[entry_axis] != 0){
+		int face_coord = (int) round(posFromT(ray, t_min)[entry_axis]);
+		voxel[entry_axis] = face_coord - (ray.dir[entry_axis] < 0);
+	}
+	return voxel;
+}
+
+RayIntersection
+Intersection::Utils::intersectVoxelsInSegment(Ray ray, float t_min, float t_max,
+	Axis entry_axis, const ChunkTable* table_ptr){
+	/*
+	Bounded voxel DDA over the part of the ray between t_min and t_max. Used
+	to resolve tree leaves that only know they might contain solid voxels.
+	Since leaves are grid aligned, the segment covers exactly the voxels of 
+	the leaf the ray passes through. Unloaded chunks count as air.
+
+	The entry_axis is the axis whose face the ray entered through at t_min,
+	which determines the face index if the very first voxel is solid.
+
+	ATTRIBUTION: Efficient Ray-Grid traversal algorithm.
+		https://www.scratchapixel.com/lessons/3d-basic-rendering/
+			introduction-acceleration-structure/grid
+	*/
+
+	RayIntersection intersection{INTERSECT_MISS};
+	if(t_max <= t_min){
+		return intersection;
+	}
+
+	IVec3 voxel_coord = voxelAtEntry(ray, t_min, t_max, entry_axis);
+
+	FVec3 delta_t;
+	FVec3 t_next_crossing;
+	IVec3 step_dir = rayStep(ray.dir);
+	for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+		if(ray.dir[axis] == 0){
+			// Never crosses. Avoids 0 * inf when the origin is on a boundary.
+			delta_t[axis] = LARGE_FLOAT;
+			t_next_crossing[axis] = LARGE_FLOAT;
+			continue;
+		}
+
+		float inverse_dir = 1.0f / ray.dir[axis];
+		int is_positive = step_dir[axis] > 0;
+		delta_t[axis] = abs(inverse_dir);
+		t_next_crossing[axis] = 
+			(voxel_coord[axis] + is_positive - ray.origin[axis]) * inverse_dir;
+	}
+
+	// Cache the current chunk since most steps stay inside it
+	ChunkTable::ReadGuard read_guard(*table_ptr);
+	IVec3 chunk_coord = chunkCoordFromVoxelCoord(voxel_coord);
+	ChunkTable::ChunkView chunk = table_ptr->getChunkView(chunk_coord);
+
+	float t_curr = t_min;
+	int curr_axis = entry_axis;
+	while(true){
+		IVec3 voxel_chunk_coord = chunkCoordFromVoxelCoord(voxel_coord);
+		if(!(voxel_chunk_coord == chunk_coord)){
+			chunk_coord = voxel_chunk_coord;
+			chunk = table_ptr->getChunkView(chunk_coord);
+		}
+
+		if(chunk.palette_ptr != NULL){
+			IVec3 local_coord = localVoxelCoordFromGlobal(voxel_coord);
+			VoxelType type = chunk.typeAt(linearChunkIndex(local_coord));
+			if(!isAir(type)){
+				bool is_axis_dir_negative = ray.dir[curr_axis] < 0;
+				intersection.type = INTERSECT_HIT_CHUNK_VOXEL;
+				intersection.t_hit = t_curr;
+				intersection.voxel_hit.voxel = voxel_coord;
+				intersection.voxel_hit.face_index = 
+					(GridDirection) (curr_axis * 2 + is_axis_dir_negative);
+				intersection.voxel_hit.palette_index = type;
+				return intersection;
+			}
+		}
+
+		curr_axis = smallestIndexBranchless(t_next_crossing);
+		t_curr = t_next_crossing[curr_axis];
+		if(t_curr >= t_max){
+			return intersection;
+		}
+		t_next_crossing[curr_axis] += delta_t[curr_axis];
+		voxel_coord[curr_axis] += step_dir[curr_axis];
+	}
+}
+
 RayIntersection 
 Intersection::intersectChunks(Ray ray, const ChunkTable* table_ptr){
+	return intersectChunks(ray, table_ptr, LARGE_FLOAT);
+}
+
+RayIntersection 
+Intersection::intersectChunks(Ray ray, const ChunkTable* table_ptr, float t_max){
 	/*
+	Voxel DDA through the loaded chunks, starting at the point where the ray
+	enters the loaded volume. Values of t are relative to the original origin.
+	A solid voxel containing the origin counts as a hit at t = 0.
 
+	The walk stops at the first chunk boundary past t_max, so a hit can 
+	still be slightly beyond it. Callers that care have to check t_hit.
 	*/
 
 	RayIntersection intersection{INTERSECT_MISS};
 
-	// Don't trace if the ray won't hit the world. Otherwise, advance it to
-	// the first loaded chunk in the ray's path.
+	// Don't trace if the ray won't hit the world. Otherwise, start at the
+	// first loaded chunk in the ray's path.
 	ICuboid chunk_bounds = table_ptr->boundingVolumeChunkspace();
-	RayIntersection box_hit = intersectCollider(ray, chunk_bounds * CHUNK_LEN);
-	if(box_hit.type == INTERSECT_HIT_COLLIDER || box_hit.type == INTERSECT_INTERNAL_COLLIDER){
-		ray.origin = ray.origin + ray.dir * box_hit.t_hit;
-	}else{
+	DetailedCuboidIntersection box_hit = intersectColliderDetailed(
+		ray, chunk_bounds * CHUNK_LEN);
+	float t_entry = std::max(box_hit.t_bounds[INDEX_VALUE_MIN], 0.0f);
+	float t_exit = box_hit.t_bounds[INDEX_VALUE_MAX];
+	if(!box_hit.is_valid || t_exit <= t_entry){
 		return intersection;
 	}
-	
+
+	IVec3 global_voxel_coord = voxelAtEntry(ray, t_entry, t_exit, box_hit.last_min_axis);
+
 	// The ray is almost never going to start in the exact corner of a voxel, so the
 	// initial t value for the first crossing will be different than all subsequent ones.
-	FVec3 dir = ray.dir.normal();
-	FVec3 t_initial_crossing = {0, 0, 0};
+	FVec3 dir = ray.dir;
+	FVec3 t_initial_crossing;
+	FVec3 delta_t;
 	for(int i = 0; i < 3; ++i){
-		int is_positive = ray.dir[i] >= 0;
-		float initial_t = (floor(ray.origin[i]) + is_positive - ray.origin[i]) / dir[i];
-		t_initial_crossing[i] = initial_t;
+		if(dir[i] == 0){
+			// Never crosses. Avoids 0 * inf when the origin is on a boundary.
+			t_initial_crossing[i] = LARGE_FLOAT;
+			delta_t[i] = LARGE_FLOAT;
+			continue;
+		}
+
+		int is_positive = dir[i] >= 0;
+		t_initial_crossing[i] = (global_voxel_coord[i] + is_positive - ray.origin[i]) / dir[i];
+		delta_t[i] = abs(1.0f / dir[i]);
 	}
-	IVec3 global_voxel_coord = floorToInt(ray.origin);
 
 	// Some of these computations only need to be done one time per ray. Calculate once
 	// and re-use for each chunk intersection.
 	Intersection::Utils::GridRay grid_ray;
-	grid_ray.delta_t = {abs(1.0f / dir.x), abs(1.0f / dir.y), abs(1.0f / dir.z)};
+	grid_ray.delta_t = delta_t;
 	grid_ray.step_dir = rayStep(dir);
 	grid_ray.local_grid_coord = localVoxelCoordFromGlobal(global_voxel_coord);
 	grid_ray.t_next_crossing = t_initial_crossing;
+	grid_ray.t_curr = t_entry;
+	grid_ray.last_stepped_axis = box_hit.last_min_axis;
 	grid_ray.is_hit = false;
 
+	ChunkTable::ReadGuard read_guard(*table_ptr);
 	IVec3 curr_chunk_coord = chunkCoordFromVoxelCoord(global_voxel_coord);
-	while(table_ptr->isLoaded(curr_chunk_coord)){
-		RawVoxelChunk chunk_data = *table_ptr->getChunkPtr(curr_chunk_coord);
+	while(true){
+		ChunkTable::ChunkView chunk = table_ptr->getChunkView(curr_chunk_coord);
+		if(chunk.palette_ptr == NULL){
+			break;
+		}
 		
-		grid_ray = localChunkIntersection(grid_ray, chunk_data);
+		grid_ray = localChunkIntersection(grid_ray, chunk);
 		if(grid_ray.is_hit){
-			// For the last grid step, the ray enters the voxel, putting the t value beyond the
-			// contact value. Pull the t value back by one step length to undo this and get the 
-			// t value at the surface.
 			int hit_axis = grid_ray.last_stepped_axis;
-			float contact_t = grid_ray.t_next_crossing[hit_axis] - grid_ray.delta_t[hit_axis];
+			float contact_t = grid_ray.t_curr;
 			bool is_axis_dir_negative = dir[hit_axis] < 0;
 			int face_index = hit_axis * 2 + is_axis_dir_negative;
 
@@ -335,6 +478,8 @@ Intersection::intersectChunks(Ray ray, const ChunkTable* table_ptr){
 			intersection.voxel_hit.face_index = (GridDirection) face_index;
 			intersection.voxel_hit.palette_index = grid_ray.hit_voxel_type;
 			break;
+		}else if(grid_ray.t_curr >= t_max){
+			break;
 		}else{
 			IVec3 offset_to_next_chunk = chunkCoordFromVoxelCoord(grid_ray.local_grid_coord);
 			grid_ray.local_grid_coord = localVoxelCoordFromGlobal(grid_ray.local_grid_coord);
@@ -346,6 +491,61 @@ Intersection::intersectChunks(Ray ray, const ChunkTable* table_ptr){
 }
 
 
+RayIntersection unresolvedLeafHit(Ray ray, VoxelKDTree::PackedData leaf_data,
+	float t_min, float t_max, Axis entry_axis){
+	/*
+	Hit for a non-empty leaf that's reported as-is, without walking its 
+	voxels. Shared by the stack and rope traversals.
+	*/
+
+	constexpr IntersectionType leaf_intersection_types[] = {
+		INTERSECT_POSSIBLE_CHUNK_VOXEL,
+		INTERSECT_HIT_CHUNK_VOXEL_UNKNOWN_TYPE,
+		INTERSECT_HIT_CHUNK_VOXEL,
+	};
+
+	bool is_fully_confirmed = VoxelKDTree::isHomogenousLeaf(leaf_data);
+	bool is_unknown_type = (leaf_data == VoxelKDTree::VALUE_SOLID_MIXED_LEAF);
+	int hit_type_index = is_fully_confirmed * 2 + is_unknown_type;
+	assert(hit_type_index >= 0 && hit_type_index < 3);
+
+	// The last axis to reduce t_min (with sign for direction) is used
+	// to index into an array for normal vectors.
+	bool is_axis_dir_negative = ray.dir[entry_axis] < 0;
+	int face_index = entry_axis * 2 + is_axis_dir_negative;
+
+	RayIntersection hit_state;
+	hit_state.type = leaf_intersection_types[hit_type_index];
+	hit_state.t_hit = t_min;
+	hit_state.voxel_hit.voxel = voxelAtEntry(ray, t_min, t_max, entry_axis);
+	hit_state.voxel_hit.face_index = (GridDirection) face_index;
+	if(is_fully_confirmed){
+		hit_state.voxel_hit.palette_index = VoxelKDTree::paletteIndex(leaf_data);
+	}else{
+		hit_state.voxel_hit.palette_index = 0;
+	}
+	return hit_state;
+}
+
+RayIntersection levelOfDetailHit(Ray ray, const VoxelKDTree::PropertyNode& properties,
+	float t_min, float t_max, Axis entry_axis){
+	/*
+	Hit for a node that traversal stopped at early. It's treated like a
+	solid block of its most common type, hit where the ray enters it.
+	*/
+
+	bool is_axis_dir_negative = ray.dir[entry_axis] < 0;
+	int face_index = entry_axis * 2 + is_axis_dir_negative;
+
+	RayIntersection hit_state;
+	hit_state.type = INTERSECT_HIT_CHUNK_VOXEL;
+	hit_state.t_hit = t_min;
+	hit_state.voxel_hit.voxel = voxelAtEntry(ray, t_min, t_max, entry_axis);
+	hit_state.voxel_hit.face_index = (GridDirection) face_index;
+	hit_state.voxel_hit.palette_index = properties.palette_index;
+	return hit_state;
+}
+
 RayIntersection 
 Intersection::intersectTree(Ray ray, const VoxelKDTree::TreeData* tree){
 	/*
@@ -365,13 +565,45 @@ RayIntersection
 Intersection::intersectTree(Ray ray, const VoxelKDTree::TreeData* tree, 
 	Intersection::Utils::VKDTStack stack){
 	/*
+	Reports leaves without type information as-is. See the overload 
+	that takes a chunk table to have them resolved during traversal.
+	*/
+
+	return intersectTree(ray, tree, stack, NULL);
+}
+
+RayIntersection 
+Intersection::intersectTree(Ray ray, const VoxelKDTree::TreeData* tree, 
+	Intersection::Utils::VKDTStack stack, const ChunkTable* table_ptr,
+	float cone_spread, float cone_width){
+	/*
 	NOTE: Assumes normalized ray
+	NOTE: If table_ptr is provided, leaves that might contain solid voxels
+		(or are solid but of unknown type) are resolved on the spot with a
+		voxel DDA bounded by the leaf. On a miss, traversal continues as if 
+		the leaf was empty. Without a table, the first such leaf is returned
+		as INTERSECT_POSSIBLE_CHUNK_VOXEL or
+		INTERSECT_HIT_CHUNK_VOXEL_UNKNOWN_TYPE.
+
 	ATTRIBUTION: A traversal optimization to reduce stack operations by only pushing the far child 
 		in the case of a double-hit and looping down the near child until a leaf is hit. 
 		Only then is the next node popped. Ensures the stack is only used when a "fork"
 		is explored in the tree. 
 		-Virginia Tech lecture slides "Acceleration Structure For Ray Tracing" by Yong Cao
 	
+	NOTE: Trees with ropes are handed off to intersectTreeStackless, which
+		doesn't touch the stack at all.
+
+	NOTE: cone_spread is the width of the ray's cone per unit of distance,
+		and 0 for an infinitely thin ray. cone_width is how wide the cone
+		already is at the ray's origin, for rays that continue a cone from
+		an earlier hit. If the cone has any width and the tree has property
+		nodes, traversal stops at any node that's narrower than the cone 
+		where the ray enters it. Mostly solid nodes are reported 
+		as a hit on their most common type, and the rest are skipped. 
+		Ropes can't skip an internal node, so trees with ropes use the 
+		stack in that case.
+
 	NOTE: The stack is a simple POD struct passed in as a glorified array
 		pointer with helper methods attached. This is meant to avoid reallocating
 		memory every time intersectTree is called. At the beginning of a batch trace,
@@ -381,11 +613,15 @@ Intersection::intersectTree(Ray ray, const VoxelKDTree::TreeData* tree,
 		since only half of nodes are actually pushed, but it isn't worth it at the moment.
 	*/
 
-	constexpr IntersectionType leaf_intersection_types[] = {
-		INTERSECT_POSSIBLE_CHUNK_VOXEL,
-		INTERSECT_HIT_CHUNK_VOXEL_UNKNOWN_TYPE,
-		INTERSECT_HIT_CHUNK_VOXEL,
-	};
+	// A node that's at least this full stops a cone. Anything less is 
+	// treated as empty.
+	constexpr Uint8 ARBITRARY_LOD_OPAQUE_PERCENTAGE = 50;
+
+	bool is_level_of_detail = (cone_spread > 0 || cone_width > 0) && 
+		tree->has_property_nodes;
+	if(tree->has_ropes && !is_level_of_detail){
+		return intersectTreeStackless(ray, tree, table_ptr);
+	}
 
 	// Bail out early if the ray didn't even hit
 	DetailedCuboidIntersection bounds_hit = Intersection::intersectColliderDetailed(
@@ -431,9 +667,23 @@ Intersection::intersectTree(Ray ray, const VoxelKDTree::TreeData* tree,
 		}
 
 		// Figure out node info
-		curr_data = tree->geometry_nodes_ptr[curr_node_index].pack;
+		VoxelKDTree::NodeView curr_node = VoxelKDTree::nodeView(tree, curr_node_index);
+		curr_data = curr_node.pack;
 		curr_type = VoxelKDTree::nodeType(curr_data);
 
+		// Level of detail. Also spares mixed leaves their voxel walk.
+		if(is_level_of_detail){
+			const VoxelKDTree::PropertyNode& properties = 
+				tree->property_nodes_ptr[curr_node_index];
+			if(properties.max_extent <= cone_width + cone_spread * t_min){
+				if(properties.density_percentage >= ARBITRARY_LOD_OPAQUE_PERCENTAGE){
+					return levelOfDetailHit(ray, properties, t_min, t_max, last_min_axis);
+				}
+				is_backtrack_required = true;
+				continue;
+			}
+		}
+
 		// Leaf handling
 		if(curr_type == VoxelKDTree::VALUE_LEAF_NODE){
 			bool is_empty_leaf = curr_data & VoxelKDTree::FLAG_LEAF_IS_EMPTY;
@@ -441,46 +691,35 @@ Intersection::intersectTree(Ray ray, const VoxelKDTree::TreeData* tree,
 				is_backtrack_required = true;
 				continue;
 			}else{
-				// WARNING: The voxel hit properties are being calculated in an unsafe manner
-				// 	voxel_hit.voxel is likely to be off-by-one
 				bool is_fully_confirmed = VoxelKDTree::isHomogenousLeaf(curr_data);
-				bool is_unknown_type = (curr_data == VoxelKDTree::VALUE_SOLID_MIXED_LEAF);
-				int hit_type_index = is_fully_confirmed * 2 + is_unknown_type;
-				assert(hit_type_index >= 0 && hit_type_index < 3);
-
-				// The last axis to reduce t_min (with sign for direction) is used
-				// to index into an array for normal vectors.
-				bool is_axis_dir_negative = ray.dir[last_min_axis] < 0;
-				int face_index = last_min_axis * 2 + is_axis_dir_negative;
-
-				// Fill in struct fields and return
-				hit_state.type = leaf_intersection_types[hit_type_index];
-				hit_state.t_hit = t_min;
-				hit_state.voxel_hit.voxel = floorToInt(posFromT(ray, t_min));  // TODO: Verify. This feels wrong
-				hit_state.voxel_hit.face_index = (GridDirection) face_index;
-				if(is_fully_confirmed){
-					hit_state.voxel_hit.palette_index = VoxelKDTree::paletteIndex(curr_data);
-				}else{
-					hit_state.voxel_hit.palette_index = 0;
+				if(!is_fully_confirmed && table_ptr != NULL){
+					RayIntersection leaf_hit = Utils::intersectVoxelsInSegment(
+						ray, t_min, t_max, last_min_axis, table_ptr);
+					if(leaf_hit.type == INTERSECT_HIT_CHUNK_VOXEL){
+						return leaf_hit;
+					}
+
+					is_backtrack_required = true;
+					continue;
 				}
 
-				return hit_state;
+				return unresolvedLeafHit(ray, curr_data, t_min, t_max, last_min_axis);
 			}
 		}
 
 		// We're still traversing internal nodes
 		plane_axis = (Axis) curr_type;
 		Uint16 plane_offset = VoxelKDTree::planeOffset(curr_data);
-		VoxelKDTree::NodeIndex child_base_index;
-		if(tree->is_packed_tree){
-			child_base_index = tree->descendant_nodes_ptr[curr_node_index].left_child_index;
-		}else{
-			child_base_index = 2 * curr_node_index + 1;
-		}
+		VoxelKDTree::NodeIndex child_base_index = curr_node.left_child_index;
 		
 		// Calculate the t_intersect value of the plane.
 		t_plane = (plane_offset - inverse_local_ray.origin[plane_axis]) * 
 			inverse_local_ray.dir[plane_axis];
+		if(ray.dir[plane_axis] == 0){
+			// Parallel rays stay on one side. Avoids 0 * inf on the plane itself.
+			bool is_far_side = inverse_local_ray.origin[plane_axis] >= plane_offset;
+			t_plane = is_far_side ? -LARGE_FLOAT : LARGE_FLOAT;
+		}
 		bool should_flip = ray.dir[plane_axis] < 0;
 
 		if(t_plane <= t_min){
@@ -516,6 +755,92 @@ Intersection::intersectTree(Ray ray, const VoxelKDTree::TreeData* tree,
 }
 
 
+RayIntersection 
+Intersection::intersectTreeStackless(Ray ray, const VoxelKDTree::TreeData* tree, 
+	const ChunkTable* table_ptr){
+	/*
+	Walks from leaf to leaf using the ropes from VoxelKDTree::generateRopes
+	instead of keeping a stack of far children. After leaving a leaf through
+	a face, the ray follows that face's rope and descends from the node it
+	points at to the leaf holding the exit point. Split planes the point 
+	lies exactly on are resolved with the ray direction. Leaves are handled
+	the same way as intersectTree.
+
+	NOTE: Assumes normalized ray
+	NOTE: Requires a tree with ropes.
+	*/
+
+	assert(tree->has_ropes);
+
+	RayIntersection hit_state = {INTERSECT_MISS};
+	DetailedCuboidIntersection bounds_hit = intersectColliderDetailed(ray, tree->bounds);
+	if(!bounds_hit.is_valid || bounds_hit.t_bounds[INDEX_VALUE_MAX] < 0){
+		return hit_state;
+	}
+
+	FVec3 local_origin = ray.origin - toFloatVector(tree->bounds.origin);
+	FVec3 inverse_dir = {1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z};
+
+	float t_min = std::max(bounds_hit.t_bounds[INDEX_VALUE_MIN], 0.0f);
+	Axis entry_axis = bounds_hit.last_min_axis;
+
+	VoxelKDTree::NodeIndex curr_node_index = 0;
+	while(true){
+		// Descend to the leaf containing the current point
+		FVec3 point = local_origin + ray.dir * t_min;
+		VoxelKDTree::NodeView curr_node = VoxelKDTree::nodeView(tree, curr_node_index);
+		while(VoxelKDTree::nodeType(curr_node.pack) != VoxelKDTree::NODE_LEAF){
+			Axis plane_axis = (Axis) VoxelKDTree::nodeType(curr_node.pack);
+			float plane_offset = VoxelKDTree::planeOffset(curr_node.pack);
+			bool is_far = 
+				point[plane_axis] > plane_offset || 
+				(point[plane_axis] == plane_offset && ray.dir[plane_axis] >= 0);
+			curr_node_index = curr_node.left_child_index + is_far;
+			curr_node = VoxelKDTree::nodeView(tree, curr_node_index);
+		}
+		VoxelKDTree::PackedData curr_data = curr_node.pack;
+
+		// Find where the ray leaves this leaf
+		const VoxelKDTree::RopeNode& rope_node = tree->rope_nodes_ptr[curr_node_index];
+		float t_max = LARGE_FLOAT;
+		Axis exit_axis = AXIS_X;
+		for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+			if(ray.dir[axis] == 0){
+				continue;
+			}
+			float face_offset = (ray.dir[axis] < 0) ? 
+				rope_node.min_corner[axis] : rope_node.max_corner[axis];
+			float t_face = (face_offset - local_origin[axis]) * inverse_dir[axis];
+			if(t_face < t_max){
+				t_max = t_face;
+				exit_axis = (Axis) axis;
+			}
+		}
+		t_max = std::max(t_max, t_min);
+
+		if(!(curr_data & VoxelKDTree::FLAG_LEAF_IS_EMPTY)){
+			bool is_fully_confirmed = VoxelKDTree::isHomogenousLeaf(curr_data);
+			if(is_fully_confirmed || table_ptr == NULL){
+				return unresolvedLeafHit(ray, curr_data, t_min, t_max, entry_axis);
+			}
+
+			RayIntersection leaf_hit = Utils::intersectVoxelsInSegment(
+				ray, t_min, t_max, entry_axis, table_ptr);
+			if(leaf_hit.type == INTERSECT_HIT_CHUNK_VOXEL){
+				return leaf_hit;
+			}
+		}
+
+		int exit_face = exit_axis * 2 + (ray.dir[exit_axis] < 0);
+		curr_node_index = rope_node.ropes[exit_face];
+		if(curr_node_index == VoxelKDTree::INVALID_NODE_INDEX){
+			return hit_state;
+		}
+		t_min = t_max;
+		entry_axis = exit_axis;
+	}
+}
+
 RayIntersection Intersection::intersectTriangle(Ray ray, const Triangle& triangle){
 	/*
 	ATTRIBUTION: Möller–Trumbore ray-triangle intersection algorithm example code:
@@ -560,32 +885,547 @@ RayIntersection Intersection::intersectTriangle(Ray ray, const Triangle& triangl
 	bool is_valid = t > 0.0f;
 	intersection.type = is_valid ? INTERSECT_HIT_TRIANGLE_MESH : INTERSECT_MISS;
 	intersection.t_hit = t;
-	intersection.unaligned_hit.normal = h.normal();
+	intersection.unaligned_hit.normal = edge1.cross(edge2).normal();
 	intersection.unaligned_hit.triangle_index = -1;
+	intersection.unaligned_hit.instance_index = -1;
 	return intersection;
 }
 
 RayIntersection Intersection::intersectTree(Ray ray, const MeshKDTree::TreeData* tree){
+	return intersectTree(ray, tree, LARGE_FLOAT);
+}
+
+RayIntersection Intersection::intersectTree(Ray ray, const MeshKDTree::TreeData* tree, 
+	float t_max){
 	/*
-	Father forgive me, for I have sinned.
+	Tests every leaf's triangle blocks and keeps the nearest hit. Each block
+	only reports hits closer than the best so far, so no per-triangle
+	comparison happens out here. Hits at or beyond t_max are ignored.
 
 	TODO: An actual tree traversal and not linear search.
 	*/
 
+	RayIntersection best_hit{INTERSECT_MISS};
+	best_hit.t_hit = t_max;
+	
+	const MeshKDTree::TriangleBlock* best_block = NULL;
+	Int32 best_lane = -1;
+	for(const MeshKDTree::LeafNode& leaf : tree->leaf_nodes){
+		Int32 block_end = leaf.block_range.origin + leaf.block_range.extent;
+		for(Int32 i = leaf.block_range.origin; i < block_end; ++i){
+			const MeshKDTree::TriangleBlock& block = tree->triangle_blocks[i];
+			TriangleBlockHit block_hit = intersectTriangleBlock(
+				ray, block, best_hit.t_hit);
+			if(block_hit.lane != -1){
+				best_hit.t_hit = block_hit.t_hit;
+				best_block = &block;
+				best_lane = block_hit.lane;
+			}
+		}
+	}
+
+	if(best_block != NULL){
+		FVec3 edge1 = {
+			best_block->edge1[0][best_lane],
+			best_block->edge1[1][best_lane],
+			best_block->edge1[2][best_lane],
+		};
+		FVec3 edge2 = {
+			best_block->edge2[0][best_lane],
+			best_block->edge2[1][best_lane],
+			best_block->edge2[2][best_lane],
+		};
+		best_hit.type = INTERSECT_HIT_TRIANGLE_MESH;
+		best_hit.unaligned_hit.normal = edge1.cross(edge2).normal();
+		best_hit.unaligned_hit.triangle_index = 
+			best_block->triangle_index[best_lane];
+		best_hit.unaligned_hit.instance_index = -1;
+	}
+
+	return best_hit;
+}
+
+RayIntersection Intersection::intersectTree(Ray ray, const EntityBVH::TreeData* tree){
+	/*
+	Nearest hit against all entity instances. Nodes are visited near child
+	first and skipped entirely once their bounds start beyond the best hit.
+	Each instance transforms the ray into mesh space and defers to the 
+	bottom-level mesh tree.
+	*/
+
 	RayIntersection best_hit{INTERSECT_MISS};
 	best_hit.t_hit = LARGE_FLOAT;
-	for(Uint64 i = 0; i < tree->intersect_data.size(); ++i){
-		const Triangle& triangle = tree->intersect_data[i];
-		RayIntersection triangle_hit = intersectTriangle(ray, triangle);
-		if(isValid(triangle_hit) && triangle_hit.t_hit < best_hit.t_hit){
-			best_hit = triangle_hit;
-			best_hit.unaligned_hit.triangle_index = i;
+	if(tree->nodes.empty()){
+		return best_hit;
+	}
+
+	struct StackEntry{
+		EntityBVH::NodeIndex node_index;
+		float t_enter;
+	};
+
+	StackEntry stack[EntityBVH::MAX_TREE_DEPTH];
+	Int32 height = 0;
+
+	auto root_hit = intersectColliderDetailed(ray, tree->nodes[0].bounds);
+	if(!root_hit.is_valid || root_hit.t_bounds[INDEX_VALUE_MAX] < 0){
+		return best_hit;
+	}
+	stack[height++] = {0, root_hit.t_bounds[INDEX_VALUE_MIN]};
+
+	while(height > 0){
+		StackEntry entry = stack[--height];
+		if(entry.t_enter >= best_hit.t_hit){
+			continue;
+		}
+
+		const EntityBVH::Node& node = tree->nodes[entry.node_index];
+		if(node.left_child_index == EntityBVH::INVALID_NODE_INDEX){
+			const EntityBVH::Instance& instance = tree->instances[node.instance_index];
+			Ray local_ray = EntityBVH::toInstanceSpace(instance, ray);
+			RayIntersection hit = intersectTree(local_ray, instance.mesh_tree, best_hit.t_hit);
+			if(hit.type == INTERSECT_HIT_TRIANGLE_MESH){
+				best_hit = hit;
+				best_hit.unaligned_hit.normal = EntityBVH::normalToWorldSpace(
+					instance, hit.unaligned_hit.normal);
+				best_hit.unaligned_hit.instance_index = node.instance_index;
+			}
+			continue;
+		}
+
+		// Push the far child first so the near one is popped next
+		StackEntry children[2];
+		Int32 num_children = 0;
+		for(Int32 i = 0; i < 2; ++i){
+			EntityBVH::NodeIndex child_index = node.left_child_index + i;
+			auto child_hit = intersectColliderDetailed(ray, tree->nodes[child_index].bounds);
+			bool is_candidate = 
+				child_hit.is_valid && 
+				child_hit.t_bounds[INDEX_VALUE_MAX] >= 0 &&
+				child_hit.t_bounds[INDEX_VALUE_MIN] < best_hit.t_hit;
+			if(is_candidate){
+				children[num_children++] = {child_index, child_hit.t_bounds[INDEX_VALUE_MIN]};
+			}
+		}
+
+		if(num_children == 2 && children[0].t_enter < children[1].t_enter){
+			StackEntry temp = children[0];
+			children[0] = children[1];
+			children[1] = temp;
+		}
+		for(Int32 i = 0; i < num_children; ++i){
+			assert(height < EntityBVH::MAX_TREE_DEPTH);
+			stack[height++] = children[i];
 		}
 	}
 
 	return best_hit;
 }
 
+//-------------------------------------------------------------------------------------------------
+// Occlusion queries
+//-------------------------------------------------------------------------------------------------
+bool Intersection::occluded(Ray ray, float t_max, const ChunkTable* table_ptr){
+	/*
+	Same walk as intersectChunks, cut off at t_max. A solid voxel 
+	containing the origin counts.
+	*/
+
+	RayIntersection hit = intersectChunks(ray, table_ptr, t_max);
+	return hit.type == INTERSECT_HIT_CHUNK_VOXEL && hit.t_hit <= t_max;
+}
+
+bool Intersection::occluded(Ray ray, float t_max, const VoxelKDTree::TreeData* tree,
+	const ChunkTable* table_ptr){
+	
+	Intersection::Utils::VKDTStack stack = Intersection::Utils::VKDTStack::init(
+		tree->curr_max_depth);
+	bool is_occluded = occluded(ray, t_max, tree, stack, table_ptr);
+	stack.freeMemory();
+	return is_occluded;
+}
+
+bool Intersection::occluded(Ray ray, float t_max, const VoxelKDTree::TreeData* tree,
+	Utils::VKDTStack stack, const ChunkTable* table_ptr){
+	/*
+	Same traversal as intersectTree, with the ray clipped to t_max up front
+	so nodes beyond it are never visited. Any solid leaf ends the query,
+	whatever its type. Leaves that only might contain solid voxels are 
+	walked through the table, so they only occlude if the ray actually 
+	hits one of their voxels.
+	*/
+
+	assert(table_ptr != NULL);
+
+	DetailedCuboidIntersection bounds_hit = intersectColliderDetailed(ray, tree->bounds);
+	if(!bounds_hit.is_valid){
+		return false;
+	}
+
+	float t_min = std::max(bounds_hit.t_bounds[INDEX_VALUE_MIN], 0.0f);
+	t_max = std::min(bounds_hit.t_bounds[INDEX_VALUE_MAX], t_max);
+	if(t_max <= t_min){
+		return false;
+	}
+
+	FVec3 tree_world_offset = toFloatVector(tree->bounds.origin);
+	FVec3 local_origin = ray.origin - tree_world_offset;
+	FVec3 inverse_dir = {1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z};
+
+	VoxelKDTree::NodeIndex curr_node_index = 0;
+	Axis last_min_axis = bounds_hit.last_min_axis;
+	bool is_backtrack_required = false;
+	while(!is_backtrack_required || stack.height > 0){
+		if(is_backtrack_required){
+			is_backtrack_required = false;
+			Utils::VKDTTraversalNode stack_top = stack.pop();
+			curr_node_index = stack_top.curr_node_index;
+			t_min = stack_top.t_min;
+			t_max = stack_top.t_max;
+			last_min_axis = stack_top.axis;
+		}
+
+		VoxelKDTree::NodeView curr_node = VoxelKDTree::nodeView(tree, curr_node_index);
+		VoxelKDTree::PackedData curr_data = curr_node.pack;
+		Bytes2 curr_type = VoxelKDTree::nodeType(curr_data);
+		if(curr_type == VoxelKDTree::VALUE_LEAF_NODE){
+			if(curr_data & VoxelKDTree::FLAG_LEAF_IS_EMPTY){
+				is_backtrack_required = true;
+				continue;
+			}
+
+			bool is_definitely_solid = 
+				VoxelKDTree::isHomogenousLeaf(curr_data) ||
+				curr_data == VoxelKDTree::VALUE_SOLID_MIXED_LEAF;
+			if(is_definitely_solid){
+				return true;
+			}
+			RayIntersection leaf_hit = Utils::intersectVoxelsInSegment(
+				ray, t_min, t_max, last_min_axis, table_ptr);
+			if(leaf_hit.type == INTERSECT_HIT_CHUNK_VOXEL){
+				return true;
+			}
+
+			is_backtrack_required = true;
+			continue;
+		}
+
+		Axis plane_axis = (Axis) curr_type;
+		Uint16 plane_offset = VoxelKDTree::planeOffset(curr_data);
+		VoxelKDTree::NodeIndex child_base_index = curr_node.left_child_index;
+
+		float t_plane = (plane_offset - local_origin[plane_axis]) * inverse_dir[plane_axis];
+		if(ray.dir[plane_axis] == 0){
+			t_plane = (local_origin[plane_axis] >= plane_offset) ? -LARGE_FLOAT : LARGE_FLOAT;
+		}
+		bool should_flip = ray.dir[plane_axis] < 0;
+		if(t_plane <= t_min){
+			curr_node_index = child_base_index + !should_flip;
+			continue;
+		}
+		if(t_plane >= t_max){
+			curr_node_index = child_base_index + should_flip;
+			continue;
+		}
+
+		Utils::VKDTTraversalNode far_info = {
+			.curr_node_index=child_base_index+!should_flip,
+			.t_min=t_plane,
+			.t_max=t_max,
+			.axis=plane_axis,
+		};
+		stack.push(far_info);
+		curr_node_index = child_base_index + should_flip;
+		t_max = t_plane;
+	}
+
+	return false;
+}
+
+bool Intersection::occluded(Ray ray, float t_max, const MeshKDTree::TreeData* tree){
+	/*
+	Returns on the first triangle block with any hit before t_max.
+	*/
+
+	for(const MeshKDTree::LeafNode& leaf : tree->leaf_nodes){
+		Int32 block_end = leaf.block_range.origin + leaf.block_range.extent;
+		for(Int32 i = leaf.block_range.origin; i < block_end; ++i){
+			TriangleBlockHit block_hit = intersectTriangleBlock(
+				ray, tree->triangle_blocks[i], t_max);
+			if(block_hit.lane != -1){
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool Intersection::occluded(Ray ray, float t_max, const EntityBVH::TreeData* tree){
+	/*
+	Unordered traversal since any hit will do.
+	*/
+
+	if(tree->nodes.empty()){
+		return false;
+	}
+
+	EntityBVH::NodeIndex stack[EntityBVH::MAX_TREE_DEPTH];
+	Int32 height = 0;
+	stack[height++] = 0;
+	while(height > 0){
+		const EntityBVH::Node& node = tree->nodes[stack[--height]];
+		if(!occluded(ray, t_max, node.bounds)){
+			continue;
+		}
+
+		if(node.left_child_index == EntityBVH::INVALID_NODE_INDEX){
+			const EntityBVH::Instance& instance = tree->instances[node.instance_index];
+			Ray local_ray = EntityBVH::toInstanceSpace(instance, ray);
+			if(occluded(local_ray, t_max, instance.mesh_tree)){
+				return true;
+			}
+			continue;
+		}
+
+		assert(height + 2 <= EntityBVH::MAX_TREE_DEPTH);
+		stack[height++] = node.left_child_index + 1;
+		stack[height++] = node.left_child_index;
+	}
+	return false;
+}
+
+bool Intersection::occluded(Ray ray, float t_max, const ICuboid& cuboid){
+	DetailedCuboidIntersection hit = intersectColliderDetailed(ray, cuboid);
+	return 
+		hit.is_valid && 
+		hit.t_bounds[INDEX_VALUE_MAX] >= 0 && 
+		hit.t_bounds[INDEX_VALUE_MIN] <= t_max;
+}
+
+bool Intersection::occluded(Ray ray, float t_max, const FCuboid& cuboid){
+	DetailedCuboidIntersection hit = intersectColliderDetailed(ray, cuboid);
+	return 
+		hit.is_valid && 
+		hit.t_bounds[INDEX_VALUE_MAX] >= 0 && 
+		hit.t_bounds[INDEX_VALUE_MIN] <= t_max;
+}
+
+bool Intersection::occluded(Ray ray, float t_max, const FSphere& sphere){
+	/*
+	NOTE: Rays starting inside the sphere aren't occluded by it.
+	*/
+
+	DetailedSphereIntersection hit = intersectColliderDetailed(ray, sphere);
+	return hit.is_valid && hit.t_bounds[INDEX_VALUE_MIN] <= t_max;
+}
+
+#if defined(__AVX__)
+Intersection::TriangleBlockHit Intersection::intersectTriangleBlock(Ray ray, 
+	const MeshKDTree::TriangleBlock& block, float t_max){
+	/*
+	8-wide Moller-Trumbore. Same math as intersectTriangle, but every lane
+	is computed unconditionally and the early-outs become a validity mask.
+	Invalid lanes are replaced with t_max before the min reduction.
+	*/
+
+	static_assert(MeshKDTree::TRIANGLE_BLOCK_WIDTH == 8);
+
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 epsilon = _mm256_set1_ps(ARBITRARY_EPSILON);
+	const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+	const __m256 t_limit = _mm256_set1_ps(t_max);
+
+	__m256 dir_x = _mm256_set1_ps(ray.dir.x);
+	__m256 dir_y = _mm256_set1_ps(ray.dir.y);
+	__m256 dir_z = _mm256_set1_ps(ray.dir.z);
+
+	__m256 e1_x = _mm256_load_ps(block.edge1[0]);
+	__m256 e1_y = _mm256_load_ps(block.edge1[1]);
+	__m256 e1_z = _mm256_load_ps(block.edge1[2]);
+	__m256 e2_x = _mm256_load_ps(block.edge2[0]);
+	__m256 e2_y = _mm256_load_ps(block.edge2[1]);
+	__m256 e2_z = _mm256_load_ps(block.edge2[2]);
+
+	// h = dir x edge2
+	__m256 h_x = _mm256_sub_ps(_mm256_mul_ps(dir_y, e2_z), _mm256_mul_ps(dir_z, e2_y));
+	__m256 h_y = _mm256_sub_ps(_mm256_mul_ps(dir_z, e2_x), _mm256_mul_ps(dir_x, e2_z));
+	__m256 h_z = _mm256_sub_ps(_mm256_mul_ps(dir_x, e2_y), _mm256_mul_ps(dir_y, e2_x));
+	__m256 a = _mm256_add_ps(_mm256_add_ps(
+		_mm256_mul_ps(e1_x, h_x), _mm256_mul_ps(e1_y, h_y)), _mm256_mul_ps(e1_z, h_z));
+	__m256 mask = _mm256_cmp_ps(
+		_mm256_andnot_ps(sign_mask, a), epsilon, _CMP_GE_OQ);
+	__m256 f = _mm256_div_ps(one, a);
+
+	// s = origin - v0
+	__m256 s_x = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(block.v0[0]));
+	__m256 s_y = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(block.v0[1]));
+	__m256 s_z = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(block.v0[2]));
+	__m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(
+		_mm256_mul_ps(s_x, h_x), _mm256_mul_ps(s_y, h_y)), _mm256_mul_ps(s_z, h_z)));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+
+	// q = s x edge1
+	__m256 q_x = _mm256_sub_ps(_mm256_mul_ps(s_y, e1_z), _mm256_mul_ps(s_z, e1_y));
+	__m256 q_y = _mm256_sub_ps(_mm256_mul_ps(s_z, e1_x), _mm256_mul_ps(s_x, e1_z));
+	__m256 q_z = _mm256_sub_ps(_mm256_mul_ps(s_x, e1_y), _mm256_mul_ps(s_y, e1_x));
+	__m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(
+		_mm256_mul_ps(dir_x, q_x), _mm256_mul_ps(dir_y, q_y)), _mm256_mul_ps(dir_z, q_z)));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+
+	__m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(
+		_mm256_mul_ps(e2_x, q_x), _mm256_mul_ps(e2_y, q_y)), _mm256_mul_ps(e2_z, q_z)));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, t_limit, _CMP_LT_OQ));
+
+	TriangleBlockHit block_hit = {t_max, -1};
+	int valid_lanes = _mm256_movemask_ps(mask);
+	if(valid_lanes == 0){
+		return block_hit;
+	}
+
+	// Horizontal min of the masked t values
+	__m256 masked_t = _mm256_blendv_ps(t_limit, t, mask);
+	__m256 reduced = _mm256_min_ps(masked_t, _mm256_permute2f128_ps(masked_t, masked_t, 1));
+	reduced = _mm256_min_ps(reduced, _mm256_shuffle_ps(reduced, reduced, 0b01'00'11'10));
+	reduced = _mm256_min_ps(reduced, _mm256_shuffle_ps(reduced, reduced, 0b10'11'00'01));
+	int nearest_lanes = valid_lanes & _mm256_movemask_ps(
+		_mm256_cmp_ps(masked_t, reduced, _CMP_EQ_OQ));
+
+	block_hit.t_hit = _mm256_cvtss_f32(reduced);
+	block_hit.lane = __builtin_ctz(nearest_lanes);
+	return block_hit;
+}
+#elif defined(__SSE2__)
+Intersection::TriangleBlockHit Intersection::intersectTriangleBlock(Ray ray, 
+	const MeshKDTree::TriangleBlock& block, float t_max){
+	/*
+	SSE version of the block test. The block is processed as two groups of
+	4 lanes, with the running minimum shared between them.
+	*/
+
+	static_assert(MeshKDTree::TRIANGLE_BLOCK_WIDTH % 4 == 0);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 epsilon = _mm_set1_ps(ARBITRARY_EPSILON);
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+
+	__m128 dir_x = _mm_set1_ps(ray.dir.x);
+	__m128 dir_y = _mm_set1_ps(ray.dir.y);
+	__m128 dir_z = _mm_set1_ps(ray.dir.z);
+	__m128 origin_x = _mm_set1_ps(ray.origin.x);
+	__m128 origin_y = _mm_set1_ps(ray.origin.y);
+	__m128 origin_z = _mm_set1_ps(ray.origin.z);
+
+	TriangleBlockHit block_hit = {t_max, -1};
+	for(int lane_offset = 0; lane_offset < MeshKDTree::TRIANGLE_BLOCK_WIDTH; 
+		lane_offset += 4){
+		
+		const __m128 t_limit = _mm_set1_ps(block_hit.t_hit);
+
+		__m128 e1_x = _mm_load_ps(block.edge1[0] + lane_offset);
+		__m128 e1_y = _mm_load_ps(block.edge1[1] + lane_offset);
+		__m128 e1_z = _mm_load_ps(block.edge1[2] + lane_offset);
+		__m128 e2_x = _mm_load_ps(block.edge2[0] + lane_offset);
+		__m128 e2_y = _mm_load_ps(block.edge2[1] + lane_offset);
+		__m128 e2_z = _mm_load_ps(block.edge2[2] + lane_offset);
+
+		// h = dir x edge2
+		__m128 h_x = _mm_sub_ps(_mm_mul_ps(dir_y, e2_z), _mm_mul_ps(dir_z, e2_y));
+		__m128 h_y = _mm_sub_ps(_mm_mul_ps(dir_z, e2_x), _mm_mul_ps(dir_x, e2_z));
+		__m128 h_z = _mm_sub_ps(_mm_mul_ps(dir_x, e2_y), _mm_mul_ps(dir_y, e2_x));
+		__m128 a = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(e1_x, h_x), _mm_mul_ps(e1_y, h_y)), _mm_mul_ps(e1_z, h_z));
+		__m128 mask = _mm_cmpge_ps(_mm_andnot_ps(sign_mask, a), epsilon);
+		__m128 f = _mm_div_ps(one, a);
+
+		// s = origin - v0
+		__m128 s_x = _mm_sub_ps(origin_x, _mm_load_ps(block.v0[0] + lane_offset));
+		__m128 s_y = _mm_sub_ps(origin_y, _mm_load_ps(block.v0[1] + lane_offset));
+		__m128 s_z = _mm_sub_ps(origin_z, _mm_load_ps(block.v0[2] + lane_offset));
+		__m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(s_x, h_x), _mm_mul_ps(s_y, h_y)), _mm_mul_ps(s_z, h_z)));
+		mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+		mask = _mm_and_ps(mask, _mm_cmple_ps(u, one));
+
+		// q = s x edge1
+		__m128 q_x = _mm_sub_ps(_mm_mul_ps(s_y, e1_z), _mm_mul_ps(s_z, e1_y));
+		__m128 q_y = _mm_sub_ps(_mm_mul_ps(s_z, e1_x), _mm_mul_ps(s_x, e1_z));
+		__m128 q_z = _mm_sub_ps(_mm_mul_ps(s_x, e1_y), _mm_mul_ps(s_y, e1_x));
+		__m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(dir_x, q_x), _mm_mul_ps(dir_y, q_y)), _mm_mul_ps(dir_z, q_z)));
+		mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+		mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+
+		__m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(e2_x, q_x), _mm_mul_ps(e2_y, q_y)), _mm_mul_ps(e2_z, q_z)));
+		mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+		mask = _mm_and_ps(mask, _mm_cmplt_ps(t, t_limit));
+
+		int valid_lanes = _mm_movemask_ps(mask);
+		if(valid_lanes == 0){
+			continue;
+		}
+
+		// Horizontal min of the masked t values. SSE2 has no blend.
+		__m128 masked_t = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, t_limit));
+		__m128 reduced = _mm_min_ps(masked_t, _mm_shuffle_ps(masked_t, masked_t, 0b01'00'11'10));
+		reduced = _mm_min_ps(reduced, _mm_shuffle_ps(reduced, reduced, 0b10'11'00'01));
+		int nearest_lanes = valid_lanes & _mm_movemask_ps(_mm_cmpeq_ps(masked_t, reduced));
+
+		block_hit.t_hit = _mm_cvtss_f32(reduced);
+		block_hit.lane = lane_offset + __builtin_ctz(nearest_lanes);
+	}
+
+	return block_hit;
+}
+#else
+Intersection::TriangleBlockHit Intersection::intersectTriangleBlock(Ray ray, 
+	const MeshKDTree::TriangleBlock& block, float t_max){
+	/*
+	Scalar fallback for targets without SSE. Mirrors the SIMD versions lane
+	by lane so that all three produce the same results.
+	*/
+
+	TriangleBlockHit block_hit = {t_max, -1};
+	for(int lane = 0; lane < MeshKDTree::TRIANGLE_BLOCK_WIDTH; ++lane){
+		FVec3 v0 = {block.v0[0][lane], block.v0[1][lane], block.v0[2][lane]};
+		FVec3 edge1 = {block.edge1[0][lane], block.edge1[1][lane], block.edge1[2][lane]};
+		FVec3 edge2 = {block.edge2[0][lane], block.edge2[1][lane], block.edge2[2][lane]};
+
+		FVec3 h = ray.dir.cross(edge2);
+		float a = edge1.dot(h);
+		if(abs(a) < ARBITRARY_EPSILON){
+			continue;
+		}
+
+		float f = 1.0f / a;
+		FVec3 s = ray.origin - v0;
+		float u = f * s.dot(h);
+		if(u < 0.0f || u > 1.0f){
+			continue;
+		}
+
+		FVec3 q = s.cross(edge1);
+		float v = f * ray.dir.dot(q);
+		if(v < 0.0f || u + v > 1.0f){
+			continue;
+		}
+
+		float t = f * edge2.dot(q);
+		if(t > 0.0f && t < block_hit.t_hit){
+			block_hit.t_hit = t;
+			block_hit.lane = lane;
+		}
+	}
+
+	return block_hit;
+}
+#endif
+
 RayIntersection Intersection::intersectCollider(Ray ray, const ICuboid& cuboid){
 	/*
 	ATTRIBUTION: Code structure
@@ -719,6 +1559,50 @@ Intersection::intersectColliderDetailed(Ray ray, const ICuboid& cuboid){
 	return result;
 }
 
+Intersection::DetailedCuboidIntersection 
+Intersection::intersectColliderDetailed(Ray ray, const FCuboid& cuboid){
+	/*
+	Same as the ICuboid version, for boxes that aren't grid aligned.
+	*/
+	
+	float t_min = -LARGE_FLOAT;
+	float t_max = LARGE_FLOAT;
+	float tmin_old;
+	bool is_valid = true;
+
+	Axis last_min_axis = AXIS_X;
+
+	FVec3 max_bounds = cuboid.origin + cuboid.extent;
+	for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+		float inverse_dir = 1.0f / ray.dir[axis];
+		float t0 = (cuboid.origin[axis] - ray.origin[axis]) * inverse_dir;
+		float t1 = (max_bounds[axis] - ray.origin[axis]) * inverse_dir;
+		if(inverse_dir < 0.0f){
+			float temp = t1;
+			t1 = t0;
+			t0 = temp;
+		}
+
+		tmin_old = t_min;
+		t_min = t0 > t_min ? t0 : t_min;
+		t_max = t1 < t_max ? t1 : t_max;
+		if(t_min > tmin_old){
+			last_min_axis = (Axis)axis;
+		}
+		if(t_max <= t_min){
+			is_valid = false;
+			break;
+		}
+	}
+
+	DetailedCuboidIntersection result;
+	result.t_bounds[INDEX_VALUE_MIN] = t_min;
+	result.t_bounds[INDEX_VALUE_MAX] = t_max;
+	result.is_valid = is_valid;
+	result.last_min_axis = last_min_axis;
+	return result;
+}
+
 Intersection::DetailedSphereIntersection 
 Intersection::intersectColliderDetailed(Ray ray, const FSphere& sphere){
 	/*
@@ -4,6 +4,7 @@
 #include "Primitives.hpp"
 #include "Geometry.hpp"  // Ray is defined here
 #include "KDTree.hpp"
+#include "EntityBVH.hpp"
 #include "Debug.hpp"
 #include "Camera.hpp"
 #include "MathUtils.hpp"
@@ -58,6 +59,7 @@ struct RayIntersection{
 		struct{
 			FVec3 normal;
 			Int32 triangle_index;  // Only defined for triangle meshes
+			Int32 instance_index;  // -1 unless the mesh was an entity instance
 		} unaligned_hit;
 
 		// For hits with voxel geometry or voxel acceleration structures
@@ -124,6 +126,7 @@ namespace Rendering{
 
 	std::vector<ImageTile> tiles(Camera camera, ImageConfig config);
 	std::vector<Ray> allRays(Camera camera, ImageConfig config);
+	float pixelConeSpread(Camera camera, IVec2 image_dims);
 };
 
 namespace Intersection{
@@ -143,13 +146,16 @@ namespace Intersection{
 			// Updated values
 			IVec3 local_grid_coord;
 			FVec3 t_next_crossing;
+			float t_curr;  // Where the ray entered the current voxel
 			int last_stepped_axis;
 			bool is_hit;
 			VoxelType hit_voxel_type;
 		};
 
-		GridRay localChunkIntersection(GridRay grid_ray, const RawVoxelChunk& chunk);
+		GridRay localChunkIntersection(GridRay grid_ray, const ChunkTable::ChunkView& chunk);
 		GridRay traverseEmptyChunk(GridRay grid_ray, Debug::DebugData& data);
+		RayIntersection intersectVoxelsInSegment(Ray ray, float t_min, float t_max,
+			Axis entry_axis, const ChunkTable* table_ptr);
 	
 		struct VKDTTraversalNode{
 			/*
@@ -199,12 +205,47 @@ namespace Intersection{
 	};
 
 	RayIntersection intersectChunks(Ray ray, const ChunkTable* table_ptr);
+	RayIntersection intersectChunks(Ray ray, const ChunkTable* table_ptr, float t_max);
 	RayIntersection intersectTree(Ray ray, const VoxelKDTree::TreeData* tree);
 	RayIntersection intersectTree(Ray ray, const VoxelKDTree::TreeData* tree, 
 		Utils::VKDTStack stack);
+	RayIntersection intersectTree(Ray ray, const VoxelKDTree::TreeData* tree, 
+		Utils::VKDTStack stack, const ChunkTable* table_ptr, float cone_spread=0,
+		float cone_width=0);
+	RayIntersection intersectTreeStackless(Ray ray, const VoxelKDTree::TreeData* tree, 
+		const ChunkTable* table_ptr);
 	
 	RayIntersection intersectTriangle(Ray ray, const Triangle& triangle);
 	RayIntersection intersectTree(Ray ray, const MeshKDTree::TreeData* tree);
+	RayIntersection intersectTree(Ray ray, const MeshKDTree::TreeData* tree, 
+		float t_max);
+	RayIntersection intersectTree(Ray ray, const EntityBVH::TreeData* tree);
+
+	// Any-hit queries. These stop at the first solid voxel or primitive that's
+	// closer than t_max, and skip resolving the exact t, normal and material.
+	bool occluded(Ray ray, float t_max, const ChunkTable* table_ptr);
+	bool occluded(Ray ray, float t_max, const VoxelKDTree::TreeData* tree,
+		const ChunkTable* table_ptr);
+	bool occluded(Ray ray, float t_max, const VoxelKDTree::TreeData* tree,
+		Utils::VKDTStack stack, const ChunkTable* table_ptr);
+	bool occluded(Ray ray, float t_max, const MeshKDTree::TreeData* tree);
+	bool occluded(Ray ray, float t_max, const EntityBVH::TreeData* tree);
+	bool occluded(Ray ray, float t_max, const ICuboid& cuboid);
+	bool occluded(Ray ray, float t_max, const FCuboid& cuboid);
+	bool occluded(Ray ray, float t_max, const FSphere& sphere);
+
+	struct TriangleBlockHit{
+		/*
+		Nearest hit within a MeshKDTree::TriangleBlock. The lane is -1 if
+		no triangle in the block was hit closer than the provided t_max.
+		*/
+
+		float t_hit;
+		Int32 lane;
+	};
+
+	TriangleBlockHit intersectTriangleBlock(Ray ray, 
+		const MeshKDTree::TriangleBlock& block, float t_max);
 
 	RayIntersection intersectCollider(Ray ray, const ICuboid& cuboid);
 	RayIntersection intersectCollider(Ray ray, const FSphere& sphere);
@@ -227,6 +268,8 @@ namespace Intersection{
 
 	DetailedCuboidIntersection intersectColliderDetailed(
 		Ray ray, const ICuboid& cuboid);
+	DetailedCuboidIntersection intersectColliderDetailed(
+		Ray ray, const FCuboid& cuboid);
 
 	struct DetailedSphereIntersection{
 		float t_bounds[2];
@@ -91,6 +91,7 @@ OpenGLModule::OpenGLModule(): m_work_group(NUM_RENDERER_WORKERS){
 	m_rigid_triangle_mesh_shader = std::unique_ptr<BaseShader>(new RigidTriangleMeshShader);
 
 	m_render_widgets = true;
+	m_seen_chunk_version = 0;
 
 	constexpr bool BACKFACE_CULLING_IS_ENABLED = true;
 	if(BACKFACE_CULLING_IS_ENABLED){
@@ -173,13 +174,19 @@ void OpenGLModule::processStoredInstructions(const SimCache& state){
 
 			if(instruction.type == CHUNK_GENERATE_UNLIT_MESH){	
 				if(instruction.leniency == IMMEDIATE_ACTION_REQUIRED){
-					// Everything must wait until this is done.
+					// Everything must wait until this is done. Chunks that 
+					// aren't loaded anymore are skipped, same as queued ones.
 					RawVoxelChunk chunk_data;
 					ChunkTable* table_ptr = &state.m_reference_world->m_chunk_table;
 					
-					table_ptr->m_access_mutex.lock();
-					chunk_data = *table_ptr->getChunkPtr(addr.corner_addr);
-					table_ptr->m_access_mutex.unlock();
+					{
+						ChunkTable::ReadGuard read_guard(*table_ptr);
+						const RawVoxelChunk* chunk_ptr = table_ptr->getChunkPtr(addr.corner_addr);
+						if(chunk_ptr == NULL){
+							continue;
+						}
+						chunk_data = *chunk_ptr;
+					}
 
 					MesherAdjacencyGrid adjacency_grid = generateAdjacencyGrid(chunk_data);
 					ChunkVoxelMesh voxel_mesh = generateChunkMesh(adjacency_grid, addr);
@@ -232,6 +239,7 @@ void OpenGLModule::render(const SimCache& state, const Camera& camera,
 	const ResourceManager* resource_manager = state.m_resource_manager;
 
 	this->processStoredInstructions(state);
+	this->queueChangedChunkMeshes(state);
 	this->scheduleChunkMeshing(state);
 
 	// Generate matrices
@@ -462,6 +470,22 @@ void OpenGLModule::scheduleChunkMeshing(const SimCache& state){
 				addresses_to_launch.push_back(job_addr);
 			}
 
+			// Read out copies of data all at once. Chunks evicted since they 
+			// were queued are dropped.
+			ChunkTable* table_ptr = &state.m_reference_world->m_chunk_table;
+			{
+				ChunkTable::ReadGuard read_guard(*table_ptr);
+				Uint64 num_loaded = 0;
+				for(const CellAddress& job_addr : addresses_to_launch){
+					const RawVoxelChunk* chunk_ptr = table_ptr->getChunkPtr(job_addr.corner_addr);
+					if(chunk_ptr != NULL){
+						addresses_to_launch[num_loaded++] = job_addr;
+						chunk_data_vector.push_back(*chunk_ptr);
+					}
+				}
+				addresses_to_launch.resize(num_loaded);
+			}
+
 			// Reserve space for each new job in the working mesh map
 			m_working_mesh_mutex.lock();
 			for(const CellAddress& job_addr : addresses_to_launch){
@@ -469,16 +493,6 @@ void OpenGLModule::scheduleChunkMeshing(const SimCache& state){
 			}
 			m_working_mesh_mutex.unlock();
 
-			// Lock the chunk table and read out copies of data all at once.
-			ChunkTable* table_ptr = &state.m_reference_world->m_chunk_table;
-			table_ptr->m_access_mutex.lock();
-			for(const CellAddress& job_addr : addresses_to_launch){
-				const RawVoxelChunk* chunk_ptr = table_ptr->getChunkPtr(job_addr.corner_addr);
-				assert(chunk_ptr != NULL);
-				chunk_data_vector.push_back(*chunk_ptr);
-			}
-			table_ptr->m_access_mutex.unlock();
-
 			// Now we're ready to launch. 
 			for(Uint64 i = 0; i < addresses_to_launch.size(); ++i){
 				ChunkMesherJobInput mesh_job = {
@@ -495,6 +509,59 @@ void OpenGLModule::scheduleChunkMeshing(const SimCache& state){
 	}
 }
 
+void OpenGLModule::queueChangedChunkMeshes(const SimCache& state){
+	/*
+	Re-meshes the meshed chunks that the chunk table changed since the last
+	call, and drops the meshes of erased ones. Unmeshed chunks are left to
+	the meshing instructions. If the table's journal already dropped some
+	changes, every meshed chunk is treated as changed. Evicted chunks keep
+	their meshes, so residency only changes are skipped.
+
+	NOTE: A chunk's mesh only depends on its own voxels, so the dirty box
+		doesn't matter yet. Once meshes look at their neighbors, edits 
+		touching a face need to re-mesh the neighbor across it too.
+	*/
+
+	constexpr Leniency ARBITRARY_REMESH_LENIENCY = 1;
+
+	const ChunkTable& table = state.m_reference_world->m_chunk_table;
+	if(table.currentVersion() == m_seen_chunk_version){
+		return;
+	}
+
+	ChunkTable::ChangeList change_list = table.changesSince(m_seen_chunk_version);
+	m_seen_chunk_version = change_list.version;
+
+	// Only the latest change to each chunk matters
+	std::unordered_map<CellAddress, bool, PODHasher> is_erased_by_cell;
+	if(change_list.is_complete){
+		for(const ChunkTable::ChunkChange& change : change_list.changes){
+			if(change.is_residency_only){
+				continue;
+			}
+			CellAddress addr = {.corner_addr=change.coord, .lod_power=0};
+			is_erased_by_cell[addr] = change.is_erased;
+		}
+	}else{
+		for(CellAddress addr : m_tracked_cells){
+			is_erased_by_cell[addr] = !table.isLoaded(addr.corner_addr) 
+				&& !table.isEvicted(addr.corner_addr);
+		}
+	}
+
+	for(auto [addr, is_erased] : is_erased_by_cell){
+		if(m_tracked_cells.count(addr) == 0){
+			continue;
+		}
+
+		if(is_erased){
+			removeData(state, addr);
+		}else{
+			m_priority_queue.setLeniency(addr, ARBITRARY_REMESH_LENIENCY);
+		}
+	}
+}
+
 bool OpenGLModule::isMeshJobCurrentlyRunning(CellAddress addr, MeshType type){
 	/*
 	Returns true if a job of the given type is currently running for the provided cell address.
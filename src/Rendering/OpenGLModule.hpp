@@ -145,6 +145,7 @@ class OpenGLModule: public RenderingModule{
 		
 		// Chunk meshing
 		void scheduleChunkMeshing(const SimCache& state);
+		void queueChangedChunkMeshes(const SimCache& state);
 		bool isMeshJobCurrentlyRunning(CellAddress addr, MeshType type);
 		void handleChunkMeshRenderable(CellAddress addr, const ChunkVoxelMesh& mesh);
 		
@@ -165,6 +166,7 @@ class OpenGLModule: public RenderingModule{
 		JankPriorityQueue m_priority_queue;
 		std::mutex m_working_mesh_mutex;
 		std::unordered_map<CellAddress, ChunkVoxelMesh*, PODHasher> m_working_chunk_voxel_meshes;
+		Uint64 m_seen_chunk_version;  // Chunk table changes up to here are meshed
 
 		// Manages links between game resources and renderables
 		AssetManagerOpenGL m_asset_manager;
@@ -137,6 +137,8 @@ void Raytracer::renderImage(const SimCache& cache, Camera camera, RenderSettings
 		*/
 
 		Rendering::CameraRayGenerator ray_generator(camera, config.num_pixels);
+		float cone_spread = settings.lod_footprint_scale * 
+			Rendering::pixelConeSpread(camera, config.num_pixels);
 
 		// Save the values
 		job_template = {  
@@ -145,7 +147,8 @@ void Raytracer::renderImage(const SimCache& cache, Camera camera, RenderSettings
 				.simcache_ptr=&cache,
 				.settings=settings,
 				.pixel_buffer=(Image::PixelRGB*)m_scratch_image.dataPtr(),
-				.ray_generator=ray_generator
+				.ray_generator=ray_generator,
+				.cone_spread=cone_spread,
 
 				/*
 				// Ray positioning info
@@ -183,7 +186,7 @@ void Raytracer::renderImage(const SimCache& cache, Camera camera, RenderSettings
 	// over the preview image instead of a black background.
 	// TODO: Option to disable preview for headless renders
 	if(true){
-		renderPreview(cache, camera, config, false);	
+		renderPreview(cache, camera, settings, false);	
 	}else{
 		Uint64 num_image_bytes = config.tile_dims.x * config.tile_dims.y * sizeof(Image::PixelRGB);
 		memset(m_scratch_image.dataPtr(), 0, num_image_bytes);
@@ -252,7 +255,7 @@ void Raytracer::visualizePaths(const SimCache& cache, std::vector<Ray> rays){
 	Int32 num_rays = rays.size();
 	PathBuffer buffer = PathBuffer::init(ARBITRARY_MAX_PATH_LEN, num_rays, false);
 	buffer.result_count = num_rays;
-	tracePaths(&cache, rays, buffer, m_default_random);
+	tracePaths(&cache, rays, buffer, 0, m_default_random);
 
 	std::vector<Widget> widgets;
 	Int32 vertex_read_start = 0;
@@ -303,20 +306,22 @@ void Raytracer::visualizePaths(const SimCache& cache, std::vector<Ray> rays){
 	cache.m_reference_world->addWidgetData("RayWidgets", widgets, true);
 }
 
-void Raytracer::renderPreview(const SimCache& cache, Camera camera, Rendering::ImageConfig config){
+void Raytracer::renderPreview(const SimCache& cache, Camera camera, RenderSettings settings){
 	/*
 	Wrapper function to make calls to the renderPreview function easier to work with
 	*/
 
-	renderPreview(cache, camera, config, true);
+	renderPreview(cache, camera, settings, true);
 }
 
-void Raytracer::renderPreview(const SimCache& cache, Camera camera, Rendering::ImageConfig config, 
+void Raytracer::renderPreview(const SimCache& cache, Camera camera, RenderSettings settings, 
 	bool is_interactive){
 	/*
 	Renders a quick preview of the scene
 	*/
 
+	Rendering::ImageConfig& config = settings.image_config;
+
 	constexpr Int64 MAX_UINT_16 = 65535;
 	constexpr Int64 MAX_INT_32 = 1ULL << 31;
 	assert(config.num_pixels.x <= MAX_UINT_16);
@@ -329,7 +334,9 @@ void Raytracer::renderPreview(const SimCache& cache, Camera camera, Rendering::I
 	
 	float hit_extremes[] = {LARGE_FLOAT, -LARGE_FLOAT};
 	PathBuffer buffer = PathBuffer::init(1, num_rays, false);
-	tracePaths(&cache, image_rays, buffer, m_default_random);
+	float cone_spread = settings.lod_footprint_scale * 
+		Rendering::pixelConeSpread(camera, config.num_pixels);
+	tracePaths(&cache, image_rays, buffer, cone_spread, m_default_random);
 	buffer.result_count = num_rays;
 
 	for(Int32 i = 0; i < num_rays; ++i){
@@ -354,6 +361,7 @@ void Raytracer::renderPreview(const SimCache& cache, Camera camera, Rendering::I
 		bool is_hit = 
 			requiresLookup(ray_path.type) ||
 			(ray_path.type == INTERSECT_HIT_CHUNK_VOXEL) ||
+			(ray_path.type == INTERSECT_HIT_TRIANGLE_MESH) ||
 			(ray_path.type == INTERSECT_HIT_COLLIDER);
 		float depth = (ray_path.t_hit - hit_extremes[INDEX_VALUE_MIN]) / t_range;
 		
@@ -453,7 +461,8 @@ void Raytracer::runTileJob(TileJob job){
 		}
 
 		// Trace the paths
-		tracePaths(job.image_info.simcache_ptr, ray_buffer, path_buffer, job.tile_info.gen);
+		tracePaths(job.image_info.simcache_ptr, ray_buffer, path_buffer, 
+			job.image_info.cone_spread, job.tile_info.gen);
 		auto batch_colors = determineColors(job.image_info.simcache_ptr, path_buffer, settings);
 
 		// Update the color buffer
@@ -495,13 +504,21 @@ bool isLightTerminated(RayIntersection hit){
 }
 
 void Raytracer::tracePaths(const SimCache* cache_ptr, const std::vector<Ray>& rays, 
-	const PathBuffer& buffer, RandomGen& random_gen) const{
+	const PathBuffer& buffer, float cone_spread, RandomGen& random_gen) const{
 	/*
 	TODO: Add ability to set which resource types are involved in a trace.
+
+	NOTE: cone_spread is how wide each camera ray's cone gets per unit of 
+		distance. A bounced ray starts out as wide as its cone was at the
+		hit, and rough bounces make it spread faster, so secondary rays 
+		stop even higher up the tree. 0 traces every ray down to the leaves.
 	*/
 
 	constexpr float TINY_FLOAT = 0.00001;
 	constexpr float BOUNCE_OFFSET = 0.001;
+
+	// How much a completely rough bounce widens the cone
+	constexpr float ARBITRARY_ROUGH_BOUNCE_SPREAD = 0.1;
 	constexpr float SURFACE_ROUGHNESS[] = {
 		0,
 		0,
@@ -514,7 +531,12 @@ void Raytracer::tracePaths(const SimCache* cache_ptr, const std::vector<Ray>& ra
 		0.02, // Metal,
 	};
 
+	// TODO: Per-mesh materials
+	constexpr MaterialPaletteIndex ENTITY_MATERIAL_INDEX = Metal;
+
+	// Chunks seen by any ray stay valid until every path is traced
 	const ChunkTable* table_ptr = &cache_ptr->m_reference_world->m_chunk_table;
+	ChunkTable::ReadGuard read_guard(*table_ptr);
 
 	Intersection::Utils::VKDTStack stack = Intersection::Utils::VKDTStack::init(
 		cache_ptr->m_kd_tree_ptr->curr_max_depth);
@@ -524,6 +546,8 @@ void Raytracer::tracePaths(const SimCache* cache_ptr, const std::vector<Ray>& ra
 		// STEP 1: Trace the path of the ray as it bounces through the scene
 		bool is_terminated_at_light = false;
 		Ray curr_ray = rays[ray_index];
+		float curr_cone_spread = cone_spread;
+		float curr_cone_width = 0;
 		
 		Int32 path_len = 0;
 		while(path_len < buffer.max_path_len){
@@ -532,26 +556,26 @@ void Raytracer::tracePaths(const SimCache* cache_ptr, const std::vector<Ray>& ra
 			curr_vertex.source_ray = curr_ray;
 			curr_vertex.material_index = 0;
 
-			// VKDTree Intersection
-			RayIntersection curr_hit{INTERSECT_MISS};
-			curr_hit.t_hit = 0;
-			auto hit = Intersection::intersectTree(curr_ray, 
-				cache_ptr->m_kd_tree_ptr, stack);
-			if(hit.type == INTERSECT_HIT_CHUNK_VOXEL){
-				curr_hit = hit;
-			}else if(curr_hit.type == INTERSECT_POSSIBLE_CHUNK_VOXEL){
-				// TODO: Follow up with chunk trace if this happens
-				// NOTE: For now I'm just making the offending areas glow bright red.
+			// VKDTree Intersection. Leaves without type info get resolved
+			// against the chunk data during traversal.
+			RayIntersection curr_hit = Intersection::intersectTree(curr_ray, 
+				cache_ptr->m_kd_tree_ptr, stack, table_ptr, curr_cone_spread, 
+				curr_cone_width);
+			if(curr_hit.type != INTERSECT_HIT_CHUNK_VOXEL){
+				curr_hit.type = INTERSECT_MISS;
+				curr_hit.t_hit = 0;
 			}
-
-			hit = Intersection::intersectChunks(curr_ray, table_ptr);
-			if(hit.type == INTERSECT_HIT_CHUNK_VOXEL && hit.t_hit < curr_hit.t_hit){
+			RayIntersection hit;
+
+			// Entity intersection. Instances are refit every frame, so 
+			// moving entities don't require any static rebuilds.
+			hit = Intersection::intersectTree(curr_ray, &cache_ptr->m_entity_bvh);
+			bool is_closer_than_voxels = 
+				curr_hit.type == INTERSECT_MISS || hit.t_hit < curr_hit.t_hit;
+			if(hit.type == INTERSECT_HIT_TRIANGLE_MESH && is_closer_than_voxels){
 				curr_hit = hit;
 			}
 
-			// MKDTree Intersection
-			
-			
 			// Portal intersection
 			// TODO: Move to function
 			if(true){
@@ -602,6 +626,8 @@ void Raytracer::tracePaths(const SimCache* cache_ptr, const std::vector<Ray>& ra
 			curr_vertex.t_hit = curr_hit.t_hit;
 			if(curr_hit.type == INTERSECT_HIT_CHUNK_VOXEL){
 				curr_vertex.material_index = curr_hit.voxel_hit.palette_index;
+			}else if(curr_hit.type == INTERSECT_HIT_TRIANGLE_MESH){
+				curr_vertex.material_index = ENTITY_MATERIAL_INDEX;
 			}
 			if(isLightTerminated(curr_hit)){
 				is_terminated_at_light = true;
@@ -615,9 +641,24 @@ void Raytracer::tracePaths(const SimCache* cache_ptr, const std::vector<Ray>& ra
 			
 			// STEP: Based on the surface properties of the hit location, 
 			// generate a new outgoing ray.
-			FVec3 hit_normal = NORMALS_BY_FACE_INDEX[curr_hit.voxel_hit.face_index];
-			float roughness = SURFACE_ROUGHNESS[curr_hit.voxel_hit.palette_index];
+			FVec3 hit_normal;
+			float roughness;
+			if(curr_hit.type == INTERSECT_HIT_TRIANGLE_MESH){
+				// Triangle winding isn't consistent, so face the normal at the ray
+				hit_normal = curr_hit.unaligned_hit.normal;
+				if(hit_normal.dot(curr_ray.dir) > 0){
+					hit_normal = -hit_normal;
+				}
+				roughness = SURFACE_ROUGHNESS[ENTITY_MATERIAL_INDEX];
+			}else{
+				hit_normal = NORMALS_BY_FACE_INDEX[curr_hit.voxel_hit.face_index];
+				roughness = SURFACE_ROUGHNESS[curr_hit.voxel_hit.palette_index];
+			}
 			FVec3 new_dir = bounceDir(random_gen, curr_ray, hit_normal, roughness).normal();
+			if(curr_cone_spread > 0){
+				curr_cone_width += curr_cone_spread * curr_hit.t_hit;
+				curr_cone_spread += roughness * ARBITRARY_ROUGH_BOUNCE_SPREAD;
+			}
 			
 			// WARNING: Assumes that any ambiguous hits were followed up on until
 			// a material was obtained. 
@@ -81,6 +81,11 @@ class Raytracer{
 			Int32 num_rays_per_pixel;
 			Int32 max_path_len;
 
+			// Rays stop at a tree node once it's narrower than this many 
+			// pixels. 0 traces every ray down to the leaves. Needs a tree 
+			// built with property nodes.
+			float lod_footprint_scale;
+
 			FVec3 sky_brightness;
 			FVec3 sun_brightness;
 			FVec3 sun_direction;
@@ -156,6 +161,7 @@ class Raytracer{
 				RenderSettings settings;
 				Image::PixelRGB* pixel_buffer;
 				Rendering::CameraRayGenerator ray_generator;
+				float cone_spread;  // See tracePaths()
 				/*
 				// Position info used to orient rays
 				FVec3 plane_world_pos;
@@ -205,14 +211,14 @@ class Raytracer{
 		void setWindowPtr(std::shared_ptr<Window> window_ptr);
 		void renderImage(const SimCache& cache, Camera camera, RenderSettings settings);
 		void visualizePaths(const SimCache& cache, std::vector<Ray> rays);
-		void renderPreview(const SimCache& cache, Camera camera, Rendering::ImageConfig config);
+		void renderPreview(const SimCache& cache, Camera camera, RenderSettings settings);
 
 	private:
-		void renderPreview(const SimCache& cache, Camera camera, Rendering::ImageConfig config, bool is_interactive);
+		void renderPreview(const SimCache& cache, Camera camera, RenderSettings settings, bool is_interactive);
 		void renderImageToQuad(Image& image, bool should_wait_for_input);
 		void runTileJob(TileJob job);
 		void tracePaths(const SimCache* cache_ptr, const std::vector<Ray>& rays, 
-			const PathBuffer& buffer, RandomGen& random_gen) const;
+			const PathBuffer& buffer, float cone_spread, RandomGen& random_gen) const;
 		std::vector<FVec3> determineColors(const SimCache* cache, const PathBuffer& buffer,
 			RenderSettings settings) const;
 
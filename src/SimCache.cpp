@@ -1,5 +1,7 @@
 #include "SimCache.hpp"
 
+#include <thread>
+
 Uint64 SimCache::CuboidHasher::operator()(const ICuboid& cuboid) const{
 	return hasher(cuboid.origin) ^ hasher(cuboid.extent);
 }
@@ -11,28 +13,98 @@ SimCache::SimCache(){
 	m_reference_world = NULL;
 	m_resource_manager = NULL;
 	m_kd_tree_ptr = NULL;
+
+	m_is_tree_regional = false;
+	m_seen_chunk_version = 0;
+	m_is_rebuild_running = false;
+	m_is_rebuild_done = false;
+	m_pending_tree_ptr = NULL;
 }
 
 SimCache::~SimCache(){
+	waitForRegionRebuild();
 
+	VoxelKDTree::TreeData* pending_tree_ptr = m_pending_tree_ptr.exchange(NULL);
+	freeTreeData(pending_tree_ptr);
+	for(auto& [region, tree_ptr] : m_chunk_region_to_tree_map){
+		freeTreeData(tree_ptr);
+	}
+	freeTreeData(m_kd_tree_ptr);
 }
 
 void SimCache::generateAccelerationStructures(VoxelKDTree::BuildSettings settings){
 	/*
+	Builds a tree for every region of the world and composes them into 
+	m_kd_tree_ptr. Blocks until done. Later changes to the chunk table 
+	only rebuild the regions they touch, see updateAccelerationStructures().
 
+	The result is cached to a file. If the cache matches the world and the
+	settings on the next run, it's mapped instead of building anything.
+
+	Regions with evicted chunks are left for updateAccelerationStructures()
+	to build once they're paged back in, and the tree isn't cached then.
 	*/
 
+	waitForRegionRebuild();
+	m_seen_chunk_version = m_reference_world->m_chunk_table.currentVersion();
+	m_dirty_regions.clear();
+
+	const std::string TREE_CACHE_FILEPATH = "VKDT.cache";
+
 	// WARNING: Hack used for testing. Should be "Generate at runtime" vs "load from file"
+	m_region_build_settings = settings;
+	VoxelKDTree::TreeFileKey cache_key;
+	VoxelKDTree::TreeData* cached_tree_ptr = NULL;
 	if(settings.max_depth > 0){
-		// Generate the tree from the chunk table
-		const ChunkTable* table_ptr = &m_reference_world->m_chunk_table;
+		// A tree cached by an earlier run over the same world gets mapped
+		// instead. Its regions are only built once something is edited.
+		const ChunkTable& table = m_reference_world->m_chunk_table;
+		cache_key = VoxelKDTree::treeFileKey(settings, table.contentHash());
+		cached_tree_ptr = VoxelKDTree::mapTreeFromFile(TREE_CACHE_FILEPATH, cache_key);
+	}
+
+	if(cached_tree_ptr != NULL){
+		printf("Mapped cached tree from '%s'\n", TREE_CACHE_FILEPATH.c_str());
 		freeTreeData(m_kd_tree_ptr);
-		m_kd_tree_ptr = VoxelKDTree::TreeBuilder::buildTree(*table_ptr, settings);
+		m_kd_tree_ptr = cached_tree_ptr;
+		m_is_tree_regional = false;
+	}else if(settings.max_depth > 0){
+		// Generate the tree from the chunk table
+		RegionRebuild rebuild;
+		for(ICuboid region : regionsInWorld()){
+			if(isRegionResident(region)){
+				rebuild.regions.push_back(region);
+			}else{
+				m_dirty_regions.insert(region);
+			}
+		}
+		m_known_regions.insert(rebuild.regions.begin(), rebuild.regions.end());
+		rebuild.world_bounds = m_reference_world->m_chunk_table.boundingVolumeChunkspace();
+		rebuild.table_ptr = &m_reference_world->m_chunk_table;
+		rebuild.is_table_owned = false;
+		rebuildRegions(rebuild);
+
+		VoxelKDTree::TreeData* tree_ptr = m_pending_tree_ptr.exchange(NULL);
+		if(tree_ptr != NULL){
+			freeTreeData(m_kd_tree_ptr);
+			m_kd_tree_ptr = tree_ptr;
+			VoxelKDTree::debuggingPrintTreeStats(m_kd_tree_ptr);
+			bool is_complete = m_dirty_regions.size() == 0;
+			if(is_complete 
+				&& !VoxelKDTree::writeTreeToFile(m_kd_tree_ptr, cache_key, TREE_CACHE_FILEPATH)){
+				printf("WARNING: Couldn't cache the tree. It'll be rebuilt next run.\n");
+			}
+		}
+		m_is_tree_regional = true;
 	}else{
 		// Have a default tree loaded from file
 		freeTreeData(m_kd_tree_ptr);
 		m_kd_tree_ptr = VoxelKDTree::loadTreeFromFile("VKDT.binary");
 		m_kd_tree_ptr->bounds.origin += {CHUNK_LEN, CHUNK_LEN, CHUNK_LEN};
+
+		// Edits will need trees for every region, at a depth that works
+		m_region_build_settings.max_depth = VoxelKDTree::BuildSettings().max_depth;
+		m_is_tree_regional = false;
 	}
 
 	bool visualize_tree = true;
@@ -45,6 +117,332 @@ void SimCache::generateAccelerationStructures(VoxelKDTree::BuildSettings setting
 	}
 }
 
+void SimCache::markChunksDirty(const std::vector<IVec3>& chunk_coords){
+	/*
+	Queues the regions holding the given chunks for a rebuild. Changes to
+	the chunk table are picked up on their own, so this is only needed to
+	force a rebuild.
+	*/
+
+	if(chunk_coords.size() == 0){
+		return;
+	}
+
+	// A tree from file has no regions yet, so all of them need building
+	if(!m_is_tree_regional){
+		for(ICuboid region : regionsInWorld()){
+			m_dirty_regions.insert(region);
+		}
+		m_is_tree_regional = true;
+	}
+
+	for(IVec3 coord : chunk_coords){
+		m_dirty_regions.insert(regionContaining(coord));
+	}
+}
+
+void SimCache::updateAccelerationStructures(){
+	/*
+	Called once per frame. Swaps in the tree from a finished rebuild, then
+	starts rebuilding whatever regions the chunk table changed in since 
+	the last one. Never blocks, and rays keep using the old tree until 
+	the swap. Dirty regions with evicted chunks wait for them to be paged
+	back in.
+
+	THREADING: The swap happens here on the main thread, between frames,
+		so nothing can be tracing against the tree that gets freed.
+	*/
+
+	markChangedChunksDirty();
+	if(m_is_rebuild_running){
+		if(!m_is_rebuild_done.load()){
+			return;
+		}
+
+		m_rebuild_thread.join();
+		m_is_rebuild_running = false;
+	}
+
+	VoxelKDTree::TreeData* tree_ptr = m_pending_tree_ptr.exchange(NULL);
+	if(tree_ptr != NULL){
+		freeTreeData(m_kd_tree_ptr);
+		m_kd_tree_ptr = tree_ptr;
+	}
+
+	std::vector<ICuboid> regions;
+	for(const ICuboid& region : m_dirty_regions){
+		if(isRegionResident(region)){
+			regions.push_back(region);
+		}
+	}
+	if(regions.size() == 0){
+		return;
+	}
+
+	for(const ICuboid& region : regions){
+		m_dirty_regions.erase(region);
+	}
+	m_known_regions.insert(regions.begin(), regions.end());
+	RegionRebuild rebuild = snapshotRegions(regions);
+	m_is_rebuild_done = false;
+	m_is_rebuild_running = true;
+	m_rebuild_thread = std::thread(&SimCache::rebuildRegions, this, rebuild);
+}
+
+void SimCache::markChangedChunksDirty(){
+	/*
+	Dirties the regions of every chunk the table journaled a change for 
+	since the last call. If the journal already dropped some of them, 
+	every region is dirtied, including ones whose chunks are all gone.
+	Residency only changes are skipped, since the tree keeps evicted 
+	chunks.
+
+	THREADING: Runs while a rebuild may be in flight, so regions with a 
+		tree come from m_known_regions and never from the region map.
+	*/
+
+	const ChunkTable& table = m_reference_world->m_chunk_table;
+	if(table.currentVersion() == m_seen_chunk_version){
+		return;
+	}
+
+	ChunkTable::ChangeList change_list = table.changesSince(m_seen_chunk_version);
+	m_seen_chunk_version = change_list.version;
+	if(!change_list.is_complete){
+		printf("WARNING: Fell behind on chunk changes. Rebuilding every region.\n");
+		for(ICuboid region : regionsInWorld()){
+			m_dirty_regions.insert(region);
+		}
+		for(ICuboid region : m_known_regions){
+			m_dirty_regions.insert(region);
+		}
+		m_is_tree_regional = true;
+		return;
+	}
+
+	std::vector<IVec3> changed_chunks;
+	changed_chunks.reserve(change_list.changes.size());
+	for(const ChunkTable::ChunkChange& change : change_list.changes){
+		if(!change.is_residency_only){
+			changed_chunks.push_back(change.coord);
+		}
+	}
+	markChunksDirty(changed_chunks);
+}
+
+ICuboid SimCache::regionContaining(IVec3 chunk_coord){
+	/*
+	Chunkspace bounds of the region the chunk belongs to. Rounds towards 
+	negative infinity so regions don't double up around the origin.
+	*/
+
+	IVec3 origin;
+	for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+		Int32 coord = chunk_coord[axis];
+		if(coord < 0){
+			coord -= ARBITRARY_REGION_LEN - 1;
+		}
+		origin[axis] = (coord / ARBITRARY_REGION_LEN) * ARBITRARY_REGION_LEN;
+	}
+	return {origin, {ARBITRARY_REGION_LEN, ARBITRARY_REGION_LEN, ARBITRARY_REGION_LEN}};
+}
+
+std::vector<ICuboid> SimCache::regionsInWorld() const{
+	/*
+	Every region that overlaps the loaded world
+	*/
+
+	std::vector<ICuboid> regions;
+	ICuboid world_bounds = m_reference_world->m_chunk_table.boundingVolumeChunkspace();
+	if(volume(world_bounds) == 0){
+		return regions;
+	}
+
+	IVec3 first = regionContaining(world_bounds.origin).origin;
+	IVec3 last = world_bounds.origin + world_bounds.extent - IVec3{1, 1, 1};
+	for(Int32 z = first.z; z <= last.z; z += ARBITRARY_REGION_LEN)
+	for(Int32 y = first.y; y <= last.y; y += ARBITRARY_REGION_LEN)
+	for(Int32 x = first.x; x <= last.x; x += ARBITRARY_REGION_LEN){
+		regions.push_back(regionContaining({x, y, z}));
+	}
+	return regions;
+}
+
+bool SimCache::isRegionResident(const ICuboid& region) const{
+	/*
+	True if none of the region's chunks are evicted. Otherwise the evicted
+	ones are touched, so the chunk manager pages them back in next frame.
+	*/
+
+	const ChunkTable& table = m_reference_world->m_chunk_table;
+	bool is_resident = true;
+	IVec3 end = region.origin + region.extent;
+	for(Int32 z = region.origin.z; z < end.z; ++z)
+	for(Int32 y = region.origin.y; y < end.y; ++y)
+	for(Int32 x = region.origin.x; x < end.x; ++x){
+		if(table.isEvicted({x, y, z})){
+			table.touchChunk({x, y, z});
+			is_resident = false;
+		}
+	}
+	return is_resident;
+}
+
+SimCache::RegionRebuild SimCache::snapshotRegions(const std::vector<ICuboid>& regions){
+	/*
+	Copies the loaded chunks of the given regions into a table owned by 
+	the rebuild. Chunks are copied in their compressed form, so this costs
+	at most 32KB per chunk, and the background thread never has to look at
+	the live table.
+	*/
+
+	ChunkTable& table = m_reference_world->m_chunk_table;
+	ChunkTable* snapshot_ptr = new ChunkTable();
+
+	snapshot_ptr->setMaxLoadedChunks(table.maxLoadedChunks());
+	for(const ICuboid& region : regions){
+		IVec3 end = region.origin + region.extent;
+		for(Int32 z = region.origin.z; z < end.z; ++z)
+		for(Int32 y = region.origin.y; y < end.y; ++y)
+		for(Int32 x = region.origin.x; x < end.x; ++x){
+			snapshot_ptr->copyChunk({x, y, z}, table);
+		}
+	}
+	ICuboid world_bounds = table.boundingVolumeChunkspace();
+
+	RegionRebuild rebuild;
+	rebuild.regions = regions;
+	rebuild.world_bounds = world_bounds;
+	rebuild.table_ptr = snapshot_ptr;
+	rebuild.is_table_owned = true;
+	return rebuild;
+}
+
+void SimCache::rebuildRegions(RegionRebuild rebuild){
+	/*
+	Rebuilds the trees of the given regions, then composes every region 
+	tree into a new tree and leaves it in m_pending_tree_ptr. Regions are
+	spread over the build threads, with each region built on one thread.
+
+	Region trees are clipped to the world bounds, so a world that isn't a
+	multiple of the region size gets the same bounds as a single tree.
+
+	Ropes and treelets are passes over the whole composed tree, so region
+	trees are built without them and the composed tree gets them if the 
+	settings ask for them. Every rebuild does this, so the tree looks the 
+	same after an edit as after the first build.
+
+	TODO: Composing copies every region tree, so a rebuild costs time in 
+		the size of the world even if one region changed. A top tree that
+		references the region trees in place, and only swaps the rebuilt 
+		ones, would make it proportional to the edit.
+
+	THREADING: Runs on the rebuild thread, except for the blocking build
+		in generateAccelerationStructures().
+	*/
+
+	VoxelKDTree::BuildSettings region_settings = m_region_build_settings;
+	region_settings.num_build_threads = 1;
+	region_settings.should_generate_ropes = false;
+	region_settings.should_cluster_treelets = false;
+	region_settings.should_report_progress = false;
+
+	// STEP 1: Build the regions in parallel
+	Int32 num_regions = rebuild.regions.size();
+	std::vector<VoxelKDTree::TreeData*> region_trees(num_regions, NULL);
+	std::atomic<Int32> next_region{0};
+	auto build_regions = [&](){
+		while(true){
+			Int32 region_index = next_region.fetch_add(1);
+			if(region_index >= num_regions){
+				break;
+			}
+
+			// Regions without any loaded chunks don't get a tree
+			const ICuboid& region = rebuild.regions[region_index];
+			IVec3 clip_min, clip_max;
+			bool is_empty = false;
+			for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+				clip_min[axis] = std::max(region.origin[axis], 
+					rebuild.world_bounds.origin[axis]);
+				clip_max[axis] = std::min(region.origin[axis] + region.extent[axis],
+					rebuild.world_bounds.origin[axis] + rebuild.world_bounds.extent[axis]);
+				is_empty |= (clip_max[axis] <= clip_min[axis]);
+			}
+
+			bool has_chunks = false;
+			for(Int32 z = clip_min.z; z < clip_max.z && !is_empty; ++z)
+			for(Int32 y = clip_min.y; y < clip_max.y; ++y)
+			for(Int32 x = clip_min.x; x < clip_max.x; ++x){
+				has_chunks |= rebuild.table_ptr->isLoaded({x, y, z});
+			}
+			if(is_empty || !has_chunks){
+				continue;
+			}
+
+			VoxelKDTree::BuildSettings settings = region_settings;
+			settings.bounds = {clip_min * CHUNK_LEN, (clip_max - clip_min) * CHUNK_LEN};
+			region_trees[region_index] = 
+				VoxelKDTree::TreeBuilder::buildTree(*rebuild.table_ptr, settings);
+		}
+	};
+
+	Int32 num_threads = m_region_build_settings.num_build_threads;
+	if(num_threads <= 0){
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	num_threads = std::min(num_threads, std::max(num_regions, 1));
+	std::vector<std::thread> threads;
+	for(Int32 i = 1; i < num_threads; ++i){
+		threads.push_back(std::thread(build_regions));
+	}
+	build_regions();
+	for(std::thread& thread : threads){
+		thread.join();
+	}
+
+	// STEP 2: Replace the old region trees
+	for(Int32 i = 0; i < num_regions; ++i){
+		const ICuboid& region = rebuild.regions[i];
+		auto iter = m_chunk_region_to_tree_map.find(region);
+		if(iter != m_chunk_region_to_tree_map.end()){
+			freeTreeData(iter->second);
+			m_chunk_region_to_tree_map.erase(iter);
+		}
+		if(region_trees[i] != NULL){
+			m_chunk_region_to_tree_map[region] = region_trees[i];
+		}
+	}
+	if(rebuild.is_table_owned){
+		delete rebuild.table_ptr;
+	}
+
+	// STEP 3: Compose. If nothing is left, the old tree stays.
+	std::vector<const VoxelKDTree::TreeData*> all_trees;
+	all_trees.reserve(m_chunk_region_to_tree_map.size());
+	for(auto& [region, tree_ptr] : m_chunk_region_to_tree_map){
+		all_trees.push_back(tree_ptr);
+	}
+	VoxelKDTree::TreeData* composed_tree_ptr = 
+		VoxelKDTree::TreeBuilder::composeTree(all_trees, m_region_build_settings);
+	
+	VoxelKDTree::TreeData* unused_tree_ptr = m_pending_tree_ptr.exchange(composed_tree_ptr);
+	freeTreeData(unused_tree_ptr);
+	m_is_rebuild_done = true;
+}
+
+void SimCache::waitForRegionRebuild(){
+	/*
+	Blocks until any running rebuild finishes. Its tree is swapped in by 
+	the next updateAccelerationStructures() call.
+	*/
+
+	if(m_is_rebuild_running){
+		m_rebuild_thread.join();
+		m_is_rebuild_running = false;
+	}
+}
+
 void SimCache::generateMKDTree(ResourceHandle handle, const TriangleMesh& mesh){
 	/*
 
@@ -65,6 +463,65 @@ MeshKDTree::MKDTree SimCache::getMeshTree(ResourceHandle handle){
 	return iter->second;
 }
 
+void SimCache::updateEntityInstances(){
+	/*
+	Syncs the entity BVH with the world's entities. Called once per frame.
+	If the set of instanced entities is unchanged the tree is only refit, 
+	which is linear in the number of entities. Otherwise it gets rebuilt.
+
+	TODO: Legitimate lookup from entity type to mesh resource. Drones are
+		currently the only entities with a mesh.
+	*/
+
+	ResourceHandle drone_handle = m_resource_manager->handleByName("DroneModel");
+	if(drone_handle.type == RESOURCE_INVALID){
+		return;
+	}
+
+	if(m_handle_to_tree_map.find(drone_handle) == m_handle_to_tree_map.end()){
+		generateMKDTree(drone_handle, m_resource_manager->getDataTriangleMesh(drone_handle));
+	}
+
+	// NOTE: The map never erases, so tree pointers stay valid
+	const MeshKDTree::TreeData* drone_tree = m_handle_to_tree_map[drone_handle].data();
+
+	std::vector<EntityBVH::Instance>& instances = m_entity_bvh.instances;
+	bool is_topology_valid = !m_entity_bvh.nodes.empty();
+	Uint64 num_instanced = 0;
+	for(const PlaceholderEntity& entity : m_reference_world->m_placeholder_entities){
+		if(entity.handle.type_index != (Uint32) EntityType::ENTITY_DRONE){
+			continue;
+		}
+
+		if(num_instanced == instances.size()){
+			EntityBVH::Instance new_instance;
+			new_instance.entity = entity.handle;
+			instances.push_back(new_instance);
+			is_topology_valid = false;
+		}
+
+		EntityBVH::Instance& instance = instances[num_instanced++];
+		if(!(instance.entity == entity.handle)){
+			instance.entity = entity.handle;
+			is_topology_valid = false;
+		}
+		instance.mesh_handle = drone_handle;
+		instance.mesh_tree = drone_tree;
+		EntityBVH::updateInstance(instance, entity.position, entity.basis);
+	}
+
+	if(num_instanced != instances.size()){
+		instances.resize(num_instanced);
+		is_topology_valid = false;
+	}
+
+	if(is_topology_valid){
+		EntityBVH::refitTree(m_entity_bvh);
+	}else{
+		EntityBVH::buildTree(m_entity_bvh);
+	}
+}
+
 #if 0
 RayIntersection SimCache::traceRay(Ray ray){
 	Debug::DebugData debug;
@@ -4,11 +4,16 @@
 #include "MultiresGrid.hpp"
 #include "ResourceManager.hpp"
 #include "KDTree.hpp"
+#include "EntityBVH.hpp"
 #include "RayTracing.hpp"
 #include "MeshLoader.hpp"
 
 #include "FileIO.hpp"
 
+#include <thread>
+#include <atomic>
+#include <unordered_set>
+
 class SimCache{
 	/*
 	Wrapper around the WorldState used by the engine to cache temporary, runtime
@@ -22,15 +27,36 @@ class SimCache{
 		Uint64 operator()(const ICuboid& cuboid) const;
 	};
 
+	struct RegionRebuild{
+		/*
+		Everything a region rebuild reads. Background rebuilds get their own
+		copy of the chunks, so the live table can keep changing meanwhile.
+		*/
+
+		std::vector<ICuboid> regions;  // Chunkspace
+		ICuboid world_bounds;  // Chunkspace, when the rebuild was requested
+		const ChunkTable* table_ptr;
+		bool is_table_owned;
+	};
+
+	// The voxel tree is split into cubic regions of this many chunks per 
+	// side, aligned to the chunk origin. Each has its own tree.
+	static constexpr Int32 ARBITRARY_REGION_LEN = 4;
+
 	public:
 		SimCache();
 		~SimCache();
 
 		void generateAccelerationStructures(VoxelKDTree::BuildSettings settings);
+		void markChunksDirty(const std::vector<IVec3>& chunk_coords);
+		void updateAccelerationStructures();
+		static ICuboid regionContaining(IVec3 chunk_coord);
 
 		void generateMKDTree(ResourceHandle handle, const TriangleMesh& mesh);
 		MeshKDTree::MKDTree getMeshTree(ResourceHandle handle);
 
+		void updateEntityInstances();
+
 		//RayIntersection traceRay(Ray ray);
 		//void traceImage(Camera& camera, Rendering::ImageConfig config);
 		//void findIntersectionDiscrepancies(int num_iterations);
@@ -42,6 +68,29 @@ class SimCache{
 
 		std::unordered_map<ICuboid, VoxelKDTree::TreeData*, CuboidHasher> m_chunk_region_to_tree_map;
 		std::unordered_map<ResourceHandle, MeshKDTree::MKDTree, PODHasher> m_handle_to_tree_map;
+		EntityBVH::TreeData m_entity_bvh;
 
 		MultiresGrid m_chunk_lod_meshes;
+
+	private:
+		std::vector<ICuboid> regionsInWorld() const;
+		bool isRegionResident(const ICuboid& region) const;
+		void markChangedChunksDirty();
+		RegionRebuild snapshotRegions(const std::vector<ICuboid>& regions);
+		void rebuildRegions(RegionRebuild rebuild);
+		void waitForRegionRebuild();
+
+	private:
+		// Region trees are only touched by the rebuild thread while it runs.
+		// The composed tree is handed back through m_pending_tree_ptr and 
+		// swapped in by updateAccelerationStructures().
+		VoxelKDTree::BuildSettings m_region_build_settings;
+		bool m_is_tree_regional;
+		Uint64 m_seen_chunk_version;  // Chunk table changes up to here are handled
+		std::unordered_set<ICuboid, CuboidHasher> m_dirty_regions;
+		std::unordered_set<ICuboid, CuboidHasher> m_known_regions;  // Main thread's copy of the map's keys
+		std::thread m_rebuild_thread;
+		bool m_is_rebuild_running;
+		std::atomic<bool> m_is_rebuild_done;
+		std::atomic<VoxelKDTree::TreeData*> m_pending_tree_ptr;
 };
@@ -0,0 +1,443 @@
+/*
+Validation and throughput harness for the ray acceleration structures.
+
+Generates a world with one of the ChunkGenerator algorithms, builds every
+VoxelKDTree variant over it, and fires the same deterministic set of rays
+through each backend. Reports build times, Mrays/sec, and every hit that
+disagrees with the chunk DDA (intersectChunks), which is treated as the
+reference. Exits with 1 if any backend disagreed.
+
+Build with "make benchmark" from the repository root.
+
+Usage: ./benchmark [Algorithm] [Seed] [NumRays] [RayMode] [MaxDepth] [NumThreads]
+	Algorithm:  Same names as GenerationAlgorithm in SETTINGS.txt. (NoiseLayers)
+	Seed:       Seed for both world generation and rays. (56)
+	NumRays:    Rays fired through each backend. (1000000)
+	RayMode:    "random" for rays anywhere in the world, "camera" for a
+	            pinhole camera looking at the world from above. (random)
+	MaxDepth:   VKDTree max depth. (20)
+	NumThreads: Threads for the batched query pass. (hardware concurrency)
+
+NOTE: Random rays that start inside a solid voxel are regenerated, since
+	every backend trivially reports those as hits at t = 0.
+*/
+
+#include "Chunks.hpp"
+#include "ChunkManager.hpp"
+#include "KDTree.hpp"
+#include "RayTracing.hpp"
+#include "Settings.hpp"
+#include "MathUtils.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+//-----------------------------------------------------------------------------
+// Harness settings
+//-----------------------------------------------------------------------------
+struct HarnessSettings{
+	std::string algorithm_name{"NoiseLayers"};
+	Int32 seed{56};
+	Int64 num_rays{1000000};
+	bool use_camera_rays{false};
+	Int32 max_depth{20};
+	Int32 num_threads{1};
+
+	// Inclusive chunk bounds of the generated world
+	IVec3 world_min{-4, -4, -3};
+	IVec3 world_max{3, 3, 1};
+};
+
+HarnessSettings parseArgs(int argc, char** argv){
+	HarnessSettings settings;
+	settings.num_threads = std::max(1u, std::thread::hardware_concurrency());
+	if(argc > 1){
+		settings.algorithm_name = argv[1];
+	}
+	if(argc > 2){
+		settings.seed = atoi(argv[2]);
+	}
+	if(argc > 3){
+		settings.num_rays = atol(argv[3]);
+	}
+	if(argc > 4){
+		settings.use_camera_rays = std::string(argv[4]) == "camera";
+	}
+	if(argc > 5){
+		settings.max_depth = atoi(argv[5]);
+	}
+	if(argc > 6){
+		settings.num_threads = atoi(argv[6]);
+	}
+	assert(settings.num_rays > 0);
+	assert(settings.num_threads > 0);
+	return settings;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start){
+	auto now = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(now - start).count();
+}
+
+//-----------------------------------------------------------------------------
+// World and ray generation
+//-----------------------------------------------------------------------------
+void generateWorld(ChunkTable& table, const HarnessSettings& harness_settings){
+	/*
+	Runs the same generation path as the engine, driven by a settings
+	object filled in here instead of SETTINGS.txt.
+	*/
+
+	auto settings_ptr = std::make_shared<Settings>();
+	Settings::Namespace& gen_settings = settings_ptr->namespaceRef("CHUNK_GEN");
+
+	PODVariant name_data;
+	name_data.type = PODVariant::DATATYPE_STRING;
+	name_data.val_string = PODString::init(harness_settings.algorithm_name.c_str());
+	gen_settings["GenerationAlgorithm"] = name_data;
+
+	PODVariant seed_data;
+	seed_data.type = PODVariant::DATATYPE_INT32;
+	seed_data.val_int = harness_settings.seed;
+	gen_settings["Seed"] = seed_data;
+
+	ChunkManager manager(settings_ptr);
+	manager.setManagedTable(table);
+
+	const IVec3& bounds_min = harness_settings.world_min;
+	const IVec3& bounds_max = harness_settings.world_max;
+	for(int z = bounds_min.z; z <= bounds_max.z; ++z)
+	for(int y = bounds_min.y; y <= bounds_max.y; ++y)
+	for(int x = bounds_min.x; x <= bounds_max.x; ++x){
+		ChunkInstruction instruction = {CHUNK_GENERATE, {x, y, z}};
+		manager.addInstruction(instruction);
+	}
+	manager.processInstructions();
+}
+
+bool isInsideSolid(const ChunkTable& table, FVec3 position){
+	IVec3 voxel = {
+		(Int32) floor(position.x),
+		(Int32) floor(position.y),
+		(Int32) floor(position.z)
+	};
+	const RawVoxelChunk* chunk_ptr = table.getChunkPtr(chunkCoordFromVoxelCoord(voxel));
+	if(chunk_ptr == NULL){
+		return false;
+	}
+	return !isAir(chunk_ptr->data[linearChunkIndex(localVoxelCoordFromGlobal(voxel))].type);
+}
+
+std::vector<Ray> randomRays(const ChunkTable& table, Int64 num_rays, Int32 seed){
+	/*
+	Origins uniformly distributed in the world volume, directions uniformly
+	distributed over the sphere.
+	*/
+
+	MathUtils::Random::SebVignaSplitmix64 random{(Uint64) seed};
+	auto next_unit = [&random](){
+		return (float) MathUtils::Random::doubleFromUint64(random.next());
+	};
+
+	ICuboid world = table.boundingVolumeChunkspace() * CHUNK_LEN;
+	std::vector<Ray> rays;
+	rays.reserve(num_rays);
+	while((Int64) rays.size() < num_rays){
+		Ray ray;
+		for(int axis = 0; axis < NUM_3D_AXES; ++axis){
+			ray.origin[axis] = world.origin[axis] + next_unit() * world.extent[axis];
+			ray.dir[axis] = next_unit() * 2 - 1;
+		}
+
+		float length_squared = ray.dir.dot(ray.dir);
+		if(length_squared > 1 || length_squared < ARBITRARY_EPSILON){
+			continue;
+		}
+		if(isInsideSolid(table, ray.origin)){
+			continue;
+		}
+		rays.push_back(ray.normal());
+	}
+	return rays;
+}
+
+std::vector<Ray> cameraRays(const ChunkTable& table, Int64 num_rays){
+	/*
+	A single image worth of rays from above one corner of the world, looking
+	at the center.
+	*/
+
+	ICuboid world = table.boundingVolumeChunkspace() * CHUNK_LEN;
+	FVec3 world_min = toFloatVector(world.origin);
+	FVec3 world_extent = toFloatVector(world.extent);
+	FVec3 world_center = world_min + world_extent * 0.5f;
+
+	Camera camera = initDefaultCamera();
+	camera.pos = world_min + FVec3{0, 0, world_extent.z * 1.5f};
+	FVec3 up = {0, 0, 1};
+	FVec3 forward = (world_center - camera.pos).normal();
+	camera.basis = {forward.cross(up).normal(), forward, up};
+
+	Int32 side_len = std::max((Int32) sqrt((double) num_rays), 1);
+	Rendering::ImageConfig config = {{side_len, side_len}, {32, 32}};
+	return Rendering::allRays(camera, config);
+}
+
+//-----------------------------------------------------------------------------
+// Backends
+//-----------------------------------------------------------------------------
+struct BackendResult{
+	std::string name;
+	double seconds;
+	std::vector<RayIntersection> intersections;
+};
+
+template<typename TraceFunc>
+BackendResult timeBackend(std::string name, const std::vector<Ray>& rays, TraceFunc trace){
+	BackendResult result;
+	result.name = name;
+	result.intersections.reserve(rays.size());
+
+	auto start = std::chrono::steady_clock::now();
+	for(const Ray& ray : rays){
+		result.intersections.push_back(trace(ray));
+	}
+	result.seconds = secondsSince(start);
+	return result;
+}
+
+struct Comparison{
+	Int64 num_discrepancies;
+
+	// Hits on different voxels or faces at (nearly) the same t. These are
+	// rays grazing an edge or corner, where float rounding decides which
+	// neighbor gets reported. Both answers are valid.
+	Int64 num_ties;
+};
+
+Comparison compareResults(const BackendResult& reference, const BackendResult& result,
+	const std::vector<Ray>& rays){
+	/*
+	Two results agree if both missed, or both hit the same face of the same
+	voxel with the same palette index. Values of t are allowed to drift.
+	*/
+
+	constexpr Int32 ARBITRARY_MAX_PRINTED_DISCREPANCIES = 5;
+	constexpr float ARBITRARY_TIE_TOLERANCE = 0.001;
+
+	Comparison comparison = {0, 0};
+	for(Uint64 i = 0; i < rays.size(); ++i){
+		const RayIntersection& a = reference.intersections[i];
+		const RayIntersection& b = result.intersections[i];
+		bool is_hit_a = isValid(a);
+		bool is_hit_b = isValid(b);
+
+		bool is_match = is_hit_a == is_hit_b;
+		if(is_match && is_hit_a){
+			is_match =
+				a.voxel_hit.voxel == b.voxel_hit.voxel &&
+				a.voxel_hit.face_index == b.voxel_hit.face_index &&
+				a.voxel_hit.palette_index == b.voxel_hit.palette_index;
+		}
+		if(is_match){
+			continue;
+		}
+		if(is_hit_a && is_hit_b && abs(a.t_hit - b.t_hit) < ARBITRARY_TIE_TOLERANCE){
+			++comparison.num_ties;
+			continue;
+		}
+
+		if(comparison.num_discrepancies < ARBITRARY_MAX_PRINTED_DISCREPANCIES){
+			const Ray& ray = rays[i];
+			printf("\t[%s] Ray %lu: origin (%f, %f, %f) dir (%f, %f, %f)\n",
+				result.name.c_str(), i,
+				ray.origin.x, ray.origin.y, ray.origin.z,
+				ray.dir.x, ray.dir.y, ray.dir.z);
+			printf("\t\tExpected %s t=%f voxel (%i, %i, %i) face %i\n",
+				INTERSECTION_TYPE_STRINGS[a.type], a.t_hit,
+				a.voxel_hit.voxel.x, a.voxel_hit.voxel.y, a.voxel_hit.voxel.z,
+				a.voxel_hit.face_index);
+			printf("\t\tGot      %s t=%f voxel (%i, %i, %i) face %i\n",
+				INTERSECTION_TYPE_STRINGS[b.type], b.t_hit,
+				b.voxel_hit.voxel.x, b.voxel_hit.voxel.y, b.voxel_hit.voxel.z,
+				b.voxel_hit.face_index);
+		}
+		++comparison.num_discrepancies;
+	}
+	return comparison;
+}
+
+void printResult(const BackendResult& result, Comparison comparison){
+	Int64 num_hits = 0;
+	for(const RayIntersection& intersection : result.intersections){
+		num_hits += isValid(intersection);
+	}
+
+	double num_rays = (double) result.intersections.size();
+	printf("%-32s %9.3f Mrays/s  %6.2f%% hits  %li discrepancies  %li edge ties\n",
+		result.name.c_str(),
+		num_rays / result.seconds / 1000000.0,
+		100.0 * num_hits / num_rays,
+		comparison.num_discrepancies,
+		comparison.num_ties);
+}
+
+VoxelKDTree::TreeData* buildTimedTree(const ChunkTable& table,
+	VoxelKDTree::BuildSettings settings, const char* name){
+
+	auto start = std::chrono::steady_clock::now();
+	VoxelKDTree::TreeData* tree = VoxelKDTree::TreeBuilder::buildTree(table, settings);
+	assert(tree != NULL);
+	printf("Built %s: %lu nodes, depth %i, %.2fs\n",
+		name, tree->node_count, tree->curr_max_depth, secondsSince(start));
+	return tree;
+}
+
+//-----------------------------------------------------------------------------
+// Main
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv){
+	HarnessSettings settings = parseArgs(argc, argv);
+	printf("Algorithm %s | Seed %i | %li %s rays | MaxDepth %i | %i threads\n",
+		settings.algorithm_name.c_str(), settings.seed, settings.num_rays,
+		settings.use_camera_rays ? "camera" : "random",
+		settings.max_depth, settings.num_threads);
+
+	ChunkTable table;
+	auto world_start = std::chrono::steady_clock::now();
+	generateWorld(table, settings);
+	printf("Generated world in %.2fs\n", secondsSince(world_start));
+
+	// Build every tree variant
+	VoxelKDTree::BuildSettings tree_settings;
+	tree_settings.max_depth = settings.max_depth;
+	tree_settings.mandatory_leaf_volume = 1;
+	tree_settings.should_differentiate_types = true;
+	tree_settings.bounds = table.boundingVolumeChunkspace() * CHUNK_LEN;
+
+	VoxelKDTree::TreeData* stack_tree = buildTimedTree(table, tree_settings, "VKDTree");
+	tree_settings.should_generate_ropes = true;
+	VoxelKDTree::TreeData* rope_tree = buildTimedTree(table, tree_settings, "VKDTree+Ropes");
+	tree_settings.should_cluster_treelets = true;
+	VoxelKDTree::TreeData* treelet_tree = buildTimedTree(
+		table, tree_settings, "VKDTree+Ropes+Treelets");
+	tree_settings.optimization_level = OPTIMIZE_EXHAUSTIVE;
+	VoxelKDTree::TreeData* sah_tree = buildTimedTree(
+		table, tree_settings, "VKDTree+Ropes+Treelets+SAH");
+
+	std::vector<Ray> rays;
+	if(settings.use_camera_rays){
+		rays = cameraRays(table, settings.num_rays);
+	}else{
+		rays = randomRays(table, settings.num_rays, settings.seed);
+	}
+
+	// Closest hit
+	printf("\nClosest hit (single thread):\n");
+	BackendResult reference = timeBackend("intersectChunks", rays,
+		[&table](Ray ray){
+			return Intersection::intersectChunks(ray, &table);
+		});
+	printResult(reference, {0, 0});
+
+	Int64 total_discrepancies = 0;
+	constexpr Int32 NUM_TREES = 4;
+	const VoxelKDTree::TreeData* trees[NUM_TREES] = {
+		stack_tree, rope_tree, treelet_tree, sah_tree
+	};
+	const char* tree_names[NUM_TREES] = {
+		"intersectTree (stack)",
+		"intersectTree (ropes)",
+		"intersectTree (ropes+treelets)",
+		"intersectTree (SAH)"
+	};
+	for(int i = 0; i < NUM_TREES; ++i){
+		const VoxelKDTree::TreeData* tree = trees[i];
+		Intersection::Utils::VKDTStack stack = Intersection::Utils::VKDTStack::init(
+			tree->curr_max_depth);
+		BackendResult result = timeBackend(tree_names[i], rays,
+			[tree, &stack, &table](Ray ray){
+				stack.height = 0;
+				return Intersection::intersectTree(ray, tree, stack, &table);
+			});
+		stack.freeMemory();
+
+		Comparison comparison = compareResults(reference, result, rays);
+		total_discrepancies += comparison.num_discrepancies;
+		printResult(result, comparison);
+	}
+
+	// Batched, multithreaded
+	printf("\nClosest hit (batched, %i threads):\n", settings.num_threads);
+	Intersection::Batch::RayBatch batch;
+	batch.reserve(rays.size());
+	for(const Ray& ray : rays){
+		batch.push(ray);
+	}
+	Intersection::Batch::BatchSettings batch_settings;
+	batch_settings.num_threads = settings.num_threads;
+	for(int i = 0; i < NUM_TREES; ++i){
+		Intersection::Batch::Scene scene = {trees[i], &table, NULL};
+		BackendResult result;
+		result.name = std::string("intersectBatch ") + (tree_names[i] + strlen("intersectTree "));
+		auto start = std::chrono::steady_clock::now();
+		result.intersections = Intersection::Batch::intersectBatch(batch, scene, batch_settings);
+		result.seconds = secondsSince(start);
+
+		Comparison comparison = compareResults(reference, result, rays);
+		total_discrepancies += comparison.num_discrepancies;
+		printResult(result, comparison);
+	}
+
+	// Occlusion. Only hit or miss is compared.
+	printf("\nOcclusion (single thread):\n");
+	auto compare_occlusion = [&reference](const BackendResult& result){
+		Comparison comparison = {0, 0};
+		for(Uint64 i = 0; i < result.intersections.size(); ++i){
+			bool is_occluded = result.intersections[i].type != INTERSECT_MISS;
+			comparison.num_discrepancies += is_occluded != isValid(reference.intersections[i]);
+		}
+		return comparison;
+	};
+	auto as_intersection = [](bool is_occluded){
+		RayIntersection intersection{is_occluded ? INTERSECT_HIT_CHUNK_VOXEL : INTERSECT_MISS};
+		return intersection;
+	};
+
+	BackendResult chunk_occlusion = timeBackend("occluded (chunks)", rays,
+		[&table, &as_intersection](Ray ray){
+			return as_intersection(Intersection::occluded(ray, LARGE_FLOAT, &table));
+		});
+	Comparison comparison = compare_occlusion(chunk_occlusion);
+	total_discrepancies += comparison.num_discrepancies;
+	printResult(chunk_occlusion, comparison);
+
+	Intersection::Utils::VKDTStack stack = Intersection::Utils::VKDTStack::init(
+		treelet_tree->curr_max_depth);
+	BackendResult tree_occlusion = timeBackend("occluded (treelets)", rays,
+		[treelet_tree, &stack, &table, &as_intersection](Ray ray){
+			stack.height = 0;
+			return as_intersection(Intersection::occluded(
+				ray, LARGE_FLOAT, treelet_tree, stack, &table));
+		});
+	stack.freeMemory();
+	comparison = compare_occlusion(tree_occlusion);
+	total_discrepancies += comparison.num_discrepancies;
+	printResult(tree_occlusion, comparison);
+
+	VoxelKDTree::freeTreeData(stack_tree);
+	VoxelKDTree::freeTreeData(rope_tree);
+	VoxelKDTree::freeTreeData(treelet_tree);
+	VoxelKDTree::freeTreeData(sah_tree);
+
+	printf("\nTotal discrepancies: %li\n", total_discrepancies);
+	return total_discrepancies == 0 ? 0 : 1;
+}